@@ -61,6 +61,18 @@ static unsigned int vcm = 0x0a; /* VCOMH=VREG1OUT*0.735 */
 module_param(vcm, uint, 0444);
 MODULE_PARM_DESC(vcm, "Set the internal VcomH voltage (ili9325)");
 
+struct fb_ili9325
+{
+    struct tinydrm_ili9325 ili9325;
+    /* Parsed once on probe */
+    u16 gamma_curves[2 * 10];
+};
+
+static inline struct fb_ili9325 *to_fb_ili9325(struct tinydrm_ili9325 *ili9325)
+{
+    return container_of(ili9325, struct fb_ili9325, ili9325);
+}
+
 /*
  * Verify that this configuration is within the Voltage limits
  *
@@ -102,7 +114,6 @@ MODULE_PARM_DESC(vcm, "Set the internal VcomH voltage (ili9325)");
 static void tinydrm_ili9325_set_rotation(struct tinydrm_ili9325 *ili9325)
 {
     struct device *dev = ili9325->tinydrm.drm->dev;
-    struct regmap *reg = ili9325->reg;
     bool bgr;
 
     if (no_rotation)
@@ -114,16 +125,16 @@ static void tinydrm_ili9325_set_rotation(struct tinydrm_ili9325 *ili9325)
     {
     /* AM: GRAM update direction */
     case 0:
-        regmap_write(reg, 0x0003, 0x0030 | (bgr << 12));
+        tinydrm_ili9325_update(ili9325, 0x0003, 0x0030 | (bgr << 12));
         break;
     case 180:
-        regmap_write(reg, 0x0003, 0x0000 | (bgr << 12));
+        tinydrm_ili9325_update(ili9325, 0x0003, 0x0000 | (bgr << 12));
         break;
     case 270:
-        regmap_write(reg, 0x0003, 0x0028 | (bgr << 12));
+        tinydrm_ili9325_update(ili9325, 0x0003, 0x0028 | (bgr << 12));
         break;
     case 90:
-        regmap_write(reg, 0x0003, 0x0018 | (bgr << 12));
+        tinydrm_ili9325_update(ili9325, 0x0003, 0x0018 | (bgr << 12));
         break;
     }
 }
@@ -136,7 +147,6 @@ static void tinydrm_ili9325_set_rotation(struct tinydrm_ili9325 *ili9325)
 static void tinydrm_ili9325_set_gamma(struct tinydrm_ili9325 *ili9325,
                                       u16 *curves)
 {
-    struct regmap *reg = ili9325->reg;
     u16 vrp[2] = {curves[0] & 0x1f, curves[1] & 0x1f};
     u16 rp[2] = {curves[2] & 0x07, curves[3] & 0x07};
     u16 kp[6];
@@ -151,17 +161,17 @@ static void tinydrm_ili9325_set_gamma(struct tinydrm_ili9325 *ili9325,
         kn[i] = curves[i + 4 + 10] & 0x7;
     }
 
-    regmap_write(reg, 0x0030, kp[1] << 8 | kp[0]);
-    regmap_write(reg, 0x0031, kp[3] << 8 | kp[2]);
-    regmap_write(reg, 0x0032, kp[5] << 8 | kp[4]);
-    regmap_write(reg, 0x0035, rp[1] << 8 | rp[0]);
-    regmap_write(reg, 0x0036, vrp[1] << 8 | vrp[0]);
-
-    regmap_write(reg, 0x0037, kn[1] << 8 | kn[0]);
-    regmap_write(reg, 0x0038, kn[3] << 8 | kn[2]);
-    regmap_write(reg, 0x0039, kn[5] << 8 | kn[4]);
-    regmap_write(reg, 0x003C, rn[1] << 8 | rn[0]);
-    regmap_write(reg, 0x003D, vrn[1] << 8 | vrn[0]);
+    tinydrm_ili9325_update(ili9325, 0x0030, kp[1] << 8 | kp[0]);
+    tinydrm_ili9325_update(ili9325, 0x0031, kp[3] << 8 | kp[2]);
+    tinydrm_ili9325_update(ili9325, 0x0032, kp[5] << 8 | kp[4]);
+    tinydrm_ili9325_update(ili9325, 0x0035, rp[1] << 8 | rp[0]);
+    tinydrm_ili9325_update(ili9325, 0x0036, vrp[1] << 8 | vrp[0]);
+
+    tinydrm_ili9325_update(ili9325, 0x0037, kn[1] << 8 | kn[0]);
+    tinydrm_ili9325_update(ili9325, 0x0038, kn[3] << 8 | kn[2]);
+    tinydrm_ili9325_update(ili9325, 0x0039, kn[5] << 8 | kn[4]);
+    tinydrm_ili9325_update(ili9325, 0x003C, rn[1] << 8 | rn[0]);
+    tinydrm_ili9325_update(ili9325, 0x003D, vrn[1] << 8 | vrn[0]);
 }
 
 static void fb_ili9325_pipe_enable(struct drm_simple_display_pipe *pipe,
@@ -169,27 +179,21 @@ static void fb_ili9325_pipe_enable(struct drm_simple_display_pipe *pipe,
 {
     struct tinydrm_device *tdev = pipe_to_tinydrm(pipe);
     struct tinydrm_ili9325 *ili9325 = tinydrm_to_ili9325(tdev);
-    struct drm_framebuffer *fb = pipe->plane.fb;
     struct regmap *reg = ili9325->reg;
     struct device *dev = tdev->drm->dev;
-    u16 gamma_curves[2 * 10];
     unsigned int devcode;
     int ret;
 
-    ret = tinydrm_fbtft_get_gamma(dev, gamma_curves,
-                                  FB_ILI9325_DEFAULT_GAMMA, 2, 10);
-    if (ret)
-    {
-        dev_err(dev, "Failed to get gamma\n");
-        return;
-    }
+    /* Runtime resume has already woken the controller up from standby */
+    if (ili9325->retained)
+        goto out_enable;
 
     tinydrm_ili9325_reset(ili9325);
 
     if (!regmap_read(reg, 0x0000, &devcode))
         DRM_DEBUG_DRIVER("devcode=%x\n", devcode);
 
-    ret = tinydrm_fbtft_init(dev, reg);
+    ret = tinydrm_fbtft_init(dev, reg, &ili9325->stream);
     if (!ret)
     {
         goto set_rotation;
@@ -270,12 +274,10 @@ static void fb_ili9325_pipe_enable(struct drm_simple_display_pipe *pipe,
 
 set_rotation:
     tinydrm_ili9325_set_rotation(ili9325);
-    tinydrm_ili9325_set_gamma(ili9325, gamma_curves);
+    tinydrm_ili9325_set_gamma(ili9325, to_fb_ili9325(ili9325)->gamma_curves);
 
-    ili9325->enabled = true;
-    fb->funcs->dirty(fb, NULL, 0, 0, NULL, 0);
-
-    tinydrm_enable_backlight(ili9325->backlight);
+out_enable:
+    tinydrm_ili9325_enable_flush(ili9325);
 }
 
 static void fb_ili9325_pipe_disable(struct drm_simple_display_pipe *pipe)
@@ -283,13 +285,19 @@ static void fb_ili9325_pipe_disable(struct drm_simple_display_pipe *pipe)
     struct tinydrm_device *tdev = pipe_to_tinydrm(pipe);
     struct tinydrm_ili9325 *ili9325 = tinydrm_to_ili9325(tdev);
 
+    tinydrm_disable_backlight(ili9325->backlight);
+
+    mutex_lock(&tdev->dirty_lock);
     ili9325->enabled = false;
+    mutex_unlock(&tdev->dirty_lock);
+
+    /* Standby is entered by runtime suspend after the autosuspend delay */
 }
 
 static const struct drm_simple_display_pipe_funcs fb_ili9325_funcs = {
     .enable = fb_ili9325_pipe_enable,
     .disable = fb_ili9325_pipe_disable,
-    .update = tinydrm_display_pipe_update,
+    .update = tinydrm_display_pipe_damage_update,
     .prepare_fb = tinydrm_display_pipe_prepare_fb,
 };
 
@@ -298,27 +306,21 @@ static void fb_ili9320_pipe_enable(struct drm_simple_display_pipe *pipe,
 {
     struct tinydrm_device *tdev = pipe_to_tinydrm(pipe);
     struct tinydrm_ili9325 *ili9325 = tinydrm_to_ili9325(tdev);
-    struct drm_framebuffer *fb = pipe->plane.fb;
     struct regmap *reg = ili9325->reg;
     struct device *dev = tdev->drm->dev;
-    u16 gamma_curves[2 * 10];
     unsigned int devcode;
     int ret;
 
-    ret = tinydrm_fbtft_get_gamma(dev, gamma_curves,
-                                  FB_ILI9320_DEFAULT_GAMMA, 2, 10);
-    if (ret)
-    {
-        dev_err(dev, "Failed to get gamma\n");
-        return;
-    }
+    /* Runtime resume has already woken the controller up from standby */
+    if (ili9325->retained)
+        goto out_enable;
 
     tinydrm_ili9325_reset(ili9325);
 
     if (!regmap_read(reg, 0x0000, &devcode))
         DRM_DEBUG_DRIVER("devcode=%x\n", devcode);
 
-    ret = tinydrm_fbtft_init(dev, reg);
+    ret = tinydrm_fbtft_init(dev, reg, &ili9325->stream);
     if (!ret)
     {
         goto set_rotation;
@@ -378,25 +380,25 @@ static void fb_ili9320_pipe_enable(struct drm_simple_display_pipe *pipe,
     regmap_write(reg, 0x0013, 0x0000);
 
     /* Dis-charge capacitor power voltage */
-    mdelay(200);
+    msleep(200);
 
     /* SAP, BT[3:0], AP, DSTB, SLP, STB */
     regmap_write(reg, 0x0010, 0x17B0);
 
     /* R11h=0x0031 at VCI=3.3V DC1[2:0], DC0[2:0], VC[2:0] */
     regmap_write(reg, 0x0011, 0x0031);
-    mdelay(50);
+    msleep(50);
 
     /* R12h=0x0138 at VCI=3.3V VREG1OUT voltage */
     regmap_write(reg, 0x0012, 0x0138);
-    mdelay(50);
+    msleep(50);
 
     /* R13h=0x1800 at VCI=3.3V VDV[4:0] for VCOM amplitude */
     regmap_write(reg, 0x0013, 0x1800);
 
     /* R29h=0x0008 at VCI=3.3V VCM[4:0] for VCOMH */
     regmap_write(reg, 0x0029, 0x0008);
-    mdelay(50);
+    msleep(50);
 
     /* GRAM horizontal Address */
     regmap_write(reg, 0x0020, 0x0000);
@@ -445,18 +447,16 @@ static void fb_ili9320_pipe_enable(struct drm_simple_display_pipe *pipe,
 
 set_rotation:
     tinydrm_ili9325_set_rotation(ili9325);
-    tinydrm_ili9325_set_gamma(ili9325, gamma_curves);
+    tinydrm_ili9325_set_gamma(ili9325, to_fb_ili9325(ili9325)->gamma_curves);
 
-    ili9325->enabled = true;
-    fb->funcs->dirty(fb, NULL, 0, 0, NULL, 0);
-
-    tinydrm_enable_backlight(ili9325->backlight);
+out_enable:
+    tinydrm_ili9325_enable_flush(ili9325);
 }
 
 static const struct drm_simple_display_pipe_funcs fb_ili9320_funcs = {
     .enable = fb_ili9320_pipe_enable,
     .disable = fb_ili9325_pipe_disable,
-    .update = tinydrm_display_pipe_update,
+    .update = tinydrm_display_pipe_damage_update,
     .prepare_fb = tinydrm_display_pipe_prepare_fb,
 };
 
@@ -479,17 +479,34 @@ static struct drm_driver fb_ili9325_driver = {
 
 static struct tinydrm_ili9325 *
 fb_ili9325_probe_common(struct device *dev, struct regmap *reg,
+                        const struct tinydrm_regmap_stream *stream,
                         const struct drm_simple_display_pipe_funcs *funcs)
 {
     struct tinydrm_ili9325 *ili9325;
     struct tinydrm_device *tdev;
+    struct fb_ili9325 *fbili;
+    const char *gamma;
     u32 rotation = 0;
     int ret;
 
-    ili9325 = devm_kzalloc(dev, sizeof(*ili9325), GFP_KERNEL);
-    if (!ili9325)
+    fbili = devm_kzalloc(dev, sizeof(*fbili), GFP_KERNEL);
+    if (!fbili)
         return ERR_PTR(-ENOMEM);
 
+    ili9325 = &fbili->ili9325;
+
+    if (funcs == &fb_ili9320_funcs)
+        gamma = FB_ILI9320_DEFAULT_GAMMA;
+    else
+        gamma = FB_ILI9325_DEFAULT_GAMMA;
+
+    ret = tinydrm_fbtft_get_gamma(dev, fbili->gamma_curves, gamma, 2, 10);
+    if (ret)
+    {
+        dev_err(dev, "Failed to get gamma\n");
+        return ERR_PTR(ret);
+    }
+
     ili9325->reset = devm_gpiod_get_optional(dev, "reset", GPIOD_OUT_HIGH);
     if (IS_ERR(ili9325->reset))
     {
@@ -503,8 +520,8 @@ fb_ili9325_probe_common(struct device *dev, struct regmap *reg,
 
     tinydrm_fbtft_get_rotation(dev, &rotation);
 
-    ret = tinydrm_ili9325_init(dev, ili9325, funcs, reg, &fb_ili9325_driver,
-                               &fb_ili9325_mode, rotation);
+    ret = tinydrm_ili9325_init(dev, ili9325, funcs, reg, stream,
+                               &fb_ili9325_driver, &fb_ili9325_mode, rotation);
     if (ret)
         return ERR_PTR(ret);
 
@@ -513,6 +530,8 @@ fb_ili9325_probe_common(struct device *dev, struct regmap *reg,
     if (ret)
         return ERR_PTR(ret);
 
+    tinydrm_fbdev_init_deferred_io(tdev);
+
     return ili9325;
 }
 
@@ -536,6 +555,7 @@ MODULE_DEVICE_TABLE(of, fb_ili9325_of_match);
 static int fb_ili9325_probe_spi(struct spi_device *spi)
 {
     const struct drm_simple_display_pipe_funcs *funcs;
+    struct tinydrm_regmap_stream stream = {};
     const struct spi_device_id *spi_id;
     const struct of_device_id *match;
     struct tinydrm_ili9325 *ili9325;
@@ -565,11 +585,11 @@ static int fb_ili9325_probe_spi(struct spi_device *spi)
         }
     }
 
-    reg = tinydrm_ili9325_spi_init(spi, 0);
+    reg = tinydrm_ili9325_spi_init(spi, 0, &stream);
     if (IS_ERR(reg))
         return PTR_ERR(reg);
 
-    ili9325 = fb_ili9325_probe_common(dev, reg, funcs);
+    ili9325 = fb_ili9325_probe_common(dev, reg, &stream, funcs);
     if (IS_ERR(ili9325))
         return PTR_ERR(ili9325);
 
@@ -585,6 +605,7 @@ static int fb_ili9325_probe_spi(struct spi_device *spi)
 static int fb_ili9325_probe_pdev(struct platform_device *pdev)
 {
     const struct drm_simple_display_pipe_funcs *funcs;
+    struct tinydrm_regmap_stream stream = {};
     const struct platform_device_id *pdev_id;
     const struct of_device_id *match;
     struct device *dev = &pdev->dev;
@@ -632,11 +653,11 @@ static int fb_ili9325_probe_pdev(struct platform_device *pdev)
         return PTR_ERR(db);
     }
 
-    reg = tinydrm_i80_init(dev, 16, cs, dc, wr, db);
+    reg = tinydrm_ili9325_i80_init(dev, cs, dc, wr, db, &stream);
     if (IS_ERR(reg))
         return PTR_ERR(reg);
 
-    ili9325 = fb_ili9325_probe_common(dev, reg, funcs);
+    ili9325 = fb_ili9325_probe_common(dev, reg, &stream, funcs);
     if (IS_ERR(ili9325))
         return PTR_ERR(ili9325);
 
@@ -659,7 +680,9 @@ static struct spi_driver fb_ili9325_spi_driver = {
     .driver = {
         .name = "fb_ili9325",
         .owner = THIS_MODULE,
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
         .of_match_table = of_match_ptr(fb_ili9325_of_match),
+        .pm = &tinydrm_ili9325_pm_ops,
     },
     .id_table = fb_ili9325_spi_ids,
     .probe = fb_ili9325_probe_spi,
@@ -676,7 +699,9 @@ static struct platform_driver fb_ili9325_platform_driver = {
     .driver = {
         .name = "fb_ili9325",
         .owner = THIS_MODULE,
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
         .of_match_table = of_match_ptr(fb_ili9325_of_match),
+        .pm = &tinydrm_ili9325_pm_ops,
     },
     .id_table = fb_ili9325_platform_ids,
     .probe = fb_ili9325_probe_pdev,
@@ -23,6 +23,7 @@
 #include <drm/drm_modeset_helper.h>
 #include <drm/tinydrm/mipi-dbi.h>
 #include <drm/tinydrm/tinydrm-helpers.h>
+#include <drm/tinydrm/tinydrm-mipi-dbi.h>
 
 #include "tinydrm-fbtft.h"
 
@@ -44,10 +45,15 @@ enum fb_mipi_dbi_variant
 
 struct fb_mipi_dbi
 {
-    struct mipi_dbi dbi;
+    struct tinydrm_mipi_dbi tmipi;
     enum fb_mipi_dbi_variant variant;
 };
 
+static inline struct fb_mipi_dbi *to_fb_mipi_dbi(struct mipi_dbi *dbi)
+{
+    return container_of(dbi, struct fb_mipi_dbi, tmipi.mipi);
+}
+
 #define MADCTL_MY BIT(7) /* MY row address order */
 #define MADCTL_MX BIT(6) /* MX column address order */
 #define MADCTL_MV BIT(5) /* MV row / column exchange */
@@ -58,18 +64,6 @@ struct fb_mipi_dbi
 #define ILI9481_HFLIP BIT(0)
 #define ILI9481_VFLIP BIT(1)
 
-/* Available in 4.17 */
-static void mipi_dbi_enable_flush(struct mipi_dbi *mipi)
-{
-    struct drm_framebuffer *fb = mipi->tinydrm.pipe.plane.fb;
-
-    mipi->enabled = true;
-    if (fb)
-        fb->funcs->dirty(fb, NULL, 0, 0, NULL, 0);
-
-    tinydrm_enable_backlight(mipi->backlight);
-}
-
 /* Available in 4.17 */
 static int mipi_dbi_poweron_reset(struct mipi_dbi *mipi)
 {
@@ -97,7 +91,7 @@ static int mipi_dbi_poweron_reset(struct mipi_dbi *mipi)
     return 0;
 }
 
-static void fb_mipi_dbi_rotate(struct mipi_dbi *dbi, u8 rotate0, u8 rotate90, u8 rotate180, u8 rotate270)
+static u8 fb_mipi_dbi_rotate(struct mipi_dbi *dbi, u8 rotate0, u8 rotate90, u8 rotate180, u8 rotate270)
 {
     bool bgr = device_property_present(dbi->tinydrm.drm->dev, "bgr");
     u8 addr_mode;
@@ -119,7 +113,16 @@ static void fb_mipi_dbi_rotate(struct mipi_dbi *dbi, u8 rotate0, u8 rotate90, u8
     }
     if (bgr)
         addr_mode |= MADCTL_BGR;
-    mipi_dbi_command(dbi, MIPI_DCS_SET_ADDRESS_MODE, addr_mode);
+
+    return addr_mode;
+}
+
+/* RGB565 unless the panel is wired for RGB666 only */
+static void fb_mipi_dbi_set_pixel_format(struct mipi_dbi *dbi)
+{
+    struct tinydrm_mipi_dbi *tmipi = &to_fb_mipi_dbi(dbi)->tmipi;
+
+    tinydrm_mipi_dbi_set_pixel_format(tmipi, tmipi->bpp == 18 ? 18 : 16);
 }
 
 static void fb_hx8340bn_enable(struct mipi_dbi *dbi)
@@ -302,8 +305,7 @@ static void fb_hx8357d_enable(struct mipi_dbi *dbi)
                      0x02, 0x0A, 0x11, 0x1d, 0x23, 0x35, 0x41, 0x4b, 0x4b, 0x42, 0x3A, 0x27, 0x1B, 0x08, 0x09, 0x03, 0x02,
                      0x0A, 0x11, 0x1d, 0x23, 0x35, 0x41, 0x4b, 0x4b, 0x42, 0x3A, 0x27, 0x1B, 0x08, 0x09, 0x03, 0x00, 0x01);
 
-    /* 16 bit */
-    mipi_dbi_command(dbi, MIPI_DCS_SET_PIXEL_FORMAT, 0x55);
+    fb_mipi_dbi_set_pixel_format(dbi);
 
     mipi_dbi_command(dbi, MIPI_DCS_SET_ADDRESS_MODE, 0xC0);
 
@@ -437,7 +439,7 @@ static void fb_ili9481_enable(struct mipi_dbi *dbi)
     /* Frame rate & inv. */
     mipi_dbi_command(dbi, 0xC5, 0x03);
     /* Pixel format */
-    mipi_dbi_command(dbi, MIPI_DCS_SET_PIXEL_FORMAT, 0x55);
+    fb_mipi_dbi_set_pixel_format(dbi);
     /* Gamma */
     mipi_dbi_command(dbi, 0xC8, 0x00, 0x32, 0x36, 0x45, 0x06, 0x16,
                      0x37, 0x75, 0x77, 0x54, 0x0C, 0x00);
@@ -454,7 +456,7 @@ static void fb_ili9486_enable(struct mipi_dbi *dbi)
     mipi_dbi_command(dbi, MIPI_DCS_EXIT_SLEEP_MODE);
     msleep(250);
     /* Interface Pixel Format */
-    mipi_dbi_command(dbi, MIPI_DCS_SET_PIXEL_FORMAT, 0x55);
+    fb_mipi_dbi_set_pixel_format(dbi);
     /* Power Control 3 */
     mipi_dbi_command(dbi, 0xC2, 0x44);
     /* VCOM Control 1 */
@@ -705,59 +707,89 @@ static void fb_tinylcd_enable(struct mipi_dbi *dbi)
     mipi_dbi_command(dbi, 0xB6, 0x00, 0x22, 0x3B);
 }
 
-#define FBTFT_INIT_CMD BIT(24)
-#define FBTFT_INIT_DELAY BIT(25)
-
+/* The init sequence is parsed once and replayed from the cache */
 static int fb_mipi_dbi_init_display_dt(struct mipi_dbi *dbi)
 {
     struct device *dev = dbi->tinydrm.drm->dev;
-    struct property *prop;
-    const __be32 *p;
-    unsigned int i;
-    u8 buf[64];
-    u32 val;
-
-    prop = of_find_property(dev->of_node, "init", NULL);
-    p = of_prop_next_u32(prop, NULL, &val);
-    if (!p)
+    int ret;
+
+    ret = tinydrm_fbtft_init_dcs(dev, dbi);
+    if (ret == -ENOENT)
         return 0;
+    if (ret)
+    {
+        dev_err(dev, "Failed to run the init sequence %d\n", ret);
+        return ret;
+    }
 
-    DRM_DEBUG_KMS("\n");
+    return 1;
+}
+
+/* Returns the MIPI_DCS_SET_ADDRESS_MODE value for the rotation */
+static int fb_mipi_dbi_addr_mode(struct fb_mipi_dbi *fbdbi)
+{
+    struct mipi_dbi *dbi = &fbdbi->tmipi.mipi;
 
-    while (p)
+    switch (fbdbi->variant)
     {
-        if (val & FBTFT_INIT_CMD)
-        {
-            val &= 0xffff;
-            i = 0;
-            while (p && !(val & 0xffff0000))
-            {
-                if (i > 63)
-                {
-                    dev_err(dev, "%s: Maximum register values exceeded\n", __func__);
-                    return -EINVAL;
-                }
-                buf[i++] = val;
-                p = of_prop_next_u32(prop, p, &val);
-            }
-
-            mipi_dbi_command_buf(dbi, buf[0], &buf[1], i - 1);
-        }
-        else if (val & FBTFT_INIT_DELAY)
-        {
-            val &= 0xffff;
-            DRM_DEBUG_DRIVER("msleep(%u)\n", val);
-            msleep(val);
-            p = of_prop_next_u32(prop, p, &val);
-        }
-        else
-        {
-            dev_err(dev, "illegal init value 0x%X\n", val);
-            return -EINVAL;
-        }
+    case MIPI_DBI_FB_HX8340BN:
+        return fb_mipi_dbi_rotate(dbi, 0,
+                                  MADCTL_MY | MADCTL_MV,
+                                  MADCTL_MX | MADCTL_MY,
+                                  MADCTL_MX | MADCTL_MV);
+    case MIPI_DBI_FB_HX8353D:
+        return fb_mipi_dbi_rotate(dbi, MADCTL_MX | MADCTL_MY,
+                                  MADCTL_MX | MADCTL_MV,
+                                  0,
+                                  MADCTL_MY | MADCTL_MV);
+    case MIPI_DBI_FB_HX8357D:
+        return fb_mipi_dbi_rotate(dbi, MADCTL_MX | MADCTL_MY,
+                                  MADCTL_MY | MADCTL_MV,
+                                  0,
+                                  MADCTL_MX | MADCTL_MV);
+    case MIPI_DBI_FB_ILI9340:
+        return fb_mipi_dbi_rotate(dbi, MADCTL_MX,
+                                  MADCTL_MV | MADCTL_MY | MADCTL_MX,
+                                  MADCTL_MY,
+                                  MADCTL_MV);
+    case MIPI_DBI_FB_ILI9341:
+        return fb_mipi_dbi_rotate(dbi, MADCTL_MX,
+                                  MADCTL_MV | MADCTL_MY | MADCTL_MX,
+                                  MADCTL_MY,
+                                  MADCTL_MV | MADCTL_ML);
+    case MIPI_DBI_FB_ILI9481:
+        return fb_mipi_dbi_rotate(dbi, ILI9481_HFLIP,
+                                  MADCTL_MV,
+                                  ILI9481_VFLIP,
+                                  MADCTL_MV | ILI9481_VFLIP | ILI9481_HFLIP);
+    case MIPI_DBI_FB_ILI9486:
+        return fb_mipi_dbi_rotate(dbi, MADCTL_MY,
+                                  MADCTL_MV,
+                                  MADCTL_MX,
+                                  MADCTL_MY | MADCTL_MX | MADCTL_MV);
+    case MIPI_DBI_FB_S6D02A1:
+        return fb_mipi_dbi_rotate(dbi, MADCTL_MX | MADCTL_MY,
+                                  MADCTL_MX | MADCTL_MV,
+                                  0,
+                                  MADCTL_MY | MADCTL_MV);
+    case MIPI_DBI_FB_ST7735R:
+        return fb_mipi_dbi_rotate(dbi, MADCTL_MX | MADCTL_MY,
+                                  MADCTL_MX | MADCTL_MV,
+                                  0,
+                                  MADCTL_MY | MADCTL_MV);
+    case MIPI_DBI_FB_ST7789V:
+        return fb_mipi_dbi_rotate(dbi, 0,
+                                  MADCTL_MY | MADCTL_MV,
+                                  MADCTL_MX | MADCTL_MY,
+                                  MADCTL_MX | MADCTL_MV);
+    case MIPI_DBI_FB_TINYLCD:
+        return fb_mipi_dbi_rotate(dbi, 0x08,
+                                  0x38,
+                                  0x58,
+                                  0x28);
     }
 
-    return 1;
+    return -1;
 }
 
 static void fb_mipi_dbi_enable(struct drm_simple_display_pipe *pipe,
@@ -765,11 +797,31 @@ static void fb_mipi_dbi_enable(struct drm_simple_display_pipe *pipe,
 {
     struct tinydrm_device *tdev = pipe_to_tinydrm(pipe);
     struct mipi_dbi *dbi = mipi_dbi_from_tinydrm(tdev);
-    struct fb_mipi_dbi *fbdbi = container_of(dbi, struct fb_mipi_dbi, dbi);
+    struct fb_mipi_dbi *fbdbi = to_fb_mipi_dbi(dbi);
+    struct device *dev = tdev->drm->dev;
+    int addr_mode = -1;
+    unsigned int bpp = 0;
     int ret;
 
     DRM_DEBUG_KMS("\n");
 
+    /* The address mode is unknown when set by the DT init sequence */
+    fbdbi->tmipi.scroll_usable = false;
+
+    if (!of_find_property(dev->of_node, "init", NULL))
+    {
+        addr_mode = fb_mipi_dbi_addr_mode(fbdbi);
+        bpp = fbdbi->tmipi.bpp == 18 ? 18 : 16;
+    }
+
+    if (tinydrm_mipi_dbi_keep_alive(&fbdbi->tmipi, addr_mode, bpp))
+    {
+        if (addr_mode >= 0)
+            tinydrm_mipi_dbi_set_address_mode(&fbdbi->tmipi, addr_mode);
+        mipi_dbi_command(dbi, MIPI_DCS_SET_DISPLAY_ON);
+        goto out_flush;
+    }
+
     ret = mipi_dbi_poweron_reset(dbi);
     if (ret < 0)
         return;
@@ -784,90 +836,66 @@ static void fb_mipi_dbi_enable(struct drm_simple_display_pipe *pipe,
     {
     case MIPI_DBI_FB_HX8340BN:
         fb_hx8340bn_enable(dbi);
-        fb_mipi_dbi_rotate(dbi, 0,
-                           MADCTL_MY | MADCTL_MV,
-                           MADCTL_MX | MADCTL_MY,
-                           MADCTL_MX | MADCTL_MV);
         break;
     case MIPI_DBI_FB_HX8353D:
         fb_hx8353d_enable(dbi);
-        fb_mipi_dbi_rotate(dbi, MADCTL_MX | MADCTL_MY,
-                           MADCTL_MX | MADCTL_MV,
-                           0,
-                           MADCTL_MY | MADCTL_MV);
         break;
     case MIPI_DBI_FB_HX8357D:
         fb_hx8357d_enable(dbi);
-        fb_mipi_dbi_rotate(dbi, MADCTL_MX | MADCTL_MY,
-                           MADCTL_MY | MADCTL_MV,
-                           0,
-                           MADCTL_MX | MADCTL_MV);
+        break;
     case MIPI_DBI_FB_ILI9340:
         fb_ili9340_enable(dbi);
-        fb_mipi_dbi_rotate(dbi, MADCTL_MX,
-                           MADCTL_MV | MADCTL_MY | MADCTL_MX,
-                           MADCTL_MY,
-                           MADCTL_MV);
         break;
     case MIPI_DBI_FB_ILI9341:
         fb_ili9341_enable(dbi);
-        fb_mipi_dbi_rotate(dbi, MADCTL_MX,
-                           MADCTL_MV | MADCTL_MY | MADCTL_MX,
-                           MADCTL_MY,
-                           MADCTL_MV | MADCTL_ML);
         break;
     case MIPI_DBI_FB_ILI9481:
         fb_ili9481_enable(dbi);
-        fb_mipi_dbi_rotate(dbi, ILI9481_HFLIP,
-                           MADCTL_MV,
-                           ILI9481_VFLIP,
-                           MADCTL_MV | ILI9481_VFLIP | ILI9481_HFLIP);
         break;
     case MIPI_DBI_FB_ILI9486:
         fb_ili9486_enable(dbi);
-        fb_mipi_dbi_rotate(dbi, MADCTL_MY,
-                           MADCTL_MV,
-                           MADCTL_MX,
-                           MADCTL_MY | MADCTL_MX | MADCTL_MV);
         break;
     case MIPI_DBI_FB_S6D02A1:
         fb_s6d02a1_enable(dbi);
-        fb_mipi_dbi_rotate(dbi, MADCTL_MX | MADCTL_MY,
-                           MADCTL_MX | MADCTL_MV,
-                           0,
-                           MADCTL_MY | MADCTL_MV);
         break;
     case MIPI_DBI_FB_ST7735R:
         fb_st7735r_enable(dbi);
-        fb_mipi_dbi_rotate(dbi, MADCTL_MX | MADCTL_MY,
-                           MADCTL_MX | MADCTL_MV,
-                           0,
-                           MADCTL_MY | MADCTL_MV);
         break;
     case MIPI_DBI_FB_ST7789V:
         fb_st7789v_enable(dbi);
-        fb_mipi_dbi_rotate(dbi, 0,
-                           MADCTL_MY | MADCTL_MV,
-                           MADCTL_MX | MADCTL_MY,
-                           MADCTL_MX | MADCTL_MV);
         break;
     case MIPI_DBI_FB_TINYLCD:
         fb_tinylcd_enable(dbi);
-        fb_mipi_dbi_rotate(dbi, 0x08,
-                           0x38,
-                           0x58,
-                           0x28);
         break;
-    };
+    }
+
+    if (addr_mode >= 0)
+        tinydrm_mipi_dbi_set_address_mode(&fbdbi->tmipi, addr_mode);
 
 out_flush:
-    mipi_dbi_enable_flush(dbi);
+    tinydrm_mipi_dbi_enable_flush(&fbdbi->tmipi);
+}
+
+static void fb_mipi_dbi_disable(struct drm_simple_display_pipe *pipe)
+{
+    struct tinydrm_device *tdev = pipe_to_tinydrm(pipe);
+    struct mipi_dbi *dbi = mipi_dbi_from_tinydrm(tdev);
+
+    DRM_DEBUG_KMS("\n");
+
+    dbi->enabled = false;
+
+    /* Unlike mipi_dbi_pipe_disable() leave GRAM alone so it can be reused */
+    if (dbi->backlight)
+        tinydrm_disable_backlight(dbi->backlight);
+    else
+        mipi_dbi_command(dbi, MIPI_DCS_SET_DISPLAY_OFF);
 }
 
 static const struct drm_simple_display_pipe_funcs fb_mipi_dbi_funcs = {
     .enable = fb_mipi_dbi_enable,
-    .disable = mipi_dbi_pipe_disable,
-    .update = tinydrm_display_pipe_update,
+    .disable = fb_mipi_dbi_disable,
+    .update = tinydrm_display_pipe_damage_update,
     .prepare_fb = tinydrm_display_pipe_prepare_fb,
 };
 
@@ -889,7 +917,7 @@ static struct drm_driver fb_mipi_dbi_driver = {
     .fops = &fb_mipi_dbi_fops,
     TINYDRM_GEM_DRIVER_OPS,
     .lastclose = tinydrm_lastclose,
-    .debugfs_init = mipi_dbi_debugfs_init,
+    .debugfs_init = tinydrm_mipi_dbi_debugfs_init,
     .name = "fb_mipi_dbi",
     .desc = "MIPI DBI fbtft compatible driver",
     .date = "20180413",
@@ -935,6 +963,40 @@ static void fb_mipi_dbi_prop_not_supported(struct device *dev, const char *propn
         DRM_DEBUG_KMS("property not supported: %s\n", propname);
 }
 
+/* Pixel formats other than RGB565 known to work over SPI */
+static bool fb_mipi_dbi_has_wire_format(enum fb_mipi_dbi_variant variant, u32 bpp)
+{
+    switch (variant)
+    {
+    case MIPI_DBI_FB_HX8357D:
+        return bpp == 12 || bpp == 18;
+    case MIPI_DBI_FB_ILI9341:
+    case MIPI_DBI_FB_S6D02A1:
+    case MIPI_DBI_FB_ST7735R:
+    case MIPI_DBI_FB_ST7789V:
+        return bpp == 12;
+    case MIPI_DBI_FB_ILI9481:
+    case MIPI_DBI_FB_ILI9486:
+        return bpp == 18;
+    default:
+        return false;
+    }
+}
+
+static void fb_mipi_dbi_set_wire_format(struct fb_mipi_dbi *fbdbi, struct device *dev)
+{
+    bool adaptive = device_property_read_bool(dev, "adaptive-bpp");
+    u32 bpp = 16;
+
+    device_property_read_u32(dev, "wire-bpp", &bpp);
+    if (bpp == 16 && !adaptive)
+        return;
+
+    if (!fb_mipi_dbi_has_wire_format(fbdbi->variant, adaptive ? 12 : bpp) ||
+        tinydrm_mipi_dbi_set_wire_format(&fbdbi->tmipi, bpp, adaptive))
+        DRM_DEV_ERROR(dev, "Wire format not supported, using RGB565\n");
+}
+
 static int fb_mipi_dbi_probe(struct spi_device *spi)
 {
     const struct spi_device_id *spi_id;
@@ -1017,7 +1079,7 @@ static int fb_mipi_dbi_probe(struct spi_device *spi)
     fb_mipi_dbi_prop_not_supported(dev, "gamma");
     fb_mipi_dbi_prop_not_supported(dev, "txbuflen");
 
-    dbi = &fbdbi->dbi;
+    dbi = &fbdbi->tmipi.mipi;
 
     dbi->reset = devm_gpiod_get_optional(dev, "reset", GPIOD_OUT_HIGH);
     if (IS_ERR(dbi->reset))
@@ -1045,14 +1107,30 @@ static int fb_mipi_dbi_probe(struct spi_device *spi)
     if (ret)
         return ret;
 
-    ret = mipi_dbi_init(&spi->dev, dbi, &fb_mipi_dbi_funcs,
-                        &fb_mipi_dbi_driver, &mode, rotation);
+    ret = tinydrm_mipi_dbi_init(&spi->dev, &fbdbi->tmipi, &fb_mipi_dbi_funcs,
+                                &fb_mipi_dbi_driver, &mode, rotation);
     if (ret)
         return ret;
 
+    /* Uses its own flip bits in the address mode */
+    if (fbdbi->variant == MIPI_DBI_FB_ILI9481)
+        fbdbi->tmipi.hw_scroll = false;
+
+    fb_mipi_dbi_set_wire_format(fbdbi, dev);
+
     spi_set_drvdata(spi, dbi);
 
-    return devm_tinydrm_register(&dbi->tinydrm);
+    /* The video wall registers the DRM device */
+    if (tinydrm_wall_is_tile(dev))
+        return tinydrm_mipi_dbi_add_tile(&fbdbi->tmipi);
+
+    ret = devm_tinydrm_register(&dbi->tinydrm);
+    if (ret)
+        return ret;
+
+    tinydrm_fbdev_init_deferred_io(&dbi->tinydrm);
+
+    return 0;
 }
 
 static void fb_mipi_dbi_shutdown(struct spi_device *spi)
@@ -1066,6 +1144,8 @@ static struct spi_driver fb_mipi_dbi_spi_driver = {
     .driver = {
         .name = "fb_mipi_dbi",
         .owner = THIS_MODULE,
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+        .pm = &tinydrm_mipi_dbi_pm_ops,
         .of_match_table = fb_mipi_dbi_of_match,
     },
     .id_table = fb_mipi_dbi_id,
@@ -23,31 +23,129 @@
 
 #define DRVNAME "fb_ra8875"
 
-static int write_spi(struct fbtft_par *par, void *buf, size_t len)
+/* First byte of each SPI cycle */
+#define RA8875_DATA_WRITE	0x00
+#define RA8875_DATA_READ	0x40
+#define RA8875_CMD_WRITE	0x80
+#define RA8875_STATUS_READ	0xC0
+
+#define RA8875_STATUS_MEM_BUSY	BIT(7)
+#define RA8875_STATUS_BTE_BUSY	BIT(6)
+
+/* Registers are written slower than memory */
+#define RA8875_REG_SPEED_HZ	1000000
+#define RA8875_BUSY_TIMEOUT_MS	100
+
+#define RA8875_MAX_REGS		16
+
+struct ra8875 {
+	int win[4];
+	bool win_valid;
+	struct spi_transfer xfers[2 * RA8875_MAX_REGS];
+	/* DMA safe buffers: cmd/data pairs and status read */
+	u8 regbuf[2 * RA8875_MAX_REGS][2] ____cacheline_aligned;
+	u8 status[2] ____cacheline_aligned;
+};
+
+/* Poll the status register until none of the @mask bits are set */
+static int ra8875_wait_ready(struct fbtft_par *par, u8 mask)
 {
+	struct ra8875 *ra = par->extra;
 	struct spi_transfer t = {
-		.tx_buf = buf,
-		.len = len,
-		.speed_hz = 1000000,
+		.tx_buf = ra->status,
+		.rx_buf = ra->status,
+		.len = 2,
+		.speed_hz = RA8875_REG_SPEED_HZ,
 	};
+	unsigned long timeout = jiffies +
+				msecs_to_jiffies(RA8875_BUSY_TIMEOUT_MS);
+	int ret;
+
+	do {
+		ra->status[0] = RA8875_STATUS_READ;
+		ra->status[1] = 0;
+		ret = spi_sync_transfer(par->spi, &t, 1);
+		if (ret)
+			return ret;
+		if (!(ra->status[1] & mask))
+			return 0;
+		usleep_range(20, 50);
+	} while (time_before(jiffies, timeout));
+
+	dev_err_once(par->info->device, "Timeout waiting for ready: 0x%02x\n",
+		     ra->status[1]);
+
+	return -ETIMEDOUT;
+}
+
+/*
+ * Write register/value pairs using one spi_message, each cycle in its own
+ * chip select period. A value < 0 only writes the command.
+ */
+static int ra8875_write_regs(struct fbtft_par *par, const int (*regs)[2],
+			     unsigned int num)
+{
+	struct ra8875 *ra = par->extra;
+	struct spi_transfer *t = ra->xfers;
 	struct spi_message m;
+	unsigned int i;
+	int ret;
 
-	fbtft_par_dbg_hex(DEBUG_WRITE, par, par->info->device, u8, buf, len,
-			  "%s(len=%d): ", __func__, len);
+	if (WARN_ON(num > RA8875_MAX_REGS))
+		return -EINVAL;
 
-	if (!par->spi) {
-		dev_err(par->info->device,
-			"%s: par->spi is unexpectedly NULL\n", __func__);
-		return -1;
-	}
+	ret = ra8875_wait_ready(par, RA8875_STATUS_MEM_BUSY |
+				    RA8875_STATUS_BTE_BUSY);
+	if (ret)
+		return ret;
 
 	spi_message_init(&m);
-	spi_message_add_tail(&t, &m);
+	memset(ra->xfers, 0, sizeof(ra->xfers));
+
+	for (i = 0; i < num; i++) {
+		ra->regbuf[2 * i][0] = RA8875_CMD_WRITE;
+		ra->regbuf[2 * i][1] = regs[i][0];
+		t->tx_buf = ra->regbuf[2 * i];
+		t->len = 2;
+		t->speed_hz = RA8875_REG_SPEED_HZ;
+		t->cs_change = 1;
+		spi_message_add_tail(t++, &m);
+
+		if (regs[i][1] < 0)
+			continue;
+
+		ra->regbuf[2 * i + 1][0] = RA8875_DATA_WRITE;
+		ra->regbuf[2 * i + 1][1] = regs[i][1];
+		t->tx_buf = ra->regbuf[2 * i + 1];
+		t->len = 2;
+		t->speed_hz = RA8875_REG_SPEED_HZ;
+		t->cs_change = 1;
+		spi_message_add_tail(t++, &m);
+	}
+
+	/* Deassert chip select at the end of the message */
+	(t - 1)->cs_change = 0;
+
 	return spi_sync(par->spi, &m);
 }
 
 static int init_display(struct fbtft_par *par)
 {
+	struct ra8875 *ra = par->extra;
+
+	if (!par->spi) {
+		dev_err(par->info->device, "Only SPI is supported\n");
+		return -EINVAL;
+	}
+
+	if (!ra) {
+		ra = devm_kzalloc(par->info->device, sizeof(*ra), GFP_KERNEL);
+		if (!ra)
+			return -ENOMEM;
+		par->extra = ra;
+	}
+	ra->win_valid = false;
+
 	gpio_set_value(par->gpio.dc, 1);
 
 	fbtft_par_dbg(DEBUG_INIT_DISPLAY, par,
@@ -175,25 +273,193 @@ static int init_display(struct fbtft_par *par)
 	return 0;
 }
 
+/* Set the active window, skipped if it hasn't changed */
+static int ra8875_set_window(struct fbtft_par *par, int xs, int ys, int xe,
+			     int ye)
+{
+	struct ra8875 *ra = par->extra;
+	const int win[][2] = {
+		/* Set_Active_Window */
+		{ 0x30, xs & 0x00FF },
+		{ 0x31, (xs & 0xFF00) >> 8 },
+		{ 0x32, ys & 0x00FF },
+		{ 0x33, (ys & 0xFF00) >> 8 },
+		{ 0x34, xe & 0x00FF },
+		{ 0x35, (xe & 0xFF00) >> 8 },
+		{ 0x36, ye & 0x00FF },
+		{ 0x37, (ye & 0xFF00) >> 8 },
+	};
+	int ret;
+
+	if (ra->win_valid && ra->win[0] == xs && ra->win[1] == ys &&
+	    ra->win[2] == xe && ra->win[3] == ye)
+		return 0;
+
+	ra->win_valid = false;
+	ret = ra8875_write_regs(par, win, ARRAY_SIZE(win));
+	if (ret)
+		return ret;
+
+	ra->win[0] = xs;
+	ra->win[1] = ys;
+	ra->win[2] = xe;
+	ra->win[3] = ye;
+	ra->win_valid = true;
+
+	return 0;
+}
+
 static void set_addr_win(struct fbtft_par *par, int xs, int ys, int xe, int ye)
 {
-	/* Set_Active_Window */
-	write_reg(par, 0x30, xs & 0x00FF);
-	write_reg(par, 0x31, (xs & 0xFF00) >> 8);
-	write_reg(par, 0x32, ys & 0x00FF);
-	write_reg(par, 0x33, (ys & 0xFF00) >> 8);
-	write_reg(par, 0x34, (xs + xe) & 0x00FF);
-	write_reg(par, 0x35, ((xs + xe) & 0xFF00) >> 8);
-	write_reg(par, 0x36, (ys + ye) & 0x00FF);
-	write_reg(par, 0x37, ((ys + ye) & 0xFF00) >> 8);
-
-	/* Set_Memory_Write_Cursor */
-	write_reg(par, 0x46,  xs & 0xff);
-	write_reg(par, 0x47, (xs >> 8) & 0x03);
-	write_reg(par, 0x48,  ys & 0xff);
-	write_reg(par, 0x49, (ys >> 8) & 0x01);
-
-	write_reg(par, 0x02);
+	const int cursor[][2] = {
+		/* Set_Memory_Write_Cursor */
+		{ 0x46,  xs & 0xff },
+		{ 0x47, (xs >> 8) & 0x03 },
+		{ 0x48,  ys & 0xff },
+		{ 0x49, (ys >> 8) & 0x01 },
+		/* Memory write */
+		{ 0x02, -1 },
+	};
+	int ret;
+
+	ret = ra8875_set_window(par, xs, ys, xs + xe, ys + ye);
+	if (!ret)
+		ret = ra8875_write_regs(par, cursor, ARRAY_SIZE(cursor));
+	if (ret)
+		dev_err(par->info->device, "Failed to set window %d\n", ret);
+}
+
+/* Drawing and BTE are clipped to the active window */
+static int ra8875_full_window(struct fbtft_par *par)
+{
+	return ra8875_set_window(par, 0, 0, par->info->var.xres - 1,
+				 par->info->var.yres - 1);
+}
+
+static int ra8875_read_reg(struct fbtft_par *par, u8 reg, u8 *val)
+{
+	struct ra8875 *ra = par->extra;
+	struct spi_transfer t[2] = {
+		{
+			.tx_buf = ra->regbuf[0],
+			.len = 2,
+			.speed_hz = RA8875_REG_SPEED_HZ,
+			.cs_change = 1,
+		}, {
+			.tx_buf = ra->regbuf[1],
+			.rx_buf = ra->regbuf[1],
+			.len = 2,
+			.speed_hz = RA8875_REG_SPEED_HZ,
+		},
+	};
+	int ret;
+
+	ra->regbuf[0][0] = RA8875_CMD_WRITE;
+	ra->regbuf[0][1] = reg;
+	ra->regbuf[1][0] = RA8875_DATA_READ;
+	ra->regbuf[1][1] = 0;
+
+	ret = spi_sync_transfer(par->spi, t, 2);
+	if (ret)
+		return ret;
+
+	*val = ra->regbuf[1][1];
+
+	return 0;
+}
+
+/* Solid fill using the geometric drawing engine */
+static int fill_rect(struct fbtft_par *par, const struct drm_clip_rect *rect,
+		     u16 color)
+{
+	int xs = rect->x1, ys = rect->y1;
+	int xe = rect->x2 - 1, ye = rect->y2 - 1;
+	const int regs[][2] = {
+		/* Foreground color */
+		{ 0x63, (color >> 11) & 0x1f },
+		{ 0x64, (color >> 5) & 0x3f },
+		{ 0x65, color & 0x1f },
+		/* Square start and end */
+		{ 0x91, xs & 0xff },
+		{ 0x92, (xs >> 8) & 0x03 },
+		{ 0x93, ys & 0xff },
+		{ 0x94, (ys >> 8) & 0x01 },
+		{ 0x95, xe & 0xff },
+		{ 0x96, (xe >> 8) & 0x03 },
+		{ 0x97, ye & 0xff },
+		{ 0x98, (ye >> 8) & 0x01 },
+		/* Draw filled square */
+		{ 0x90, 0xb0 },
+	};
+	unsigned long timeout;
+	u8 dcr;
+	int ret;
+
+	ret = ra8875_full_window(par);
+	if (ret)
+		return ret;
+
+	ret = ra8875_write_regs(par, regs, ARRAY_SIZE(regs));
+	if (ret)
+		return ret;
+
+	timeout = jiffies + msecs_to_jiffies(RA8875_BUSY_TIMEOUT_MS);
+	do {
+		ret = ra8875_read_reg(par, 0x90, &dcr);
+		if (ret)
+			return ret;
+		if (!(dcr & BIT(7)))
+			return 0;
+		usleep_range(50, 100);
+	} while (time_before(jiffies, timeout));
+
+	return -ETIMEDOUT;
+}
+
+/*
+ * Move using the Block Transfer Engine. Overlapping moves towards higher
+ * addresses have to run in the negative direction starting at the bottom
+ * right corner.
+ */
+static int copy_rect(struct fbtft_par *par, const struct drm_clip_rect *src,
+		     int dx, int dy)
+{
+	bool negative = dy > 0 || (!dy && dx > 0);
+	int w = src->x2 - src->x1, h = src->y2 - src->y1;
+	int sx = negative ? src->x2 - 1 : src->x1;
+	int sy = negative ? src->y2 - 1 : src->y1;
+	int tx = sx + dx, ty = sy + dy;
+	const int regs[][2] = {
+		/* Source */
+		{ 0x54, sx & 0xff },
+		{ 0x55, (sx >> 8) & 0x03 },
+		{ 0x56, sy & 0xff },
+		{ 0x57, (sy >> 8) & 0x01 },
+		/* Destination */
+		{ 0x58, tx & 0xff },
+		{ 0x59, (tx >> 8) & 0x03 },
+		{ 0x5a, ty & 0xff },
+		{ 0x5b, (ty >> 8) & 0x01 },
+		/* Width and height */
+		{ 0x5c, w & 0xff },
+		{ 0x5d, (w >> 8) & 0x03 },
+		{ 0x5e, h & 0xff },
+		{ 0x5f, (h >> 8) & 0x01 },
+		/* ROP=S, move in positive/negative direction, start */
+		{ 0x51, negative ? 0xc3 : 0xc2 },
+		{ 0x50, 0x80 },
+	};
+	int ret;
+
+	ret = ra8875_full_window(par);
+	if (ret)
+		return ret;
+
+	ret = ra8875_write_regs(par, regs, ARRAY_SIZE(regs));
+	if (ret)
+		return ret;
+
+	return ra8875_wait_ready(par, RA8875_STATUS_BTE_BUSY);
 }
 
 static void write_reg8_bus8(struct fbtft_par *par, int len, ...)
@@ -201,53 +467,37 @@ static void write_reg8_bus8(struct fbtft_par *par, int len, ...)
 	va_list args;
 	int i, ret;
 	u8 *buf = par->buf;
-
-	/* slow down spi-speed for writing registers */
-	par->fbtftops.write = write_spi;
-
-	if (unlikely(par->debug & DEBUG_WRITE_REGISTER)) {
-		va_start(args, len);
-		for (i = 0; i < len; i++)
-			buf[i] = (u8)va_arg(args, unsigned int);
-		va_end(args);
-		fbtft_par_dbg_hex(DEBUG_WRITE_REGISTER, par, par->info->device,
-				  u8, buf, len, "%s: ", __func__);
-	}
+	struct spi_transfer t[2] = {
+		{
+			.tx_buf = par->buf,
+			.len = 2,
+			.speed_hz = RA8875_REG_SPEED_HZ,
+			.cs_change = len > 1,
+		}, {
+			.tx_buf = par->buf + 2,
+			.len = len,
+			.speed_hz = RA8875_REG_SPEED_HZ,
+		},
+	};
 
 	va_start(args, len);
-	*buf++ = 0x80;
-	*buf = (u8)va_arg(args, unsigned int);
-	ret = par->fbtftops.write(par, par->buf, 2);
-	if (ret < 0) {
-		va_end(args);
-		dev_err(par->info->device, "write() failed and returned %dn",
-			ret);
-		return;
-	}
-	len--;
-
-	udelay(100);
-
-	if (len) {
-		buf = (u8 *)par->buf;
-		*buf++ = 0x00;
-		i = len;
-		while (i--)
-			*buf++ = (u8)va_arg(args, unsigned int);
-
-		ret = par->fbtftops.write(par, par->buf, len + 1);
-		if (ret < 0) {
-			va_end(args);
-			dev_err(par->info->device,
-				"write() failed and returned %dn", ret);
-			return;
-		}
-	}
+	*buf++ = RA8875_CMD_WRITE;
+	*buf++ = (u8)va_arg(args, unsigned int);
+	*buf++ = RA8875_DATA_WRITE;
+	for (i = 1; i < len; i++)
+		*buf++ = (u8)va_arg(args, unsigned int);
 	va_end(args);
 
-	/* restore user spi-speed */
-	par->fbtftops.write = fbtft_write_spi;
-	udelay(100);
+	fbtft_par_dbg_hex(DEBUG_WRITE_REGISTER, par, par->info->device,
+			  u8, par->buf, len + 2, "%s: ", __func__);
+
+	ret = ra8875_wait_ready(par, RA8875_STATUS_MEM_BUSY |
+				    RA8875_STATUS_BTE_BUSY);
+	if (!ret)
+		ret = spi_sync_transfer(par->spi, t, len > 1 ? 2 : 1);
+	if (ret < 0)
+		dev_err(par->info->device, "write() failed and returned %d\n",
+			ret);
 }
 
 static int write_vmem16_bus8(struct fbtft_par *par, size_t offset, size_t len)
@@ -298,7 +548,8 @@ static struct fbtft_display display = {
 		.set_addr_win = set_addr_win,
 		.write_register = write_reg8_bus8,
 		.write_vmem = write_vmem16_bus8,
-		.write = write_spi,
+		.fill_rect = fill_rect,
+		.copy_rect = copy_rect,
 	},
 };
 
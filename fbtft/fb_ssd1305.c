@@ -128,14 +128,21 @@ static int init_display(struct fbtft_par *par)
 	return 0;
 }
 
+/* Only the pages covering the damaged lines are sent */
 static void set_addr_win(struct fbtft_par *par, int xs, int ys, int xe, int ye)
 {
-	/* Set Lower Column Start Address for Page Addressing Mode */
-	write_reg(par, 0x00 | ((par->info->var.rotate == 180) ? 0x0 : 0x4));
-	/* Set Higher Column Start Address for Page Addressing Mode */
-	write_reg(par, 0x10 | 0x0);
-	/* Set Display Start Line */
-	write_reg(par, 0x40 | 0x0);
+	/* The 128 columns sit at the end of the 132 column RAM unless flipped */
+	int offset = (par->info->var.rotate == 180) ? 0x0 : 0x4;
+
+	/* Set Column Address */
+	write_reg(par, 0x21);
+	write_reg(par, offset + xs);
+	write_reg(par, offset + xe);
+
+	/* Set Page Address */
+	write_reg(par, 0x22);
+	write_reg(par, ys / 8);
+	write_reg(par, ye / 8);
 }
 
 static int blank(struct fbtft_par *par, bool on)
@@ -161,12 +168,16 @@ static int set_gamma(struct fbtft_par *par, unsigned long *curves)
 static int write_vmem(struct fbtft_par *par, size_t offset, size_t len)
 {
 	u16 *vmem16 = (u16 *)par->info->screen_buffer;
+	u32 line_length = par->info->fix.line_length;
+	u32 ys = offset / line_length;
+	u32 ye = ys + len / line_length - 1;
 	u8 *buf = par->txbuf.buf;
 	int x, y, i;
 	int ret;
 
+	/* Vertical addressing mode, the pages of a column follow each other */
 	for (x = 0; x < par->info->var.xres; x++) {
-		for (y = 0; y < par->info->var.yres / 8; y++) {
+		for (y = ys / 8; y <= ye / 8; y++) {
 			*buf = 0x00;
 			for (i = 0; i < 8; i++)
 				*buf |= (vmem16[(y * 8 + i) *
@@ -176,11 +187,11 @@ static int write_vmem(struct fbtft_par *par, size_t offset, size_t len)
 		}
 	}
 
-	/* Write data */
-	gpio_set_value(par->gpio.dc, 1);
+	/* Write data, on I2C it's sent as one data stream */
+	if (par->gpio.dc != -1)
+		gpio_set_value(par->gpio.dc, 1);
 	ret = par->fbtftops.write(par, par->txbuf.buf,
-				  par->info->var.xres * par->info->var.yres /
-				  8);
+				  buf - (u8 *)par->txbuf.buf);
 	if (ret < 0)
 		dev_err(par->info->device, "write failed and returned: %d\n",
 			ret);
@@ -208,6 +219,7 @@ FBTFT_REGISTER_DRIVER(DRVNAME, "solomon,ssd1305", &display);
 
 MODULE_ALIAS("spi:" DRVNAME);
 MODULE_ALIAS("platform:" DRVNAME);
+MODULE_ALIAS("i2c:" DRVNAME);
 MODULE_ALIAS("spi:ssd1305");
 MODULE_ALIAS("platform:ssd1305");
 
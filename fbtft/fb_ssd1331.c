@@ -101,6 +101,69 @@ static void write_reg8_bus8(struct fbtft_par *par, int len, ...)
 	va_end(args);
 }
 
+/* Colour bytes for the drawing commands: 6 bits each, C B A order */
+static void ssd1331_color(struct fbtft_par *par, u16 color, u8 *c)
+{
+	u8 r = (color >> 11) << 1;
+	u8 g = (color >> 5) & 0x3f;
+	u8 b = (color << 1) & 0x3f;
+
+	c[0] = par->bgr ? b : r;
+	c[1] = g;
+	c[2] = par->bgr ? r : b;
+}
+
+static int fill_rect(struct fbtft_par *par, const struct drm_clip_rect *rect,
+		     u16 color)
+{
+	u8 c[3];
+
+	if (!color) {
+		/* Clear Window */
+		write_reg(par, 0x25, rect->x1, rect->y1,
+			  rect->x2 - 1, rect->y2 - 1);
+	} else {
+		ssd1331_color(par, color, c);
+		write_reg(par, 0x26, 0x01); /* Fill Enable */
+		/* Draw Rectangle */
+		write_reg(par, 0x22, rect->x1, rect->y1,
+			  rect->x2 - 1, rect->y2 - 1,
+			  c[0], c[1], c[2], c[0], c[1], c[2]);
+	}
+
+	/* No busy flag, wait for the drawing to finish */
+	usleep_range(3000, 3500);
+
+	return 0;
+}
+
+/*
+ * The Copy command doesn't define the direction for overlapping areas, so
+ * move non-overlapping strips starting at the edge we're moving towards.
+ */
+static int copy_rect(struct fbtft_par *par, const struct drm_clip_rect *src,
+		     int dx, int dy)
+{
+	int h = src->y2 - src->y1;
+	int step = abs(dy);
+	int y, n;
+
+	if (dx || !dy || DIV_ROUND_UP(h, step) > 16)
+		return -EOPNOTSUPP;
+
+	for (n = 0; n < h; n += step) {
+		int lines = min(step, h - n);
+
+		y = dy > 0 ? src->y2 - n - lines : src->y1 + n;
+		/* Copy */
+		write_reg(par, 0x23, src->x1, y, src->x2 - 1, y + lines - 1,
+			  src->x1, y + dy);
+		usleep_range(1000, 1500);
+	}
+
+	return 0;
+}
+
 /*
  * Grayscale Lookup Table
  * GS1 - GS63
@@ -181,6 +244,8 @@ static struct fbtft_display display = {
 		.set_addr_win = set_addr_win,
 		.set_gamma = set_gamma,
 		.blank = blank,
+		.fill_rect = fill_rect,
+		.copy_rect = copy_rect,
 	},
 };
 
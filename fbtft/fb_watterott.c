@@ -19,13 +19,16 @@
 #include <linux/init.h>
 #include <linux/gpio.h>
 #include <linux/delay.h>
+#include <linux/debugfs.h>
+
+#include <drm/tinydrm/tinydrm-helpers2.h>
 
 #include "fbtft.h"
 
 #define DRVNAME			"fb_watterott"
 #define WIDTH			320
 #define HEIGHT			240
-#define FPS			5
+#define FPS			10
 #define TXBUFLEN		1024
 #define DEFAULT_BRIGHTNESS	50
 
@@ -39,9 +42,28 @@
 #define COLOR_RGB233		10
 #define COLOR_RGB565		16
 
+#define DRAWIMAGE_HEADER	10
+
+/* Time the firmware needs to draw one line */
+#define LINE_US_RGB565		300
+#define LINE_US_RGB332		700
+
+struct watterott {
+	struct fbtft_par *par;
+	unsigned int version;
+	void *buf;
+	size_t buf_len;
+	struct tinydrm_bw_policy policy;
+	u16 reduced_mode;
+};
+
 static short mode = 565;
 module_param(mode, short, 0000);
-MODULE_PARM_DESC(mode, "RGB color transfer mode: 332, 565 (default)");
+MODULE_PARM_DESC(mode, "RGB color transfer mode: 332, 323, 233, 565 (default)");
+
+static bool adaptive = true;
+module_param(adaptive, bool, 0000);
+MODULE_PARM_DESC(adaptive, "Use RGB332 during sustained full screen motion in 565 mode (default: true)");
 
 static void write_reg8_bus8(struct fbtft_par *par, int len, ...)
 {
@@ -65,34 +87,120 @@ static void write_reg8_bus8(struct fbtft_par *par, int len, ...)
 	}
 }
 
+/*
+ * The firmware doesn't report its receive buffer size, these are the sizes of
+ * the versions known to take a DRAWIMAGE block of several lines.
+ */
+static const struct {
+	unsigned int version;
+	size_t rxbuf;
+} firmware_rxbuf[] = {
+	{ 0x104, 2048 },
+	{ 0x105, 4096 },
+	{ 0x106, 4096 },
+};
+
+/*
+ * Size the DRAWIMAGE buffer to the firmware receive buffer. Unknown firmware
+ * keeps the transmit buffer, TXBUFLEN or the txbuflen property, which holds
+ * one RGB565 line by default.
+ */
+static int block_buf_init(struct fbtft_par *par, struct watterott *wt)
+{
+	size_t len = par->txbuf.len;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(firmware_rxbuf); i++)
+		if (firmware_rxbuf[i].version == wt->version)
+			len = max(len, firmware_rxbuf[i].rxbuf);
+
+	if (len <= par->txbuf.len) {
+		wt->buf = par->txbuf.buf;
+		wt->buf_len = par->txbuf.len;
+		return 0;
+	}
+
+	if (len <= wt->buf_len)
+		return 0;
+
+	wt->buf = devm_kmalloc(par->info->device, len, GFP_KERNEL);
+	if (!wt->buf)
+		return -ENOMEM;
+	wt->buf_len = len;
+
+	return 0;
+}
+
+/*
+ * Lines per DRAWIMAGE block, bounded by the buffer sized to the firmware.
+ * Firmware that doesn't report a version gets one line at a time.
+ */
+static unsigned int block_lines(struct fbtft_par *par, size_t line_len)
+{
+	struct watterott *wt = par->extra;
+	unsigned int lines;
+
+	if (!wt || !wt->version)
+		return 1;
+
+	lines = (wt->buf_len - DRAWIMAGE_HEADER) / line_len;
+
+	return max(lines, 1U);
+}
+
+static void *block_buf(struct fbtft_par *par)
+{
+	struct watterott *wt = par->extra;
+
+	return wt && wt->buf ? wt->buf : par->txbuf.buf;
+}
+
+/* Give the firmware time to draw @lines lines without spinning */
+static void block_wait(unsigned int lines, unsigned int line_us)
+{
+	unsigned long us = lines * line_us;
+
+	usleep_range(us, us + us / 4);
+}
+
+static void set_drawimage_header(struct fbtft_par *par, u8 *buf,
+				 unsigned int y, unsigned int h, u8 color)
+{
+	u16 *pos = (u16 *)(buf + 1);
+
+	/* pos: x, y, w, h */
+	buf[0] = CMD_LCD_DRAWIMAGE;
+	pos[0] = 0;
+	pos[1] = cpu_to_be16(y);
+	pos[2] = cpu_to_be16(par->info->var.xres);
+	pos[3] = cpu_to_be16(h);
+	buf[9] = color;
+}
+
 static int write_vmem(struct fbtft_par *par, size_t offset, size_t len)
 {
-	unsigned int start_line, end_line;
+	unsigned int start_line, end_line, lines, block;
 	u16 *vmem16 = (u16 *)(par->info->screen_buffer + offset);
-	u16 *pos = par->txbuf.buf + 1;
-	u16 *buf16 = par->txbuf.buf + 10;
+	u8 *buf = block_buf(par);
+	u16 *buf16 = (u16 *)(buf + DRAWIMAGE_HEADER);
+	size_t line_len = par->info->fix.line_length;
 	int i, j;
 	int ret = 0;
 
-	start_line = offset / par->info->fix.line_length;
-	end_line = start_line + (len / par->info->fix.line_length) - 1;
+	start_line = offset / line_len;
+	end_line = start_line + (len / line_len) - 1;
+	block = block_lines(par, line_len);
 
-	/* Set command header. pos: x, y, w, h */
-	((u8 *)par->txbuf.buf)[0] = CMD_LCD_DRAWIMAGE;
-	pos[0] = 0;
-	pos[2] = cpu_to_be16(par->info->var.xres);
-	pos[3] = cpu_to_be16(1);
-	((u8 *)par->txbuf.buf)[9] = COLOR_RGB565;
-
-	for (i = start_line; i <= end_line; i++) {
-		pos[1] = cpu_to_be16(i);
-		for (j = 0; j < par->info->var.xres; j++)
+	for (i = start_line; i <= end_line; i += lines) {
+		lines = min_t(unsigned int, block, end_line - i + 1);
+		set_drawimage_header(par, buf, i, lines, COLOR_RGB565);
+		for (j = 0; j < par->info->var.xres * lines; j++)
 			buf16[j] = cpu_to_be16(*vmem16++);
-		ret = par->fbtftops.write(par,
-			par->txbuf.buf, 10 + par->info->fix.line_length);
+		ret = par->fbtftops.write(par, buf,
+					  DRAWIMAGE_HEADER + line_len * lines);
 		if (ret < 0)
 			return ret;
-		udelay(300);
+		block_wait(lines, LINE_US_RGB565);
 	}
 
 	return 0;
@@ -102,41 +210,112 @@ static int write_vmem(struct fbtft_par *par, size_t offset, size_t len)
 #define RGB565toRGB332(c) (((c&0xE000)>>8) | ((c&0700)>>6) | ((c&0x0018)>>3))
 #define RGB565toRGB233(c) (((c&0xC000)>>8) | ((c&0700)>>5) | ((c&0x001C)>>2))
 
-static int write_vmem_8bit(struct fbtft_par *par, size_t offset, size_t len)
+static u8 mode_to_color(unsigned int mode)
+{
+	switch (mode) {
+	case 323:
+		return COLOR_RGB323;
+	case 233:
+		return COLOR_RGB233;
+	default:
+		return COLOR_RGB332;
+	}
+}
+
+static u8 rgb565_to_8bit(u16 c, u8 color)
+{
+	switch (color) {
+	case COLOR_RGB323:
+		return RGB565toRGB323(c);
+	case COLOR_RGB233:
+		return RGB565toRGB233(c);
+	default:
+		return RGB565toRGB332(c);
+	}
+}
+
+static int write_vmem_color(struct fbtft_par *par, size_t offset, size_t len,
+			    u8 color)
 {
-	unsigned int start_line, end_line;
+	unsigned int start_line, end_line, lines, block;
 	u16 *vmem16 = (u16 *)(par->info->screen_buffer + offset);
-	u16 *pos = par->txbuf.buf + 1;
-	u8 *buf8 = par->txbuf.buf + 10;
+	u8 *buf = block_buf(par);
+	u8 *buf8 = buf + DRAWIMAGE_HEADER;
+	unsigned int xres = par->info->var.xres;
 	int i, j;
 	int ret = 0;
 
 	start_line = offset / par->info->fix.line_length;
 	end_line = start_line + (len / par->info->fix.line_length) - 1;
+	block = block_lines(par, xres);
 
-	/* Set command header. pos: x, y, w, h */
-	((u8 *)par->txbuf.buf)[0] = CMD_LCD_DRAWIMAGE;
-	pos[0] = 0;
-	pos[2] = cpu_to_be16(par->info->var.xres);
-	pos[3] = cpu_to_be16(1);
-	((u8 *)par->txbuf.buf)[9] = COLOR_RGB332;
-
-	for (i = start_line; i <= end_line; i++) {
-		pos[1] = cpu_to_be16(i);
-		for (j = 0; j < par->info->var.xres; j++) {
-			buf8[j] = RGB565toRGB332(*vmem16);
+	for (i = start_line; i <= end_line; i += lines) {
+		lines = min_t(unsigned int, block, end_line - i + 1);
+		set_drawimage_header(par, buf, i, lines, color);
+		for (j = 0; j < xres * lines; j++) {
+			buf8[j] = rgb565_to_8bit(*vmem16, color);
 			vmem16++;
 		}
-		ret = par->fbtftops.write(par,
-			par->txbuf.buf, 10 + par->info->var.xres);
+		ret = par->fbtftops.write(par, buf,
+					  DRAWIMAGE_HEADER + xres * lines);
 		if (ret < 0)
 			return ret;
-		udelay(700);
+		block_wait(lines, LINE_US_RGB332);
 	}
 
 	return 0;
 }
 
+static int write_vmem_8bit(struct fbtft_par *par, size_t offset, size_t len)
+{
+	return write_vmem_color(par, offset, len, mode_to_color(mode));
+}
+
+/*
+ * Drop to an 8-bit format during sustained full screen motion and go back to
+ * RGB565 once the content settles, resending the whole frame if needed.
+ */
+static int write_vmem_adaptive(struct fbtft_par *par, size_t offset,
+			       size_t len)
+{
+	size_t size = par->info->fix.line_length * par->info->var.yres;
+	struct watterott *wt = par->extra;
+	bool reduced;
+	int ret;
+
+	reduced = tinydrm_bw_policy_begin(&wt->policy, len * 2 >= size);
+	if (!reduced && wt->policy.lossy) {
+		offset = 0;
+		len = size;
+	}
+
+	if (reduced)
+		ret = write_vmem_color(par, offset, len,
+				       mode_to_color(wt->reduced_mode));
+	else
+		ret = write_vmem(par, offset, len);
+
+	tinydrm_bw_policy_end(&wt->policy, reduced, len == size);
+
+	return ret;
+}
+
+static void restore_frame(struct tinydrm_bw_policy *policy)
+{
+	struct watterott *wt = container_of(policy, struct watterott, policy);
+	struct fbtft_par *par = wt->par;
+	struct tinydrm_device *tdev = &par->tinydrm;
+	size_t size = par->info->fix.line_length * par->info->var.yres;
+
+	mutex_lock(&tdev->dirty_lock);
+
+	if (tinydrm_bw_policy_restore_needed(policy) && tdev->pipe.plane.fb &&
+	    !write_vmem(par, 0, size))
+		policy->lossy = false;
+
+	mutex_unlock(&tdev->dirty_lock);
+}
+
 static unsigned int firmware_version(struct fbtft_par *par)
 {
 	u8 rxbuf[4] = {0, };
@@ -151,10 +330,27 @@ static unsigned int firmware_version(struct fbtft_par *par)
 
 static int init_display(struct fbtft_par *par)
 {
+	struct watterott *wt = par->extra;
 	int ret;
 	unsigned int version;
 	u8 save_mode;
 
+	if (!wt) {
+		wt = devm_kzalloc(par->info->device, sizeof(*wt), GFP_KERNEL);
+		if (!wt)
+			return -ENOMEM;
+
+		ret = devm_tinydrm_bw_policy_init(par->info->device,
+						  &wt->policy, restore_frame);
+		if (ret)
+			return ret;
+
+		wt->par = par;
+		wt->policy.adaptive = adaptive;
+		wt->reduced_mode = 332;
+		par->extra = wt;
+	}
+
 	/* enable SPI interface by having CS and MOSI low during reset */
 	save_mode = par->spi->mode;
 	par->spi->mode |= SPI_CS_HIGH;
@@ -165,9 +361,9 @@ static int init_display(struct fbtft_par *par)
 	}
 	write_reg(par, 0x00); /* make sure mode is set */
 
-	mdelay(50);
+	msleep(50);
 	par->fbtftops.reset(par);
-	mdelay(1000);
+	msleep(1000);
 	par->spi->mode = save_mode;
 	ret = spi_setup(par->spi);
 	if (ret) {
@@ -179,12 +375,31 @@ static int init_display(struct fbtft_par *par)
 	version = firmware_version(par);
 	fbtft_par_dbg(DEBUG_INIT_DISPLAY, par, "Firmware version: %x.%02x\n",
 						version >> 8, version & 0xFF);
+	wt->version = version;
+
+	ret = block_buf_init(par, wt);
+	if (ret)
+		return ret;
 
-	if (mode == 332)
+	if (mode == 565)
+		par->fbtftops.write_vmem = write_vmem_adaptive;
+	else
 		par->fbtftops.write_vmem = write_vmem_8bit;
 	return 0;
 }
 
+#ifdef CONFIG_DEBUG_FS
+static void watterott_debugfs_init(struct fbtft_par *par, struct dentry *root)
+{
+	struct watterott *wt = par->extra;
+
+	tinydrm_bw_policy_debugfs_init(&wt->policy, root);
+	debugfs_create_u16("reduced_mode", 0644, root, &wt->reduced_mode);
+}
+#else
+#define watterott_debugfs_init NULL
+#endif
+
 static void set_addr_win(struct fbtft_par *par, int xs, int ys, int xe, int ye)
 {
 	/* not used on this controller */
@@ -290,6 +505,7 @@ static struct fbtft_display display = {
 		.set_var = set_var,
 		.verify_gpios = verify_gpios,
 		.register_backlight = register_chip_backlight,
+		.debugfs_init = watterott_debugfs_init,
 	},
 };
 
@@ -1,6 +1,7 @@
 #include <linux/export.h>
 #include <linux/errno.h>
 #include <linux/gpio.h>
+#include <linux/i2c.h>
 #include <linux/spi/spi.h>
 #include "fbtft.h"
 
@@ -116,6 +117,41 @@ void fbtft_write_reg8_bus9(struct fbtft_par *par, int len, ...)
 }
 EXPORT_SYMBOL(fbtft_write_reg8_bus9);
 
+/*
+ * The command and its parameters are all sent as one command stream (control
+ * byte 0x00) in a single transfer, there's no DC line on I2C.
+ */
+void fbtft_write_reg8_i2c(struct fbtft_par *par, int len, ...)
+{
+	u8 *buf = par->buf;
+	va_list args;
+	int i, ret;
+
+	if (len <= 0)
+		return;
+
+	if (len > 127) {
+		dev_err(par->info->device, "%s: len=%d is too big\n",
+			__func__, len);
+		return;
+	}
+
+	*buf++ = FBTFT_I2C_CMD_STREAM;
+	va_start(args, len);
+	for (i = 0; i < len; i++)
+		*buf++ = (u8)va_arg(args, unsigned int);
+	va_end(args);
+
+	fbtft_par_dbg_hex(DEBUG_WRITE_REGISTER, par, par->info->device, u8,
+			  par->buf + 1, len, "%s: ", __func__);
+
+	ret = i2c_master_send(par->i2c, par->buf, len + 1);
+	if (ret != len + 1)
+		dev_err(par->info->device,
+			"%s: write() failed and returned %d\n", __func__, ret);
+}
+EXPORT_SYMBOL(fbtft_write_reg8_i2c);
+
 /*****************************************************************************
  *
  *   int (*write_vmem)(struct fbtft_par *par);
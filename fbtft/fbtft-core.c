@@ -25,12 +25,14 @@
 #include <linux/of.h>
 #include <linux/of_gpio.h>
 #include <linux/platform_device.h>
+#include <linux/pm_runtime.h>
 #include <linux/spi/spi.h>
 #include <linux/string.h>
 #include <video/mipi_display.h>
 
 #include <drm/drm_fb_helper.h>
 #include <drm/drm_gem_framebuffer_helper.h>
+#include <drm/tinydrm/tinydrm-helpers2.h>
 
 #include "fbtft.h"
 
@@ -325,7 +327,7 @@ static int fbtft_verify_gpios(struct fbtft_par *par)
 	fbtft_par_dbg(DEBUG_VERIFY_GPIOS, par, "%s()\n", __func__);
 
 	if (par->display.buswidth != 9 && par->startbyte == 0 &&
-							par->gpio.dc < 0) {
+	    !par->i2c && par->gpio.dc < 0) {
 		dev_err(par->info->device,
 			"Missing info about 'dc' gpio. Aborting.\n");
 		return -EINVAL;
@@ -353,209 +355,6 @@ static int fbtft_verify_gpios(struct fbtft_par *par)
 	return 0;
 }
 
-#ifdef CONFIG_OF
-/**
- * fbtft_init_display_dt() - Device Tree init_display() function
- * @par: Driver data
- *
- * Return: 0 if successful, negative if error
- */
-static int fbtft_init_display_dt(struct fbtft_par *par)
-{
-	struct device_node *node = par->info->device->of_node;
-	struct property *prop;
-	const __be32 *p;
-	u32 val;
-	int buf[64], i, j;
-
-	if (!node)
-		return -EINVAL;
-
-	prop = of_find_property(node, "init", NULL);
-	p = of_prop_next_u32(prop, NULL, &val);
-	if (!p)
-		return -EINVAL;
-
-	par->fbtftops.reset(par);
-	if (par->gpio.cs != -1)
-		gpio_set_value(par->gpio.cs, 0);  /* Activate chip */
-
-	while (p) {
-		if (val & FBTFT_OF_INIT_CMD) {
-			val &= 0xFFFF;
-			i = 0;
-			while (p && !(val & 0xFFFF0000)) {
-				if (i > 63) {
-					dev_err(par->info->device,
-					"%s: Maximum register values exceeded\n",
-					__func__);
-					return -EINVAL;
-				}
-				buf[i++] = val;
-				p = of_prop_next_u32(prop, p, &val);
-			}
-			/* make debug message */
-			fbtft_par_dbg(DEBUG_INIT_DISPLAY, par,
-				"init: write_register:\n");
-			for (j = 0; j < i; j++)
-				fbtft_par_dbg(DEBUG_INIT_DISPLAY, par,
-					      "buf[%d] = %02X\n", j, buf[j]);
-
-			par->fbtftops.write_register(par, i,
-				buf[0], buf[1], buf[2], buf[3],
-				buf[4], buf[5], buf[6], buf[7],
-				buf[8], buf[9], buf[10], buf[11],
-				buf[12], buf[13], buf[14], buf[15],
-				buf[16], buf[17], buf[18], buf[19],
-				buf[20], buf[21], buf[22], buf[23],
-				buf[24], buf[25], buf[26], buf[27],
-				buf[28], buf[29], buf[30], buf[31],
-				buf[32], buf[33], buf[34], buf[35],
-				buf[36], buf[37], buf[38], buf[39],
-				buf[40], buf[41], buf[42], buf[43],
-				buf[44], buf[45], buf[46], buf[47],
-				buf[48], buf[49], buf[50], buf[51],
-				buf[52], buf[53], buf[54], buf[55],
-				buf[56], buf[57], buf[58], buf[59],
-				buf[60], buf[61], buf[62], buf[63]);
-		} else if (val & FBTFT_OF_INIT_DELAY) {
-			fbtft_par_dbg(DEBUG_INIT_DISPLAY, par,
-				"init: msleep(%u)\n", val & 0xFFFF);
-			msleep(val & 0xFFFF);
-			p = of_prop_next_u32(prop, p, &val);
-		} else {
-			dev_err(par->info->device, "illegal init value 0x%X\n",
-									val);
-			return -EINVAL;
-		}
-	}
-
-	return 0;
-}
-#else
-static int fbtft_init_display_dt(struct fbtft_par *par)
-{
-	return -EINVAL;
-}
-#endif
-
-/**
- * fbtft_init_display() - Generic init_display() function
- * @par: Driver data
- *
- * Uses par->init_sequence to do the initialization
- *
- * Return: 0 if successful, negative if error
- */
-static int fbtft_init_display(struct fbtft_par *par)
-{
-	int buf[64];
-	char msg[128];
-	char str[16];
-	int i = 0;
-	int j;
-
-	/* sanity check */
-	if (!par->init_sequence) {
-		dev_err(par->info->device,
-			"error: init_sequence is not set\n");
-		return -EINVAL;
-	}
-
-	/* make sure stop marker exists */
-	for (i = 0; i < FBTFT_MAX_INIT_SEQUENCE; i++)
-		if (par->init_sequence[i] == -3)
-			break;
-	if (i == FBTFT_MAX_INIT_SEQUENCE) {
-		dev_err(par->info->device,
-			"missing stop marker at end of init sequence\n");
-		return -EINVAL;
-	}
-
-	par->fbtftops.reset(par);
-	if (par->gpio.cs != -1)
-		gpio_set_value(par->gpio.cs, 0);  /* Activate chip */
-
-	i = 0;
-	while (i < FBTFT_MAX_INIT_SEQUENCE) {
-		if (par->init_sequence[i] == -3) {
-			/* done */
-			return 0;
-		}
-		if (par->init_sequence[i] >= 0) {
-			dev_err(par->info->device,
-				"missing delimiter at position %d\n", i);
-			return -EINVAL;
-		}
-		if (par->init_sequence[i + 1] < 0) {
-			dev_err(par->info->device,
-				"missing value after delimiter %d at position %d\n",
-				par->init_sequence[i], i);
-			return -EINVAL;
-		}
-		switch (par->init_sequence[i]) {
-		case -1:
-			i++;
-			/* make debug message */
-			strcpy(msg, "");
-			j = i + 1;
-			while (par->init_sequence[j] >= 0) {
-				sprintf(str, "0x%02X ", par->init_sequence[j]);
-				strcat(msg, str);
-				j++;
-			}
-			fbtft_par_dbg(DEBUG_INIT_DISPLAY, par,
-				"init: write(0x%02X) %s\n",
-				par->init_sequence[i], msg);
-
-			/* Write */
-			j = 0;
-			while (par->init_sequence[i] >= 0) {
-				if (j > 63) {
-					dev_err(par->info->device,
-					"%s: Maximum register values exceeded\n",
-					__func__);
-					return -EINVAL;
-				}
-				buf[j++] = par->init_sequence[i++];
-			}
-			par->fbtftops.write_register(par, j,
-				buf[0], buf[1], buf[2], buf[3],
-				buf[4], buf[5], buf[6], buf[7],
-				buf[8], buf[9], buf[10], buf[11],
-				buf[12], buf[13], buf[14], buf[15],
-				buf[16], buf[17], buf[18], buf[19],
-				buf[20], buf[21], buf[22], buf[23],
-				buf[24], buf[25], buf[26], buf[27],
-				buf[28], buf[29], buf[30], buf[31],
-				buf[32], buf[33], buf[34], buf[35],
-				buf[36], buf[37], buf[38], buf[39],
-				buf[40], buf[41], buf[42], buf[43],
-				buf[44], buf[45], buf[46], buf[47],
-				buf[48], buf[49], buf[50], buf[51],
-				buf[52], buf[53], buf[54], buf[55],
-				buf[56], buf[57], buf[58], buf[59],
-				buf[60], buf[61], buf[62], buf[63]);
-			break;
-		case -2:
-			i++;
-			fbtft_par_dbg(DEBUG_INIT_DISPLAY, par,
-				"init: mdelay(%d)\n", par->init_sequence[i]);
-			mdelay(par->init_sequence[i++]);
-			break;
-		default:
-			dev_err(par->info->device,
-				"unknown delimiter %d at position %d\n",
-				par->init_sequence[i], i);
-			return -EINVAL;
-		}
-	}
-
-	dev_err(par->info->device,
-		"%s: something is wrong. Shouldn't get here.\n", __func__);
-	return -EINVAL;
-}
-
 static void fbtft_set_addr_win(struct fbtft_par *par, int xs, int ys, int xe,
 			       int ye)
 {
@@ -580,6 +379,72 @@ static int fbtft_update_display(struct fbtft_par *par, unsigned int start_line,
 	return par->fbtftops.write_vmem(par, offset, len);
 }
 
+static bool fbtft_rect_uniform(struct fbtft_par *par,
+			       const struct drm_clip_rect *rect, u16 *color)
+{
+	unsigned int width = par->info->var.xres;
+	u16 *vmem16 = par->info->screen_buffer;
+	unsigned int x, y;
+	u16 c;
+
+	c = vmem16[rect->y1 * width + rect->x1];
+	for (y = rect->y1; y < rect->y2; y++)
+		for (x = rect->x1; x < rect->x2; x++)
+			if (vmem16[y * width + x] != c)
+				return false;
+
+	*color = c;
+
+	return true;
+}
+
+/*
+ * Use the hardware to fill a uniform clip or to move content that was
+ * scrolled vertically. @clip is shrunk to what's left to send.
+ *
+ * Returns:
+ * True if nothing is left to send.
+ */
+static bool fbtft_flush_accel(struct fbtft_par *par, struct drm_clip_rect *clip)
+{
+	unsigned int pitch = par->info->fix.line_length;
+	struct drm_clip_rect src = *clip;
+	u16 color;
+	int dy;
+
+	if (par->rowhash.next)
+		tinydrm_row_hashes(par->rowhash.next, par->info->screen_buffer,
+				   pitch, pitch, clip->y1, clip->y2);
+
+	if (par->fbtftops.fill_rect && fbtft_rect_uniform(par, clip, &color) &&
+	    !par->fbtftops.fill_rect(par, clip, color))
+		return true;
+
+	if (!par->fbtftops.copy_rect || !par->rowhash.valid)
+		return false;
+
+	dy = tinydrm_find_vscroll(par->rowhash.sent, par->rowhash.next,
+				  clip->y1, clip->y2, (clip->y2 - clip->y1) / 2);
+	if (!dy)
+		return false;
+
+	if (dy > 0)
+		src.y2 -= dy;
+	else
+		src.y1 -= dy;
+
+	if (par->fbtftops.copy_rect(par, &src, 0, dy))
+		return false;
+
+	/* Send the revealed strip */
+	if (dy > 0)
+		clip->y2 = clip->y1 + dy;
+	else
+		clip->y1 = clip->y2 + dy;
+
+	return false;
+}
+
 static int fbtft_fb_dirty(struct drm_framebuffer *fb,
 			  struct drm_file *file_priv,
 			  unsigned int flags, unsigned int color,
@@ -601,6 +466,11 @@ static int fbtft_fb_dirty(struct drm_framebuffer *fb,
 
 	mutex_lock(&tdev->dirty_lock);
 
+	if (!par->enabled) {
+		par->stale = true;
+		goto out_unlock;
+	}
+
 	/* fbdev can flush even when we're not interested */
 	if (tdev->pipe.plane.fb != fb)
 		goto out_unlock;
@@ -650,9 +520,22 @@ static int fbtft_fb_dirty(struct drm_framebuffer *fb,
 		ret = par->fbtftops.write_vmem(par, 0, (clip.x2 - clip.x1) *
 					       (clip.y2 - clip.y1) * 2);
 	} else {
-		ret = fbtft_update_display(par, clip.y1, clip.y2 - 1);
+		struct drm_clip_rect damage = clip;
+
+		if (!fbtft_flush_accel(par, &clip))
+			ret = fbtft_update_display(par, clip.y1, clip.y2 - 1);
+
+		if (par->rowhash.next) {
+			memcpy(par->rowhash.sent + damage.y1,
+			       par->rowhash.next + damage.y1,
+			       (damage.y2 - damage.y1) * sizeof(u64));
+			par->rowhash.valid = !ret;
+		}
 	}
 
+	/* The reference keeps a new framebuffer from reusing the pointer */
+	drm_framebuffer_assign(&par->last_fb, ret ? NULL : fb);
+
 out_unlock:
 	mutex_unlock(&tdev->dirty_lock);
 
@@ -669,30 +552,169 @@ static const struct drm_framebuffer_funcs fbtft_fb_funcs = {
 	.dirty		= fbtft_fb_dirty,
 };
 
-static void fbtft_pipe_enable(struct drm_simple_display_pipe *pipe,
-			      struct drm_crtc_state *crtc_state)
+static int fbtft_deferred_init(struct tinydrm_deferred_init *dinit)
+{
+	struct tinydrm_device *tdev = pipe_to_tinydrm(dinit->pipe);
+	struct fbtft_par *par = fbtft_par_from_tinydrm(tdev);
+	int ret;
+
+	ret = par->fbtftops.init_display(par);
+	if (ret < 0)
+		return ret;
+
+	if (par->fbtftops.set_var && !no_set_var) {
+		ret = par->fbtftops.set_var(par);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (par->fbtftops.set_gamma && par->gamma.curves) {
+		ret = par->fbtftops.set_gamma(par, par->gamma.curves);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* Runs from the deferred init worker */
+static void fbtft_deferred_enable(struct drm_simple_display_pipe *pipe,
+				  struct drm_crtc_state *crtc_state)
 {
 	struct tinydrm_device *tdev = pipe_to_tinydrm(pipe);
 	struct fbtft_par *par = fbtft_par_from_tinydrm(tdev);
 	struct drm_framebuffer *fb = pipe->plane.fb;
+	struct device *dev = tdev->drm->dev;
+	bool retained;
+	int ret;
 
 	DRM_DEBUG_KMS("\n");
 
-	if (fb)
+	ret = pm_runtime_get_sync(dev);
+	if (ret < 0)
+		DRM_DEV_ERROR(dev, "Failed to resume (%d)\n", ret);
+
+	mutex_lock(&tdev->dirty_lock);
+	/* Nothing to flush if the display still shows the framebuffer */
+	retained = par->retained && !par->stale && fb && fb == par->last_fb;
+	/* Display content is unknown, the next flush sends it all */
+	if (!retained)
+		par->rowhash.valid = false;
+	par->retained = false;
+	par->stale = false;
+	par->enabled = true;
+	mutex_unlock(&tdev->dirty_lock);
+
+	if (fb && !retained)
 		fb->funcs->dirty(fb, NULL, 0, 0, NULL, 0);
 
 	tinydrm_enable_backlight(par->info->bl_dev);
 }
 
+/* Runs before the framebuffers are torn down */
+static void fbtft_release_last_fb(void *data)
+{
+	struct fbtft_par *par = data;
+
+	drm_framebuffer_assign(&par->last_fb, NULL);
+}
+
+static void fbtft_pipe_enable(struct drm_simple_display_pipe *pipe,
+			      struct drm_crtc_state *crtc_state)
+{
+	struct tinydrm_device *tdev = pipe_to_tinydrm(pipe);
+
+	drm_crtc_vblank_on(&pipe->crtc);
+	tinydrm_deferred_enable(&fbtft_par_from_tinydrm(tdev)->dinit);
+}
+
 static void fbtft_pipe_disable(struct drm_simple_display_pipe *pipe)
 {
 	struct tinydrm_device *tdev = pipe_to_tinydrm(pipe);
 	struct fbtft_par *par = fbtft_par_from_tinydrm(tdev);
 
+	struct device *dev = tdev->drm->dev;
+	bool enabled;
+
 	DRM_DEBUG_KMS("\n");
+	drm_crtc_vblank_off(&pipe->crtc);
+	tinydrm_deferred_wait(&par->dinit);
+
+	mutex_lock(&tdev->dirty_lock);
+	enabled = par->enabled;
+	par->retained = enabled;
+	par->enabled = false;
+	mutex_unlock(&tdev->dirty_lock);
+
 	tinydrm_disable_backlight(par->info->bl_dev);
+
+	/* The reference is only taken if the panel came up */
+	if (enabled) {
+		pm_runtime_mark_last_busy(dev);
+		pm_runtime_put_autosuspend(dev);
+	}
 }
 
+static int __maybe_unused fbtft_runtime_suspend(struct device *dev)
+{
+	struct fbtft_par *par = dev_get_drvdata(dev);
+	int ret = 0;
+
+	if (!par->retained)
+		return 0;
+
+	if (par->fbtftops.blank) {
+		ret = par->fbtftops.blank(par, true);
+	} else if (!par->fbtftops.set_addr_win) {
+		write_reg(par, MIPI_DCS_SET_DISPLAY_OFF);
+		write_reg(par, MIPI_DCS_ENTER_SLEEP_MODE);
+	} else {
+		return 0;
+	}
+
+	if (ret)
+		par->retained = false;
+	else
+		par->sleeping = true;
+
+	return 0;
+}
+
+static int __maybe_unused fbtft_runtime_resume(struct device *dev)
+{
+	struct fbtft_par *par = dev_get_drvdata(dev);
+	int ret = 0;
+
+	if (!par->sleeping)
+		return 0;
+
+	par->sleeping = false;
+	if (par->fbtftops.blank) {
+		ret = par->fbtftops.blank(par, false);
+	} else {
+		write_reg(par, MIPI_DCS_EXIT_SLEEP_MODE);
+		/* Commands can be sent 5ms after Sleep Out */
+		usleep_range(5000, 10000);
+		write_reg(par, MIPI_DCS_SET_DISPLAY_ON);
+	}
+
+	/* The next enable flushes everything */
+	if (ret)
+		par->retained = false;
+
+	return 0;
+}
+
+/*
+ * Idle panels are blanked, or put in sleep mode if they're MIPI DCS
+ * compatible, when they have been disabled for the autosuspend delay.
+ * The init sequence is only run at probe so waking is cheap.
+ */
+const struct dev_pm_ops fbtft_pm_ops = {
+	SET_RUNTIME_PM_OPS(fbtft_runtime_suspend, fbtft_runtime_resume, NULL)
+};
+EXPORT_SYMBOL(fbtft_pm_ops);
+
 static const uint32_t fbtft_formats[] = {
 	DRM_FORMAT_RGB565,
 	DRM_FORMAT_XRGB8888,
@@ -701,7 +723,7 @@ static const uint32_t fbtft_formats[] = {
 static const struct drm_simple_display_pipe_funcs fbtft_pipe_funcs = {
 	.enable = fbtft_pipe_enable,
 	.disable = fbtft_pipe_disable,
-	.update = tinydrm_display_pipe_update,
+	.update = tinydrm_display_pipe_damage_update,
 	.prepare_fb = tinydrm_display_pipe_prepare_fb,
 };
 
@@ -715,6 +737,20 @@ static struct drm_driver fbtft_driver = {
 	.minor			= 0,
 };
 
+static int fbtft_debugfs_init(struct drm_minor *minor)
+{
+	struct tinydrm_device *tdev = minor->dev->dev_private;
+	struct fbtft_par *par = fbtft_par_from_tinydrm(tdev);
+
+	if (par->spi)
+		tinydrm_spi_qos_debugfs_init(&par->spi_qos,
+					     minor->debugfs_root);
+	if (par->fbtftops.debugfs_init)
+		par->fbtftops.debugfs_init(par, minor->debugfs_root);
+
+	return 0;
+}
+
 static int fbtft_property_unsigned(struct device *dev, const char *propname,
 				   unsigned int *val)
 {
@@ -743,7 +779,8 @@ static void fbtft_setmode(struct drm_display_mode *mode, int width, int height)
 }
 
 int fbtft_probe_common(struct fbtft_display *display,
-			struct spi_device *sdev, struct platform_device *pdev)
+			struct spi_device *sdev, struct platform_device *pdev,
+			struct i2c_client *client)
 {
 	unsigned int startbyte = 0, rotate = 0;
 	struct drm_display_mode fbtft_mode;
@@ -752,16 +789,20 @@ int fbtft_probe_common(struct fbtft_display *display,
 	struct drm_driver *driver;
 	unsigned int txbuflen = 0;
 	unsigned int vmem_size;
+	unsigned int headroom;
 	struct fbtft_par *par;
 	struct device *dev;
+	u8 *txbuf;
 	int ret, i;
 
 	DRM_DEBUG_DRIVER("\n");
 
 	if (sdev)
 		dev = &sdev->dev;
-	else
+	else if (pdev)
 		dev = &pdev->dev;
+	else
+		dev = &client->dev;
 
 	if (display->gamma_num * display->gamma_len >
 			FBTFT_GAMMA_MAX_VALUES_TOTAL) {
@@ -789,6 +830,7 @@ int fbtft_probe_common(struct fbtft_display *display,
 
 	par->spi = sdev;
 	par->pdev = pdev;
+	par->i2c = client;
 
 	/* make a copy that we can modify */
 	par->display = *display;
@@ -849,6 +891,10 @@ int fbtft_probe_common(struct fbtft_display *display,
 	if (of_find_property(dev->of_node, "led-gpios", NULL))
 		display->backlight = 1;
 
+	/* Control bytes take the place of the DC line */
+	if (client && !display->buswidth)
+		display->buswidth = 8;
+
 	if (!display->buswidth) {
 		dev_err(dev, "buswidth is not set\n");
 		return -EINVAL;
@@ -914,10 +960,14 @@ int fbtft_probe_common(struct fbtft_display *display,
 #endif
 
 	if (txbuflen) {
-		par->txbuf.len = txbuflen;
-		par->txbuf.buf = devm_kzalloc(dev, txbuflen, GFP_KERNEL);
-		if (!par->txbuf.buf)
+		/* Room for the I2C control byte, see fbtft_write_i2c() */
+		headroom = client ? 1 : 0;
+		txbuf = devm_kzalloc(dev, txbuflen + headroom, GFP_KERNEL);
+		if (!txbuf)
 			return -ENOMEM;
+
+		par->txbuf.len = txbuflen;
+		par->txbuf.buf = txbuf + headroom;
 	}
 
 	par->fbtftops = display->fbtftops;
@@ -928,6 +978,12 @@ int fbtft_probe_common(struct fbtft_display *display,
 	if (!par->fbtftops.register_backlight && display->backlight)
 		par->fbtftops.register_backlight = fbtft_register_backlight;
 
+	if (!par->fbtftops.write_register && client) {
+		if (display->regwidth != 8)
+			return -EINVAL;
+		par->fbtftops.write_register = fbtft_write_reg8_i2c;
+	}
+
 	if (!par->fbtftops.write_register) {
 		if (display->regwidth == 8 && display->buswidth == 8)
 			par->fbtftops.write_register = fbtft_write_reg8_bus8;
@@ -954,6 +1010,7 @@ int fbtft_probe_common(struct fbtft_display *display,
 
 	if (!par->fbtftops.write && par->spi) {
 		par->fbtftops.write = fbtft_write_spi;
+		tinydrm_spi_qos_init(dev, &par->spi_qos);
 		if (display->buswidth == 9) {
 			if (par->spi->master->bits_per_word_mask & SPI_BPW_MASK(9)) {
 				par->spi->bits_per_word = 9;
@@ -969,6 +1026,8 @@ int fbtft_probe_common(struct fbtft_display *display,
 					return -ENOMEM;
 			}
 		}
+	} else if (!par->fbtftops.write && client) {
+		par->fbtftops.write = fbtft_write_i2c;
 	} else if (!par->fbtftops.write) {
 		if (display->buswidth == 8)
 			par->fbtftops.write = fbtft_write_gpio8_wr;
@@ -978,9 +1037,7 @@ int fbtft_probe_common(struct fbtft_display *display,
 
 	par->fbtftops.read = fbtft_read_spi;
 
-	if (of_find_property(dev->of_node, "init", NULL))
-		par->fbtftops.init_display = fbtft_init_display_dt;
-	else if (par->init_sequence)
+	if (of_find_property(dev->of_node, "init", NULL) || par->init_sequence)
 		par->fbtftops.init_display = fbtft_init_display;
 
 	if (!par->fbtftops.init_display) {
@@ -1001,6 +1058,24 @@ int fbtft_probe_common(struct fbtft_display *display,
 	if (!par->info->screen_buffer)
 		return -ENOMEM;
 
+	if (par->fbtftops.init_display == fbtft_init_display) {
+		ret = fbtft_init_compile(par);
+		if (ret)
+			return ret;
+	}
+
+	/* Row hashes of the display content are used to detect scrolling */
+	if (par->fbtftops.copy_rect) {
+		unsigned int rows = max(display->width, display->height);
+
+		par->rowhash.sent = devm_kcalloc(dev, rows, sizeof(u64),
+						 GFP_KERNEL);
+		par->rowhash.next = devm_kcalloc(dev, rows, sizeof(u64),
+						 GFP_KERNEL);
+		if (!par->rowhash.sent || !par->rowhash.next)
+			return -ENOMEM;
+	}
+
 	driver = devm_kmalloc(dev, sizeof(*driver), GFP_KERNEL);
 	if (!driver)
 		return -ENOMEM;
@@ -1011,12 +1086,19 @@ int fbtft_probe_common(struct fbtft_display *display,
 		return -ENOMEM;
 
 	driver->desc = driver->name;
+	if (IS_ENABLED(CONFIG_DEBUG_FS) &&
+	    (par->fbtftops.debugfs_init || par->spi))
+		driver->debugfs_init = fbtft_debugfs_init;
 	fbtft_setmode(&fbtft_mode, display->width, display->height);
 
 	ret = devm_tinydrm_init(dev, tdev, &fbtft_fb_funcs, driver);
 	if (ret)
 		return ret;
 
+	ret = devm_add_action(dev, fbtft_release_last_fb, par);
+	if (ret)
+		return ret;
+
 	ret = tinydrm_display_pipe_init(tdev, &fbtft_pipe_funcs,
 					DRM_MODE_CONNECTOR_VIRTUAL,
 					fbtft_formats,
@@ -1025,6 +1107,18 @@ int fbtft_probe_common(struct fbtft_display *display,
 	if (ret)
 		return ret;
 
+	ret = tinydrm_plane_enable_fb_damage_clips(&tdev->pipe.plane);
+	if (ret)
+		return ret;
+
+	ret = tinydrm_vblank_emulation_init(&tdev->pipe.crtc);
+	if (ret)
+		return ret;
+
+	ret = tinydrm_flip_queue_init(&tdev->pipe);
+	if (ret)
+		return ret;
+
 	par->info->var.xres = tdev->drm->mode_config.min_width;
 	par->info->var.yres = tdev->drm->mode_config.min_height;
 	par->info->var.rotate = rotate;
@@ -1042,21 +1136,28 @@ int fbtft_probe_common(struct fbtft_display *display,
 	if (ret < 0)
 		return ret;
 
-	ret = par->fbtftops.init_display(par);
-	if (ret < 0)
-		return ret;
-
-	if (par->fbtftops.set_var && !no_set_var) {
-		ret = par->fbtftops.set_var(par);
-		if (ret < 0)
-			return ret;
+	if (par->pdev && par->gpio.wr && !IS_ERR_OR_NULL(par->gpio.db)) {
+		par->i80 = devm_tinydrm_i80_bus_init(dev, par->gpio.wr,
+						     par->gpio.db);
+		if (IS_ERR(par->i80))
+			return PTR_ERR(par->i80);
 	}
 
-	if (par->fbtftops.set_gamma && par->gamma.curves) {
-		ret = par->fbtftops.set_gamma(par, par->gamma.curves);
-		if (ret)
-			return ret;
-	}
+	/*
+	 * The controller is initialized from a worker so probe, and with it
+	 * boot, doesn't wait for the reset and init sequence sleeps.
+	 */
+	ret = devm_tinydrm_deferred_init(dev, &par->dinit, &tdev->pipe,
+					 fbtft_deferred_init,
+					 fbtft_deferred_enable);
+	if (ret)
+		return ret;
+
+	/* The runtime PM callbacks can run once the pipe is enabled */
+	dev_set_drvdata(dev, par);
+	ret = devm_tinydrm_runtime_pm_init(dev);
+	if (ret)
+		return ret;
 
 	if (par->fbtftops.register_backlight)
 		par->fbtftops.register_backlight(par);
@@ -1065,10 +1166,7 @@ int fbtft_probe_common(struct fbtft_display *display,
 	if (ret)
 		return ret;
 
-	if (par->spi)
-		spi_set_drvdata(par->spi, par);
-	else if (par->pdev)
-		platform_set_drvdata(par->pdev, par);
+	tinydrm_fbdev_init_deferred_io(tdev);
 
 	if (par->spi)
 		DRM_DEBUG_DRIVER("Initialized %s:%s %ux%u @%uMHz on minor %d\n",
@@ -0,0 +1,460 @@
+/*
+ * Compiled init sequences
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/delay.h>
+#include <linux/errno.h>
+#include <linux/gpio.h>
+#include <linux/of.h>
+#include <linux/slab.h>
+#include <linux/spi/spi.h>
+#include <asm/unaligned.h>
+#include "fbtft.h"
+
+/*
+ * The s16 init_sequence and the Device Tree 'init' property are parsed and
+ * validated once at probe and compiled into a list of operations. When the
+ * generic write_register() functions are used, the commands are encoded in
+ * their wire format so replay is just write() calls. On a 9-bit bus the
+ * DC bit is part of the data, so consecutive commands are sent in one
+ * write().
+ */
+
+#define FBTFT_INIT_MAX_VALUES	64
+
+enum fbtft_init_encoding {
+	FBTFT_INIT_ENC_CUSTOM,
+	FBTFT_INIT_ENC_REG8_BUS8,
+	FBTFT_INIT_ENC_REG8_BUS9,
+	FBTFT_INIT_ENC_REG16_BUS8,
+	FBTFT_INIT_ENC_REG16_BUS16,
+};
+
+enum fbtft_init_op_type {
+	FBTFT_INIT_WRITE,	/* Encoded bytes, @dc is the DC level or -1 */
+	FBTFT_INIT_REG,		/* @len u16 values for write_register() */
+	FBTFT_INIT_DELAY,	/* Sleep @len milliseconds */
+};
+
+struct fbtft_init_op {
+	u8 type;
+	s8 dc;
+	u16 len;
+	u32 offset;
+};
+
+struct fbtft_init_prog {
+	struct fbtft_init_op *ops;
+	unsigned int num_ops;
+	u8 *data;
+	size_t data_len;
+};
+
+static enum fbtft_init_encoding fbtft_init_encoding(struct fbtft_par *par)
+{
+	void (*write_register)(struct fbtft_par *par, int len, ...);
+
+	write_register = par->fbtftops.write_register;
+	if (write_register == fbtft_write_reg8_bus8)
+		return FBTFT_INIT_ENC_REG8_BUS8;
+	if (write_register == fbtft_write_reg8_bus9)
+		return FBTFT_INIT_ENC_REG8_BUS9;
+	if (write_register == fbtft_write_reg16_bus8)
+		return FBTFT_INIT_ENC_REG16_BUS8;
+	if (write_register == fbtft_write_reg16_bus16)
+		return FBTFT_INIT_ENC_REG16_BUS16;
+
+	return FBTFT_INIT_ENC_CUSTOM;
+}
+
+static void *fbtft_init_emit(struct fbtft_init_prog *prog, u8 type, s8 dc,
+			     u16 len, size_t size)
+{
+	struct fbtft_init_op *op = &prog->ops[prog->num_ops++];
+	void *data = prog->data + prog->data_len;
+
+	op->type = type;
+	op->dc = dc;
+	op->len = len;
+	op->offset = prog->data_len;
+	prog->data_len += size;
+
+	return data;
+}
+
+/* Command register with DC low, then the parameters with DC high */
+static void fbtft_init_emit_reg(struct fbtft_par *par,
+				struct fbtft_init_prog *prog,
+				enum fbtft_init_encoding enc,
+				const u32 *vals, unsigned int num)
+{
+	unsigned int width = enc == FBTFT_INIT_ENC_REG8_BUS8 ? 1 : 2;
+	unsigned int offset = par->startbyte ? 1 : 0;
+	unsigned int i, j, count;
+	u8 *buf;
+
+	for (i = 0; i < num; i += count) {
+		count = i ? num - 1 : 1;
+		buf = fbtft_init_emit(prog, FBTFT_INIT_WRITE, !!i,
+				      offset + count * width,
+				      offset + count * width);
+		if (par->startbyte)
+			*buf++ = par->startbyte | (i ? 0x2 : 0);
+
+		for (j = i; j < i + count; j++) {
+			if (enc == FBTFT_INIT_ENC_REG8_BUS8) {
+				*buf++ = vals[j];
+				continue;
+			}
+
+			if (enc == FBTFT_INIT_ENC_REG16_BUS8)
+				put_unaligned_be16(vals[j], buf);
+			else
+				put_unaligned(vals[j], (u16 *)buf);
+			buf += 2;
+		}
+	}
+}
+
+/* Values of the command starting at @i, or zero if not a command */
+static unsigned int fbtft_init_cmd_len(const u32 *seq, unsigned int num,
+				       unsigned int i)
+{
+	unsigned int j;
+
+	if (!(seq[i] & FBTFT_OF_INIT_CMD))
+		return 0;
+
+	for (j = i + 1; j < num; j++)
+		if (seq[j] & (FBTFT_OF_INIT_CMD | FBTFT_OF_INIT_DELAY))
+			break;
+
+	return j - i;
+}
+
+/* Commands until the next delay in one write, limited by the tx buffer */
+static unsigned int fbtft_init_emit_bus9(struct fbtft_par *par,
+					 struct fbtft_init_prog *prog,
+					 const u32 *seq, unsigned int num,
+					 unsigned int i)
+{
+	size_t max_words = (par->txbuf.len ?: PAGE_SIZE) / 2;
+	bool emulated = par->spi && par->spi->bits_per_word == 8;
+	unsigned int n, end, words = 0, pad = 0;
+	u16 *buf;
+
+	for (end = i; end < num; end += n) {
+		n = fbtft_init_cmd_len(seq, num, end);
+		if (!n || (words && words + n + 3 > max_words))
+			break;
+		words += n;
+	}
+
+	/* The 9-bit emulation works on 8 byte blocks, pad with no-ops */
+	if (emulated && words % 4)
+		pad = 4 - words % 4;
+
+	buf = fbtft_init_emit(prog, FBTFT_INIT_WRITE, -1,
+			      (pad + words) * 2, (pad + words) * 2);
+	while (pad--)
+		put_unaligned(0x000, buf++);
+
+	for (; i < end; i++, buf++)
+		put_unaligned((seq[i] & 0xFF) |
+			      (seq[i] & FBTFT_OF_INIT_CMD ? 0 : 0x100), buf);
+
+	return end;
+}
+
+/*
+ * @seq uses the Device Tree encoding: FBTFT_OF_INIT_CMD | register followed
+ * by the parameters, or FBTFT_OF_INIT_DELAY | milliseconds.
+ */
+static int fbtft_init_compile_seq(struct fbtft_par *par, const u32 *seq,
+				  unsigned int num)
+{
+	enum fbtft_init_encoding enc = fbtft_init_encoding(par);
+	struct device *dev = par->info->device;
+	struct fbtft_init_prog *prog;
+	u32 vals[FBTFT_INIT_MAX_VALUES];
+	unsigned int i, j, n;
+	u16 *buf;
+
+	for (i = 0; i < num; i += n) {
+		if (seq[i] & FBTFT_OF_INIT_DELAY) {
+			n = 1;
+			continue;
+		}
+
+		n = fbtft_init_cmd_len(seq, num, i);
+		if (!n) {
+			dev_err(dev, "illegal init value 0x%X\n", seq[i]);
+			return -EINVAL;
+		}
+		if (n > FBTFT_INIT_MAX_VALUES) {
+			dev_err(dev, "%s: Maximum register values exceeded\n",
+				__func__);
+			return -EINVAL;
+		}
+	}
+
+	prog = devm_kzalloc(dev, sizeof(*prog), GFP_KERNEL);
+	if (!prog)
+		return -ENOMEM;
+
+	/* Worst case is two operations per value, or a padded 9-bit block */
+	prog->ops = devm_kcalloc(dev, 2 * num, sizeof(*prog->ops), GFP_KERNEL);
+	prog->data = devm_kzalloc(dev, 8 * num + 8, GFP_KERNEL);
+	if (!prog->ops || !prog->data)
+		return -ENOMEM;
+
+	i = 0;
+	while (i < num) {
+		if (seq[i] & FBTFT_OF_INIT_DELAY) {
+			fbtft_par_dbg(DEBUG_INIT_DISPLAY, par,
+				      "init: sleep(%u)\n", seq[i] & 0xFFFF);
+			fbtft_init_emit(prog, FBTFT_INIT_DELAY, -1,
+					seq[i++] & 0xFFFF, 0);
+			continue;
+		}
+
+		n = fbtft_init_cmd_len(seq, num, i);
+		for (j = 0; j < n; j++)
+			vals[j] = seq[i + j] & 0xFFFF;
+
+		fbtft_par_dbg(DEBUG_INIT_DISPLAY, par,
+			      "init: write(0x%02X) %u values\n", vals[0], n - 1);
+
+		switch (enc) {
+		case FBTFT_INIT_ENC_REG8_BUS9:
+			i = fbtft_init_emit_bus9(par, prog, seq, num, i);
+			continue;
+		case FBTFT_INIT_ENC_CUSTOM:
+			buf = fbtft_init_emit(prog, FBTFT_INIT_REG, -1, n, n * 2);
+			for (j = 0; j < n; j++)
+				put_unaligned(vals[j], buf + j);
+			break;
+		default:
+			fbtft_init_emit_reg(par, prog, enc, vals, n);
+			break;
+		}
+		i += n;
+	}
+
+	par->init_prog = prog;
+
+	return 0;
+}
+
+static int fbtft_init_compile_s16(struct fbtft_par *par)
+{
+	struct device *dev = par->info->device;
+	const s16 *init = par->init_sequence;
+	unsigned int i, num = 0;
+	u32 *seq;
+	int ret;
+
+	seq = kcalloc(FBTFT_MAX_INIT_SEQUENCE, sizeof(*seq), GFP_KERNEL);
+	if (!seq)
+		return -ENOMEM;
+
+	for (i = 0; i < FBTFT_MAX_INIT_SEQUENCE; i++) {
+		if (init[i] == -3)
+			break;
+
+		if (init[i] >= 0) {
+			if (!num) {
+				dev_err(dev, "missing delimiter at position %d\n",
+					i);
+				ret = -EINVAL;
+				goto out_free;
+			}
+			seq[num++] = init[i];
+			continue;
+		}
+
+		if (i + 1 == FBTFT_MAX_INIT_SEQUENCE || init[i + 1] < 0) {
+			dev_err(dev,
+				"missing value after delimiter %d at position %d\n",
+				init[i], i);
+			ret = -EINVAL;
+			goto out_free;
+		}
+
+		switch (init[i]) {
+		case -1:
+			seq[num++] = FBTFT_OF_INIT_CMD | init[++i];
+			break;
+		case -2:
+			seq[num++] = FBTFT_OF_INIT_DELAY | init[++i];
+			break;
+		default:
+			dev_err(dev, "unknown delimiter %d at position %d\n",
+				init[i], i);
+			ret = -EINVAL;
+			goto out_free;
+		}
+	}
+
+	if (i == FBTFT_MAX_INIT_SEQUENCE) {
+		dev_err(dev, "missing stop marker at end of init sequence\n");
+		ret = -EINVAL;
+		goto out_free;
+	}
+
+	ret = fbtft_init_compile_seq(par, seq, num);
+
+out_free:
+	kfree(seq);
+
+	return ret;
+}
+
+#ifdef CONFIG_OF
+static int fbtft_init_compile_dt(struct fbtft_par *par)
+{
+	struct device_node *node = par->info->device->of_node;
+	u32 *seq;
+	int num, ret;
+
+	num = of_property_count_u32_elems(node, "init");
+	if (num <= 0)
+		return -EINVAL;
+
+	seq = kcalloc(num, sizeof(*seq), GFP_KERNEL);
+	if (!seq)
+		return -ENOMEM;
+
+	ret = of_property_read_u32_array(node, "init", seq, num);
+	if (!ret)
+		ret = fbtft_init_compile_seq(par, seq, num);
+
+	kfree(seq);
+
+	return ret;
+}
+#else
+static int fbtft_init_compile_dt(struct fbtft_par *par)
+{
+	return -EINVAL;
+}
+#endif
+
+/**
+ * fbtft_init_compile() - Compile the init sequence
+ * @par: Driver data
+ *
+ * Compiles the Device Tree 'init' property, or if missing par->init_sequence,
+ * for use by fbtft_init_display(). Errors in the sequence are reported here.
+ *
+ * Return: 0 if successful, negative if error
+ */
+int fbtft_init_compile(struct fbtft_par *par)
+{
+	struct device_node *node = par->info->device->of_node;
+
+	if (node && of_find_property(node, "init", NULL))
+		return fbtft_init_compile_dt(par);
+
+	return fbtft_init_compile_s16(par);
+}
+
+static void fbtft_init_write_reg(struct fbtft_par *par, const u16 *vals,
+				 unsigned int num)
+{
+	int buf[FBTFT_INIT_MAX_VALUES] = { 0 };
+	unsigned int i;
+
+	for (i = 0; i < num; i++)
+		buf[i] = get_unaligned(vals + i);
+
+	par->fbtftops.write_register(par, num,
+		buf[0], buf[1], buf[2], buf[3],
+		buf[4], buf[5], buf[6], buf[7],
+		buf[8], buf[9], buf[10], buf[11],
+		buf[12], buf[13], buf[14], buf[15],
+		buf[16], buf[17], buf[18], buf[19],
+		buf[20], buf[21], buf[22], buf[23],
+		buf[24], buf[25], buf[26], buf[27],
+		buf[28], buf[29], buf[30], buf[31],
+		buf[32], buf[33], buf[34], buf[35],
+		buf[36], buf[37], buf[38], buf[39],
+		buf[40], buf[41], buf[42], buf[43],
+		buf[44], buf[45], buf[46], buf[47],
+		buf[48], buf[49], buf[50], buf[51],
+		buf[52], buf[53], buf[54], buf[55],
+		buf[56], buf[57], buf[58], buf[59],
+		buf[60], buf[61], buf[62], buf[63]);
+}
+
+static void fbtft_init_sleep(unsigned int ms)
+{
+	if (!ms)
+		return;
+
+	if (ms < 20)
+		usleep_range(ms * 1000, ms * 1000 + 500);
+	else
+		msleep(ms);
+}
+
+/**
+ * fbtft_init_display() - Generic init_display() function
+ * @par: Driver data
+ *
+ * Resets the controller and replays the sequence compiled by
+ * fbtft_init_compile().
+ *
+ * Return: 0 if successful, negative if error
+ */
+int fbtft_init_display(struct fbtft_par *par)
+{
+	struct fbtft_init_prog *prog = par->init_prog;
+	struct fbtft_init_op *op;
+	unsigned int i;
+	int ret;
+
+	if (!prog) {
+		dev_err(par->info->device,
+			"error: init sequence is not compiled\n");
+		return -EINVAL;
+	}
+
+	par->fbtftops.reset(par);
+	if (par->gpio.cs != -1)
+		gpio_set_value(par->gpio.cs, 0);  /* Activate chip */
+
+	for (i = 0; i < prog->num_ops; i++) {
+		op = &prog->ops[i];
+
+		switch (op->type) {
+		case FBTFT_INIT_WRITE:
+			if (op->dc >= 0 && par->gpio.dc != -1)
+				gpio_set_value(par->gpio.dc, op->dc);
+			ret = par->fbtftops.write(par, prog->data + op->offset,
+						  op->len);
+			if (ret < 0) {
+				dev_err(par->info->device,
+					"%s: write() failed and returned %d\n",
+					__func__, ret);
+				return ret;
+			}
+			break;
+		case FBTFT_INIT_REG:
+			fbtft_init_write_reg(par,
+					     (u16 *)(prog->data + op->offset),
+					     op->len);
+			break;
+		case FBTFT_INIT_DELAY:
+			fbtft_init_sleep(op->len);
+			break;
+		}
+	}
+
+	return 0;
+}
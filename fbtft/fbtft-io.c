@@ -1,17 +1,14 @@
 #include <linux/export.h>
 #include <linux/errno.h>
 #include <linux/gpio.h>
+#include <linux/i2c.h>
+#include <linux/slab.h>
 #include <linux/spi/spi.h>
+#include <drm/tinydrm/tinydrm-i80.h>
 #include "fbtft.h"
 
 int fbtft_write_spi(struct fbtft_par *par, void *buf, size_t len)
 {
-	struct spi_transfer t = {
-		.tx_buf = buf,
-		.len = len,
-	};
-	struct spi_message m;
-
 	fbtft_par_dbg_hex(DEBUG_WRITE, par, par->info->device, u8, buf, len,
 		"%s(len=%d): ", __func__, len);
 
@@ -21,9 +18,8 @@ int fbtft_write_spi(struct fbtft_par *par, void *buf, size_t len)
 		return -1;
 	}
 
-	spi_message_init(&m);
-	spi_message_add_tail(&t, &m);
-	return spi_sync(par->spi, &m);
+	return tinydrm_spi_qos_transfer(&par->spi_qos, par->spi, 0,
+					par->spi->bits_per_word, buf, len);
 }
 EXPORT_SYMBOL(fbtft_write_spi);
 
@@ -121,115 +117,65 @@ int fbtft_read_spi(struct fbtft_par *par, void *buf, size_t len)
 }
 EXPORT_SYMBOL(fbtft_read_spi);
 
-static void tinydrm_i80_write_value(struct gpio_descs *db,
-				    struct gpio_desc *wr, u32 value,
-				    u32 *prev_value)
-{
-	int i, values[32];
-
-
-if (prev_value && *prev_value == value) {
-	gpiod_set_value_cansleep(wr, 0);
-	gpiod_set_value_cansleep(wr, 0);
-	gpiod_set_value_cansleep(wr, 1);
-
-} else {
-	for (i = 0; i < db->ndescs; i++, value >>= 1)
-		values[i] = value & 1;
-
-	gpiod_set_value_cansleep(wr, 0);
-	gpiod_set_array_value_cansleep(db->ndescs, db->desc, values);
-	gpiod_set_value_cansleep(wr, 1);
-
-
-}
-	if (prev_value)
-		*prev_value = value;
-}
-
-static
-void tinydrm_i80_write_buf(struct gpio_descs *db, struct gpio_desc *wr,
-			   void *buf, size_t len)
+int fbtft_write_gpio8_wr(struct fbtft_par *par, void *buf, size_t len)
 {
-	unsigned int width = db->ndescs;
-	size_t i;
-
-	if (width == 8) {
-		u8 *buf8 = buf;
-		u32 prev_val = ~*buf8;
+	fbtft_par_dbg_hex(DEBUG_WRITE, par, par->info->device, u8, buf, len,
+		"%s(len=%d): ", __func__, len);
 
-		for (i = 0; i < len; i++)
-			tinydrm_i80_write_value(db, wr, *buf8++, NULL);
-	} else if (width == 16) {
-		u16 *buf16 = buf;
-		u32 prev_val = ~*buf16;
+	tinydrm_i80_bus_write_buf(par->i80, buf, len);
 
-		for (i = 0; i < (len / 2); i++)
-			tinydrm_i80_write_value(db, wr, *buf16++, NULL);
-	} else {
-		WARN_ON_ONCE(1);
-	}
+	return 0;
 }
+EXPORT_SYMBOL(fbtft_write_gpio8_wr);
 
-int fbtft_write_gpio8_wr(struct fbtft_par *par, void *buf, size_t len)
+int fbtft_write_gpio16_wr(struct fbtft_par *par, void *buf, size_t len)
 {
 	fbtft_par_dbg_hex(DEBUG_WRITE, par, par->info->device, u8, buf, len,
 		"%s(len=%d): ", __func__, len);
 
-	tinydrm_i80_write_buf(par->gpio.db, par->gpio.wr, buf, len);
+	tinydrm_i80_bus_write_buf(par->i80, buf, len);
 
 	return 0;
 }
-EXPORT_SYMBOL(fbtft_write_gpio8_wr);
+EXPORT_SYMBOL(fbtft_write_gpio16_wr);
 
-int fbtft_write_gpio16_wr(struct fbtft_par *par, void *buf, size_t len)
+/**
+ * fbtft_write_i2c() - write data stream over I2C
+ * @par: Driver data
+ * @buf: Buffer to write
+ * @len: Length of buffer
+ *
+ * Sends @buf as one data stream (control byte 0x40) in a single transfer.
+ * The transmit buffer has a spare byte in front for the control byte so it
+ * isn't copied. The bus clock is set by the adapter, Fast-mode Plus needs
+ * clock-frequency = <1000000> on the adapter node.
+ */
+int fbtft_write_i2c(struct fbtft_par *par, void *buf, size_t len)
 {
-#if 0
-	u16 data;
-	int i;
-#ifndef DO_NOT_OPTIMIZE_FBTFT_WRITE_GPIO
-	static u16 prev_data;
-#endif
+	u8 *data = buf;
+	int ret;
 
 	fbtft_par_dbg_hex(DEBUG_WRITE, par, par->info->device, u8, buf, len,
 		"%s(len=%d): ", __func__, len);
 
-	while (len) {
-		data = *(u16 *)buf;
-
-		/* Start writing by pulling down /WR */
-		gpio_set_value(par->gpio.wr, 0);
-
-		/* Set data */
-#ifndef DO_NOT_OPTIMIZE_FBTFT_WRITE_GPIO
-		if (data == prev_data) {
-			gpio_set_value(par->gpio.wr, 0); /* used as delay */
-		} else {
-			for (i = 0; i < 16; i++) {
-				if ((data & 1) != (prev_data & 1))
-					gpio_set_value(par->gpio.db[i],
-								data & 1);
-				data >>= 1;
-				prev_data >>= 1;
-			}
-		}
-#else
-		for (i = 0; i < 16; i++) {
-			gpio_set_value(par->gpio.db[i], data & 1);
-			data >>= 1;
-		}
-#endif
+	if (buf == par->txbuf.buf) {
+		data--;
+	} else {
+		data = kmalloc(len + 1, GFP_KERNEL);
+		if (!data)
+			return -ENOMEM;
+		memcpy(data + 1, buf, len);
+	}
 
-		/* Pullup /WR */
-		gpio_set_value(par->gpio.wr, 1);
+	data[0] = FBTFT_I2C_DATA_STREAM;
+	ret = i2c_master_send(par->i2c, data, len + 1);
 
-#ifndef DO_NOT_OPTIMIZE_FBTFT_WRITE_GPIO
-		prev_data = *(u16 *)buf;
-#endif
-		buf += 2;
-		len -= 2;
-	}
-#endif
-	return 0;
+	if (data != buf - 1)
+		kfree(data);
+
+	if (ret < 0)
+		return ret;
+
+	return ret == len + 1 ? 0 : -EIO;
 }
-EXPORT_SYMBOL(fbtft_write_gpio16_wr);
+EXPORT_SYMBOL(fbtft_write_i2c);
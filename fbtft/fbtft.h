@@ -17,12 +17,18 @@
 
 #include "../include/drm/tinydrm/tinydrm.h"
 #include "../include/drm/tinydrm/tinydrm-helpers.h"
+#include <drm/tinydrm/tinydrm-helpers2.h>
 
 #include <linux/fb.h>
+#include <linux/i2c.h>
 #include <linux/spinlock.h>
 #include <linux/spi/spi.h>
 #include <linux/platform_device.h>
 
+struct dentry;
+struct drm_clip_rect;
+struct fbtft_init_prog;
+
 #define FBTFT_ONBOARD_BACKLIGHT 2
 
 #define FBTFT_GPIO_NO_MATCH		0xFFFF
@@ -62,6 +68,10 @@ struct fbtft_par;
  * @set_var: Configure LCD with values from variables like @rotate and @bgr
  *           (optional)
  * @set_gamma: Set Gamma curve (optional)
+ * @debugfs_init: Create driver specific debugfs files in @root (optional)
+ * @fill_rect: Fill @rect with the RGB565 @color in hardware (optional)
+ * @copy_rect: Move the content of @src by @dx/@dy in hardware. Return
+ *             -EOPNOTSUPP to fall back to sending pixels (optional)
  *
  * Most of these operations have default functions assigned to them in
  *     fbtft_framebuffer_alloc()
@@ -86,6 +96,13 @@ struct fbtft_ops {
 
 	int (*set_var)(struct fbtft_par *par);
 	int (*set_gamma)(struct fbtft_par *par, unsigned long *curves);
+
+	void (*debugfs_init)(struct fbtft_par *par, struct dentry *root);
+
+	int (*fill_rect)(struct fbtft_par *par,
+			 const struct drm_clip_rect *rect, u16 color);
+	int (*copy_rect)(struct fbtft_par *par,
+			 const struct drm_clip_rect *src, int dx, int dy);
 };
 
 struct fbtft_display {
@@ -132,6 +149,7 @@ struct fbtft_par {
 	struct tinydrm_device tinydrm;
 	struct spi_device *spi;
 	struct platform_device *pdev;
+	struct i2c_client *i2c;
 	struct fbtft_display display;
 	struct fbtft_fb_info *info;
 	struct fbtft_platform_data *pdata;
@@ -156,7 +174,15 @@ struct fbtft_par {
 		struct gpio_descs *db;
 		int led[16];
 	} gpio;
+	struct tinydrm_i80_bus *i80;
+	struct tinydrm_spi_qos spi_qos;
+	struct {
+		u64 *sent;
+		u64 *next;
+		bool valid;
+	} rowhash;
 	s16 *init_sequence;
+	struct fbtft_init_prog *init_prog;
 	struct {
 		struct mutex lock;
 		unsigned long *curves;
@@ -167,6 +193,13 @@ struct fbtft_par {
 	/* Used in fb_ra8875, fb_ssd1331 */
 	unsigned long debug;
 
+	struct tinydrm_deferred_init dinit;
+	bool enabled;
+	bool retained;
+	bool sleeping;
+	bool stale;
+	struct drm_framebuffer *last_fb;
+
 	bool bgr;
 	void *extra;
 };
@@ -180,8 +213,9 @@ struct fbtft_par {
 void fbtft_dbg_hex(const struct device *dev, int groupsize,
 		   void *buf, size_t len, const char *fmt, ...);
 int fbtft_probe_common(struct fbtft_display *display, struct spi_device *sdev,
-		       struct platform_device *pdev);
+		       struct platform_device *pdev, struct i2c_client *client);
 int fbtft_remove_common(struct device *dev, struct fbtft_par *par);
+extern const struct dev_pm_ops fbtft_pm_ops;
 
 #ifdef CONFIG_BACKLIGHT_CLASS_DEVICE
 void fbtft_register_backlight(struct fbtft_par *par);
@@ -195,12 +229,17 @@ static inline void fbtft_unregister_backlight(struct fbtft_par *par)
 }
 #endif
 
+/* fbtft-init.c */
+int fbtft_init_compile(struct fbtft_par *par);
+int fbtft_init_display(struct fbtft_par *par);
+
 /* fbtft-io.c */
 int fbtft_write_spi(struct fbtft_par *par, void *buf, size_t len);
 int fbtft_write_spi_emulate_9(struct fbtft_par *par, void *buf, size_t len);
 int fbtft_read_spi(struct fbtft_par *par, void *buf, size_t len);
 int fbtft_write_gpio8_wr(struct fbtft_par *par, void *buf, size_t len);
 int fbtft_write_gpio16_wr(struct fbtft_par *par, void *buf, size_t len);
+int fbtft_write_i2c(struct fbtft_par *par, void *buf, size_t len);
 
 /* fbtft-bus.c */
 int fbtft_write_vmem16_bus16(struct fbtft_par *par, size_t offset, size_t len);
@@ -210,12 +249,17 @@ void fbtft_write_reg8_bus8(struct fbtft_par *par, int len, ...);
 void fbtft_write_reg8_bus9(struct fbtft_par *par, int len, ...);
 void fbtft_write_reg16_bus8(struct fbtft_par *par, int len, ...);
 void fbtft_write_reg16_bus16(struct fbtft_par *par, int len, ...);
+void fbtft_write_reg8_i2c(struct fbtft_par *par, int len, ...);
+
+/* I2C control byte, SSD1306 style */
+#define FBTFT_I2C_CMD_STREAM	0x00
+#define FBTFT_I2C_DATA_STREAM	0x40
 
 #define FBTFT_REGISTER_DRIVER(_name, _compatible, _display)                \
 									   \
 static int fbtft_driver_probe_spi(struct spi_device *spi)                  \
 {                                                                          \
-	return fbtft_probe_common(_display, spi, NULL);                    \
+	return fbtft_probe_common(_display, spi, NULL, NULL);              \
 }                                                                          \
 									   \
 static int fbtft_driver_remove_spi(struct spi_device *spi)                 \
@@ -227,7 +271,7 @@ static int fbtft_driver_remove_spi(struct spi_device *spi)                 \
 									   \
 static int fbtft_driver_probe_pdev(struct platform_device *pdev)           \
 {                                                                          \
-	return fbtft_probe_common(_display, NULL, pdev);                   \
+	return fbtft_probe_common(_display, NULL, pdev, NULL);             \
 }                                                                          \
 									   \
 static int fbtft_driver_remove_pdev(struct platform_device *pdev)          \
@@ -237,6 +281,19 @@ static int fbtft_driver_remove_pdev(struct platform_device *pdev)          \
 	return fbtft_remove_common(&pdev->dev, par);                       \
 }                                                                          \
 									   \
+static int fbtft_driver_probe_i2c(struct i2c_client *client,               \
+				  const struct i2c_device_id *id)          \
+{                                                                          \
+	return fbtft_probe_common(_display, NULL, NULL, client);           \
+}                                                                          \
+									   \
+static int fbtft_driver_remove_i2c(struct i2c_client *client)              \
+{                                                                          \
+	struct fbtft_par *par = i2c_get_clientdata(client);                \
+									   \
+	return fbtft_remove_common(&client->dev, par);                     \
+}                                                                          \
+									   \
 static const struct of_device_id dt_ids[] = {                              \
 	{ .compatible = _compatible },                                     \
 	{},                                                                \
@@ -249,6 +306,8 @@ static struct spi_driver fbtft_driver_spi_driver = {                       \
 	.driver = {                                                        \
 		.name   = _name,                                           \
 		.of_match_table = of_match_ptr(dt_ids),                    \
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,                   \
+		.pm = &fbtft_pm_ops,                                       \
 	},                                                                 \
 	.probe  = fbtft_driver_probe_spi,                                  \
 	.remove = fbtft_driver_remove_spi,                                 \
@@ -259,11 +318,31 @@ static struct platform_driver fbtft_driver_platform_driver = {             \
 		.name   = _name,                                           \
 		.owner  = THIS_MODULE,                                     \
 		.of_match_table = of_match_ptr(dt_ids),                    \
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,                   \
+		.pm = &fbtft_pm_ops,                                       \
 	},                                                                 \
 	.probe  = fbtft_driver_probe_pdev,                                 \
 	.remove = fbtft_driver_remove_pdev,                                \
 };                                                                         \
 									   \
+static const struct i2c_device_id fbtft_driver_i2c_ids[] = {               \
+	{ _name, 0 },                                                      \
+	{},                                                                \
+};                                                                         \
+MODULE_DEVICE_TABLE(i2c, fbtft_driver_i2c_ids);                            \
+									   \
+static struct i2c_driver fbtft_driver_i2c_driver = {                       \
+	.driver = {                                                        \
+		.name   = _name,                                           \
+		.of_match_table = of_match_ptr(dt_ids),                    \
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,                   \
+		.pm = &fbtft_pm_ops,                                       \
+	},                                                                 \
+	.id_table = fbtft_driver_i2c_ids,                                  \
+	.probe  = fbtft_driver_probe_i2c,                                  \
+	.remove = fbtft_driver_remove_i2c,                                 \
+};                                                                         \
+									   \
 static int __init fbtft_driver_module_init(void)                           \
 {                                                                          \
 	int ret;                                                           \
@@ -271,11 +350,24 @@ static int __init fbtft_driver_module_init(void)                           \
 	ret = spi_register_driver(&fbtft_driver_spi_driver);               \
 	if (ret < 0)                                                       \
 		return ret;                                                \
-	return platform_driver_register(&fbtft_driver_platform_driver);    \
+	ret = platform_driver_register(&fbtft_driver_platform_driver);     \
+	if (ret < 0)                                                       \
+		goto err_spi;                                              \
+	ret = i2c_add_driver(&fbtft_driver_i2c_driver);                    \
+	if (ret < 0)                                                       \
+		goto err_platform;                                         \
+	return 0;                                                          \
+									   \
+err_platform:                                                              \
+	platform_driver_unregister(&fbtft_driver_platform_driver);         \
+err_spi:                                                                   \
+	spi_unregister_driver(&fbtft_driver_spi_driver);                   \
+	return ret;                                                        \
 }                                                                          \
 									   \
 static void __exit fbtft_driver_module_exit(void)                          \
 {                                                                          \
+	i2c_del_driver(&fbtft_driver_i2c_driver);                          \
 	spi_unregister_driver(&fbtft_driver_spi_driver);                   \
 	platform_driver_unregister(&fbtft_driver_platform_driver);         \
 }                                                                          \
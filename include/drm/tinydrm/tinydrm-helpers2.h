@@ -24,14 +24,206 @@ In file included from /home/pi/tinydrm/tinydrm/include/drm/tinydrm/tinydrm-helpe
 */
 struct drm_framebuffer;
 
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <drm/drm_plane.h>
 #include <drm/tinydrm/tinydrm-helpers.h>
 
+struct dentry;
+struct device;
+struct drm_crtc;
+struct drm_crtc_state;
+struct drm_plane;
+struct drm_plane_state;
+struct drm_simple_display_pipe;
 struct gpio_desc;
+struct spi_device;
+struct tinydrm_device;
+
+/**
+ * struct tinydrm_bw_policy - Adaptive reduced bandwidth policy
+ * @adaptive: Policy is enabled
+ * @threshold: Number of consecutive large flushes not keeping up with the
+ *             damage rate before switching to the reduced format
+ * @settle_ms: Time without damage before the exact frame is restored
+ * @reduced: The reduced format is in use
+ * @lossy: Display content has been sent using the reduced format
+ * @damage_us: Average interval between damage in microseconds
+ * @flush_us: Average flush duration in microseconds
+ * @restore: Called from a worker when the content has settled and is lossy.
+ *           It should take the flush lock, check
+ *           tinydrm_bw_policy_restore_needed(), flush the exact frame and
+ *           clear @lossy.
+ */
+struct tinydrm_bw_policy {
+	bool adaptive;
+	u32 threshold;
+	u32 settle_ms;
+	bool reduced;
+	bool lossy;
+	u32 damage_us;
+	u32 flush_us;
+	void (*restore)(struct tinydrm_bw_policy *policy);
+
+	/* private: */
+	struct device *dev;
+	unsigned int streak;
+	ktime_t last_damage;
+	ktime_t flush_start;
+	struct delayed_work restore_work;
+};
+
+/**
+ * struct tinydrm_spi_qos - SPI bus sharing
+ * @chunk_size: Largest transfer in bytes, zero for no limit
+ * @max_util: Share of the bus time the display may use in percent
+ * @display_hold_us: Average time the display held the bus per chunk
+ * @max_display_hold_us: Longest time the display held the bus for one chunk.
+ *                       Other devices are not observed, this is only the
+ *                       upper bound on how long one of their transfers could
+ *                       have been delayed.
+ * @overhead_us: Average time per chunk beyond the time on the wire, spent in
+ *               the SPI core and controller driver
+ * @util: Bus utilisation of the last transfer in percent
+ */
+struct tinydrm_spi_qos {
+	u32 chunk_size;
+	u32 max_util;
+	u32 display_hold_us;
+	u32 max_display_hold_us;
+	u32 overhead_us;
+	u32 util;
+};
+
+/**
+ * struct tinydrm_mode_rect - Damage rectangle
+ * @x1: Horizontal starting coordinate (inclusive)
+ * @y1: Vertical starting coordinate (inclusive)
+ * @x2: Horizontal ending coordinate (exclusive)
+ * @y2: Vertical ending coordinate (exclusive)
+ *
+ * Element of the FB_DAMAGE_CLIPS blob, same layout as &drm_mode_rect.
+ */
+struct tinydrm_mode_rect {
+	__s32 x1;
+	__s32 y1;
+	__s32 x2;
+	__s32 y2;
+};
+
+/**
+ * struct tinydrm_deferred_init - Panel bring-up from a worker
+ * @pipe: Display pipe
+ * @init: Optional one-time panel initialization, run before the first enable
+ * @enable: The driver's pipe enable, run from the worker
+ *
+ * Lets probe and modeset return without waiting for panel reset and
+ * initialization delays. The enable callback sets the enabled state and
+ * does the first flush, flushes before that are skipped by the driver.
+ */
+struct tinydrm_deferred_init {
+	struct drm_simple_display_pipe *pipe;
+	int (*init)(struct tinydrm_deferred_init *dinit);
+	void (*enable)(struct drm_simple_display_pipe *pipe,
+		       struct drm_crtc_state *crtc_state);
+
+	/* private: */
+	struct work_struct work;
+	struct completion done;
+	struct mutex lock;
+	bool init_done;
+	int init_ret;
+	bool enable_pending;
+};
+
+/* Overlays and the cursor */
+#define TINYDRM_MAX_OVERLAYS	2
+#define TINYDRM_MAX_SW_PLANES	(TINYDRM_MAX_OVERLAYS + 1)
+
+/**
+ * struct tinydrm_sw_plane - Plane composited while flushing
+ * @base: Base &drm_plane
+ * @pipe: Display pipe the plane is shown on
+ */
+struct tinydrm_sw_plane {
+	struct drm_plane base;
+	struct drm_simple_display_pipe *pipe;
+
+	/* private: protected by &tinydrm_device->dirty_lock */
+	struct drm_framebuffer *fb;
+	struct drm_clip_rect src;
+	struct drm_clip_rect dst;
+	void *linebuf;
+};
 
 int tinydrm_rgb565_buf_copy(void *dst, struct drm_framebuffer *fb,
 			    struct drm_clip_rect *clip, bool swap);
+int tinydrm_rgb444_buf_copy(void *dst, void *linebuf,
+			    struct drm_framebuffer *fb,
+			    struct drm_clip_rect *clip);
+int tinydrm_rgb666_buf_copy(void *dst, void *linebuf,
+			    struct drm_framebuffer *fb,
+			    struct drm_clip_rect *clip);
 
 void tinydrm_hw_reset(struct gpio_desc *reset, unsigned int assert_ms,
 		      unsigned int settle_ms);
 
+void tinydrm_row_hashes(u64 *hashes, const void *vaddr, unsigned int pitch,
+			size_t len, unsigned int y1, unsigned int y2);
+int tinydrm_find_vscroll(const u64 *old, const u64 *new, unsigned int y1,
+			 unsigned int y2, unsigned int min_overlap);
+
+int devm_tinydrm_bw_policy_init(struct device *dev,
+				struct tinydrm_bw_policy *policy,
+				void (*restore)(struct tinydrm_bw_policy *policy));
+bool tinydrm_bw_policy_begin(struct tinydrm_bw_policy *policy, bool large);
+void tinydrm_bw_policy_end(struct tinydrm_bw_policy *policy, bool reduced,
+			   bool full);
+bool tinydrm_bw_policy_restore_needed(struct tinydrm_bw_policy *policy);
+void tinydrm_bw_policy_debugfs_init(struct tinydrm_bw_policy *policy,
+				    struct dentry *parent);
+
+int devm_tinydrm_deferred_init(struct device *dev,
+			       struct tinydrm_deferred_init *dinit,
+			       struct drm_simple_display_pipe *pipe,
+			       int (*init)(struct tinydrm_deferred_init *dinit),
+			       void (*enable)(struct drm_simple_display_pipe *pipe,
+					      struct drm_crtc_state *crtc_state));
+void tinydrm_deferred_enable(struct tinydrm_deferred_init *dinit);
+int tinydrm_deferred_wait(struct tinydrm_deferred_init *dinit);
+
+int devm_tinydrm_runtime_pm_init(struct device *dev);
+
+void tinydrm_spi_qos_init(struct device *dev, struct tinydrm_spi_qos *qos);
+int tinydrm_spi_qos_transfer(struct tinydrm_spi_qos *qos,
+			     struct spi_device *spi, u32 speed_hz, u8 bpw,
+			     const void *buf, size_t len);
+void tinydrm_spi_qos_debugfs_init(struct tinydrm_spi_qos *qos,
+				  struct dentry *parent);
+
+unsigned int tinydrm_plan_clips(struct drm_clip_rect *clips,
+				unsigned int num_clips, unsigned int max_clips,
+				unsigned int overhead);
+void tinydrm_fbdev_init_deferred_io(struct tinydrm_device *tdev);
+
+int tinydrm_plane_enable_fb_damage_clips(struct drm_plane *plane);
+int tinydrm_plane_damage_clips(struct drm_plane_state *state,
+			       struct drm_clip_rect **clips);
+void tinydrm_display_pipe_damage_update(struct drm_simple_display_pipe *pipe,
+					struct drm_plane_state *old_state);
+int tinydrm_vblank_emulation_init(struct drm_crtc *crtc);
+int tinydrm_flip_queue_init(struct drm_simple_display_pipe *pipe);
+
+int tinydrm_sw_planes_init(struct tinydrm_sw_plane *planes,
+			   struct drm_simple_display_pipe *pipe);
+bool tinydrm_sw_planes_overlap(struct tinydrm_sw_plane *planes,
+			       unsigned int count,
+			       const struct drm_clip_rect *clip);
+void tinydrm_sw_planes_blend(struct tinydrm_sw_plane *planes,
+			     unsigned int count, void *dst,
+			     const struct drm_clip_rect *clip,
+			     unsigned int bpp, bool swap);
+
 #endif /* __LINUX_TINYDRM_HELPERS_ADD_H */
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2018 The tinydrm contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __LINUX_TINYDRM_I80_H
+#define __LINUX_TINYDRM_I80_H
+
+#include <linux/bitops.h>
+#include <linux/types.h>
+
+struct device;
+struct gpio_desc;
+struct gpio_descs;
+struct tinydrm_i80_bus;
+
+/* Slot flags */
+#define TINYDRM_I80_CMD		BIT(0) /* Index/dc low */
+#define TINYDRM_I80_BEGIN	BIT(1) /* Assert cs before */
+#define TINYDRM_I80_END		BIT(2) /* Deassert cs after */
+
+struct tinydrm_i80_bus *devm_tinydrm_i80_bus_init(struct device *dev,
+						  struct gpio_desc *wr,
+						  struct gpio_descs *db);
+unsigned int tinydrm_i80_bus_width(struct tinydrm_i80_bus *bus);
+void tinydrm_i80_bus_write_word(struct tinydrm_i80_bus *bus, u16 word);
+void tinydrm_i80_bus_write_buf(struct tinydrm_i80_bus *bus, const void *buf,
+			       size_t len);
+
+int tinydrm_i80_bus_start_thread(struct device *dev,
+				 struct tinydrm_i80_bus *bus,
+				 struct gpio_desc *cs, struct gpio_desc *dc,
+				 unsigned int cpu);
+bool tinydrm_i80_bus_threaded(struct tinydrm_i80_bus *bus);
+void *tinydrm_i80_bus_get_slot(struct tinydrm_i80_bus *bus, size_t *size);
+void tinydrm_i80_bus_queue_slot(struct tinydrm_i80_bus *bus, size_t len,
+				unsigned int flags);
+void tinydrm_i80_bus_wait_idle(struct tinydrm_i80_bus *bus);
+
+#endif /* __LINUX_TINYDRM_I80_H */
@@ -12,31 +12,48 @@
 
 #include <drm/tinydrm/tinydrm.h>
 #include <drm/tinydrm/tinydrm-helpers2.h>
+#include <drm/tinydrm/tinydrm-regmap.h>
 
 /**
  * struct tinydrm_ili9325 - tinydrm ILI9325 device
  * @tinydrm: Base &tinydrm_device
  * @reg: Register map (optional)
+ * @stream: Pixel stream operation used for GRAM writes (optional)
  * @enabled: Pipeline is enabled
  * @tx_buf: Transmit buffer
  * @swap_bytes: Swap pixel data bytes
  * @always_tx_buf:
  * @rotation: Rotation in degrees Counter Clock Wise
+ * @standby: Controller is in standby mode, registers are cached
+ * @display_ctrl: Display Control 1 value to restore on wake
  * @reset: Optional reset gpio
  * @backlight: Optional backlight device
  * @regulator: Optional regulator
+ * @funcs: The driver's display pipe functions
+ * @dinit: Runs the driver's enable from a worker
+ * @retained: Controller kept its registers and GRAM since it was disabled
+ * @stale: A flush was skipped while disabled
+ * @last_fb: Framebuffer of the last successful flush, holds a reference
  */
 struct tinydrm_ili9325 {
 	struct tinydrm_device tinydrm;
 	struct regmap *reg;
+	struct tinydrm_regmap_stream stream;
 	bool enabled;
 	void *tx_buf;
 	bool swap_bytes;
 	bool always_tx_buf;
 	unsigned int rotation;
+	bool standby;
+	unsigned int display_ctrl;
 	struct gpio_desc *reset;
 	struct backlight_device *backlight;
 	struct regulator *regulator;
+	const struct drm_simple_display_pipe_funcs *funcs;
+	struct tinydrm_deferred_init dinit;
+	bool retained;
+	bool stale;
+	struct drm_framebuffer *last_fb;
 };
 
 static inline struct tinydrm_ili9325 *
@@ -47,17 +64,31 @@ tinydrm_to_ili9325(struct tinydrm_device *tdev)
 
 int tinydrm_ili9325_init(struct device *dev, struct tinydrm_ili9325 *cntrl,
 			 const struct drm_simple_display_pipe_funcs *funcs,
-			 struct regmap *reg, struct drm_driver *driver,
+			 struct regmap *reg,
+			 const struct tinydrm_regmap_stream *stream,
+			 struct drm_driver *driver,
 			 const struct drm_display_mode *mode,
 			 unsigned int rotation);
 
-static inline void tinydrm_ili9325_reset(struct tinydrm_ili9325 *controller)
-{
-	tinydrm_hw_reset(controller->reset, 1, 10);
-}
+void tinydrm_ili9325_reset(struct tinydrm_ili9325 *ili9325);
+int tinydrm_ili9325_update(struct tinydrm_ili9325 *ili9325,
+			   unsigned int regnr, unsigned int val);
+int tinydrm_ili9325_standby(struct tinydrm_ili9325 *ili9325);
+int tinydrm_ili9325_wake(struct tinydrm_ili9325 *ili9325);
+void tinydrm_ili9325_enable_flush(struct tinydrm_ili9325 *ili9325);
+
+extern const struct dev_pm_ops tinydrm_ili9325_pm_ops;
+
+struct regmap *tinydrm_ili9325_i80_init(struct device *dev,
+					struct gpio_desc *cs,
+					struct gpio_desc *idx,
+					struct gpio_desc *wr,
+					struct gpio_descs *db,
+					struct tinydrm_regmap_stream *stream);
 
 struct regmap *tinydrm_ili9325_spi_init(struct spi_device *spi,
-					unsigned int id);
+					unsigned int id,
+					struct tinydrm_regmap_stream *stream);
 
 int tinydrm_ili9325_debugfs_init(struct drm_minor *minor);
 
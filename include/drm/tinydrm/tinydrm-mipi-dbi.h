@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2018 The tinydrm contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __LINUX_TINYDRM_MIPI_DBI_ADD_H
+#define __LINUX_TINYDRM_MIPI_DBI_ADD_H
+
+#include <drm/tinydrm/mipi-dbi.h>
+#include <drm/tinydrm/tinydrm-helpers2.h>
+#include <drm/tinydrm/tinydrm-wall.h>
+
+#define MIPI_DBI_MADCTL_MY	BIT(7)
+#define MIPI_DBI_MADCTL_MV	BIT(5)
+
+/**
+ * struct tinydrm_mipi_dbi - MIPI DBI controller with additional flush stages
+ * @mipi: Base &mipi_dbi
+ * @hw_scroll: Hardware scrolling is enabled for the device
+ * @scroll_usable: The current address mode allows hardware scrolling
+ * @scroll_reversed: Row address order is reversed (MY)
+ * @scroll_offset: Page address of the first framebuffer row
+ * @hashes_valid: @sent_hashes matches the display content
+ * @sent_hashes: Row hashes of the content on the display
+ * @next_hashes: Row hashes of the content being flushed
+ * @bpp: Bits per pixel on the wire when not reduced
+ * @cur_bpp: Pixel format set in the controller, zero if unknown after the
+ *           controller lost its configuration
+ * @policy: Switches to RGB444 during heavy motion if adaptive
+ * @funcs: The driver's display pipe functions
+ * @dinit: Runs the driver's enable from a worker
+ * @keep_alive: Take over the panel as is on the first enable
+ * @retained: Panel kept its configuration and GRAM since it was disabled
+ * @sleeping: Panel was put in sleep mode by runtime suspend
+ * @stale: A flush was skipped while disabled
+ * @last_fb: Framebuffer of the last successful flush, holds a reference
+ * @sw_planes: Overlays and cursor blended into the flushed pixels
+ * @num_sw_planes: Number of initialized @sw_planes
+ * @tile: Video wall tile, see tinydrm_mipi_dbi_add_tile()
+ * @qos: Sharing of the SPI bus while flushing
+ * @cmd_buf: DMA safe buffer for the RAMWR command byte
+ * @linebuf: Framebuffer line read buffer for the packed pixel formats
+ */
+struct tinydrm_mipi_dbi {
+	struct mipi_dbi mipi;
+	bool hw_scroll;
+	bool scroll_usable;
+	bool scroll_reversed;
+	unsigned int scroll_offset;
+	bool hashes_valid;
+	u64 *sent_hashes;
+	u64 *next_hashes;
+	unsigned int bpp;
+	unsigned int cur_bpp;
+	struct tinydrm_bw_policy policy;
+	const struct drm_simple_display_pipe_funcs *funcs;
+	struct tinydrm_deferred_init dinit;
+	bool keep_alive;
+	bool retained;
+	bool sleeping;
+	bool stale;
+	struct drm_framebuffer *last_fb;
+	struct tinydrm_sw_plane sw_planes[TINYDRM_MAX_SW_PLANES];
+	unsigned int num_sw_planes;
+	struct tinydrm_wall_tile tile;
+	struct tinydrm_spi_qos qos;
+	u8 *cmd_buf;
+	void *linebuf;
+};
+
+static inline struct tinydrm_mipi_dbi *
+mipi_to_tinydrm_mipi_dbi(struct mipi_dbi *mipi)
+{
+	return container_of(mipi, struct tinydrm_mipi_dbi, mipi);
+}
+
+int tinydrm_mipi_dbi_init(struct device *dev, struct tinydrm_mipi_dbi *tmipi,
+			  const struct drm_simple_display_pipe_funcs *pipe_funcs,
+			  struct drm_driver *driver,
+			  const struct drm_display_mode *mode,
+			  unsigned int rotation);
+void tinydrm_mipi_dbi_set_address_mode(struct tinydrm_mipi_dbi *tmipi,
+				       u8 addr_mode);
+int tinydrm_mipi_dbi_set_wire_format(struct tinydrm_mipi_dbi *tmipi,
+				     unsigned int bpp, bool adaptive);
+int tinydrm_mipi_dbi_set_pixel_format(struct tinydrm_mipi_dbi *tmipi,
+				      unsigned int bpp);
+bool tinydrm_mipi_dbi_keep_alive(struct tinydrm_mipi_dbi *tmipi,
+				 int addr_mode, unsigned int bpp);
+void tinydrm_mipi_dbi_enable_flush(struct tinydrm_mipi_dbi *tmipi);
+int tinydrm_mipi_dbi_add_tile(struct tinydrm_mipi_dbi *tmipi);
+
+extern const struct dev_pm_ops tinydrm_mipi_dbi_pm_ops;
+
+#ifdef CONFIG_DEBUG_FS
+int tinydrm_mipi_dbi_debugfs_init(struct drm_minor *minor);
+#else
+#define tinydrm_mipi_dbi_debugfs_init	NULL
+#endif
+
+#endif /* __LINUX_TINYDRM_MIPI_DBI_ADD_H */
@@ -10,19 +10,59 @@
 #ifndef __LINUX_TINYDRM_REGMAP_H
 #define __LINUX_TINYDRM_REGMAP_H
 
-
+#include <linux/types.h>
 
 //Hmmmm
 struct gpio_descs;
 struct gpio_desc;
 struct dentry;
+struct device;
 struct regmap;
+struct regmap_config;
+
+/**
+ * tinydrm_regmap_fill_t - Produce @len bytes at stream offset @offset
+ */
+typedef int (*tinydrm_regmap_fill_t)(void *dst, size_t offset, size_t len,
+				     void *arg);
+
+/**
+ * struct tinydrm_regmap_stream - Pixel stream operation next to a regmap
+ * @write: Select register @regnr once and stream @len bytes from @buf
+ *         straight to the transport.
+ * @fill: Like @write, but the bytes are produced chunk by chunk using @fill
+ *        while the previous chunk is being written (optional).
+ * @context: Bus context passed to @write and @fill
+ *
+ * Register traffic goes through &regmap, but pixel data bypasses the regmap
+ * core (locking, formatting and possible copying) using this operation.
+ * The buffer has the same layout as for regmap_raw_write().
+ */
+struct tinydrm_regmap_stream {
+	int (*write)(void *context, unsigned int regnr, const void *buf,
+		     size_t len);
+	int (*fill)(void *context, unsigned int regnr, size_t len,
+		    size_t granule, tinydrm_regmap_fill_t fill, void *arg);
+	void *context;
+};
 
 bool tinydrm_regmap_raw_swap_bytes(struct regmap *reg);
 
-struct regmap *tinydrm_i80_init(struct device *dev, unsigned int reg_width,
+int tinydrm_regmap_stream_write(struct regmap *reg,
+				const struct tinydrm_regmap_stream *stream,
+				unsigned int regnr, const void *buf,
+				size_t len);
+int tinydrm_regmap_stream_fill(struct regmap *reg,
+			       const struct tinydrm_regmap_stream *stream,
+			       unsigned int regnr, void *buf, size_t len,
+			       size_t granule, tinydrm_regmap_fill_t fill,
+			       void *arg);
+
+struct regmap *tinydrm_i80_init(struct device *dev,
+				const struct regmap_config *config,
 				struct gpio_desc *cs, struct gpio_desc *idx,
-				struct gpio_desc *wr, struct gpio_descs *db);
+				struct gpio_desc *wr, struct gpio_descs *db,
+				struct tinydrm_regmap_stream *stream);
 
 int tinydrm_regmap_debugfs_init(struct regmap *reg, struct dentry *parent);
 
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2018 The tinydrm contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __LINUX_TINYDRM_WALL_H
+#define __LINUX_TINYDRM_WALL_H
+
+#include <linux/atomic.h>
+#include <linux/list.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <drm/tinydrm/tinydrm.h>
+
+#define TINYDRM_WALL_MAX_TILES	4
+
+struct tinydrm_wall;
+struct tinydrm_wall_tile;
+
+/**
+ * struct tinydrm_wall_tile_funcs - Video wall panel operations
+ * @enable: Power up and initialize the panel
+ * @disable: Turn off the panel
+ * @flush: Send @clip of @fb to the panel. @clip is in framebuffer
+ *         coordinates and inside the tile, subtract &tinydrm_wall_tile->x
+ *         and &tinydrm_wall_tile->y to get the panel window.
+ *
+ * The callbacks run from the tile worker, so tiles on different buses are
+ * handled at the same time.
+ */
+struct tinydrm_wall_tile_funcs {
+	void (*enable)(struct tinydrm_wall_tile *tile);
+	void (*disable)(struct tinydrm_wall_tile *tile);
+	int (*flush)(struct tinydrm_wall_tile *tile, struct drm_framebuffer *fb,
+		     struct drm_clip_rect *clip);
+};
+
+/**
+ * struct tinydrm_wall_tile - Panel in a video wall
+ * @funcs: Panel operations
+ * @width: Width in pixels
+ * @height: Height in pixels
+ * @x: Left edge in the wall, set when added to a wall
+ * @y: Top edge in the wall, set when added to a wall
+ */
+struct tinydrm_wall_tile {
+	const struct tinydrm_wall_tile_funcs *funcs;
+	unsigned int width;
+	unsigned int height;
+	unsigned int x;
+	unsigned int y;
+
+	/* private: */
+	struct device *dev;
+	struct list_head list;
+	struct tinydrm_wall *wall;
+	struct workqueue_struct *wq;
+	struct work_struct work;
+	unsigned int op;
+	struct drm_framebuffer *fb;
+	struct drm_clip_rect clip;
+	int ret;
+};
+
+/**
+ * struct tinydrm_wall - Tiled multi-panel device
+ * @tinydrm: Base &tinydrm_device
+ * @tiles: Panels in row major order
+ * @num_tiles: Number of panels
+ * @enabled: Pipeline is enabled
+ */
+struct tinydrm_wall {
+	struct tinydrm_device tinydrm;
+	struct tinydrm_wall_tile *tiles[TINYDRM_WALL_MAX_TILES];
+	unsigned int num_tiles;
+	bool enabled;
+
+	/* private: */
+	atomic_t pending;
+	wait_queue_head_t done;
+};
+
+static inline struct tinydrm_wall *
+tinydrm_to_wall(struct tinydrm_device *tdev)
+{
+	return container_of(tdev, struct tinydrm_wall, tinydrm);
+}
+
+bool tinydrm_wall_is_tile(struct device *dev);
+int devm_tinydrm_wall_tile_add(struct device *dev,
+			       struct tinydrm_wall_tile *tile);
+int devm_tinydrm_wall_init(struct device *dev, struct tinydrm_wall *wall,
+			   struct drm_driver *driver);
+
+#endif /* __LINUX_TINYDRM_WALL_H */
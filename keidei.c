@@ -16,10 +16,14 @@
 #include <linux/delay.h>
 #include <linux/module.h>
 #include <linux/of_device.h>
+#include <linux/pm_runtime.h>
 #include <linux/property.h>
 #include <linux/spi/spi.h>
+#include <drm/drm_fb_cma_helper.h>
+#include <drm/drm_gem_framebuffer_helper.h>
 #include <drm/tinydrm/mipi-dbi.h>
 #include <drm/tinydrm/tinydrm-helpers.h>
+#include <drm/tinydrm/tinydrm-helpers2.h>
 #include <linux/gpio/consumer.h>
 #include <video/mipi_display.h>
 
@@ -31,6 +35,26 @@ enum keidei_version
     KEIDEI_V60
 };
 
+struct keidei
+{
+    struct mipi_dbi mipi;
+    enum keidei_version version;
+    struct tinydrm_deferred_init dinit;
+    bool keep_alive;
+    bool active;
+    bool sleeping;
+    struct tinydrm_sw_plane sw_planes[TINYDRM_MAX_SW_PLANES];
+    unsigned int num_sw_planes;
+};
+
+static inline struct keidei *
+pipe_to_keidei(struct drm_simple_display_pipe *pipe)
+{
+    struct tinydrm_device *tdev = pipe_to_tinydrm(pipe);
+
+    return container_of(mipi_dbi_from_tinydrm(tdev), struct keidei, mipi);
+}
+
 #define KEIDEI20_RESET 0x00   /* 00000 */
 #define KEIDEI20_NORESET 0x01 /* 00001 */
 #define KEIDEI20_CMD_BE 0x11  /* 10001 */
@@ -519,28 +543,218 @@ static int keidei50_prepare(struct mipi_dbi *mipi)
     return 0;
 }
 
-static void keidei_enable(struct drm_simple_display_pipe *pipe,
-                          struct drm_crtc_state *crtc_state)
+static int keidei_prepare(struct tinydrm_deferred_init *dinit)
 {
-    struct tinydrm_device *tdev = pipe_to_tinydrm(pipe);
-    struct mipi_dbi *mipi = mipi_dbi_from_tinydrm(tdev);
+    struct keidei *keidei = container_of(dinit, struct keidei, dinit);
+    struct mipi_dbi *mipi = &keidei->mipi;
+
+    /* The controller can't be read, trust DT that the bootloader set it up */
+    if (keidei->keep_alive)
+    {
+        DRM_DEBUG_KMS("Keeping panel configuration\n");
+        return 0;
+    }
+
+    switch (keidei->version)
+    {
+    case KEIDEI_V10:
+        return keidei10_prepare(mipi);
+    case KEIDEI_V20:
+        return keidei20_prepare(mipi);
+    case KEIDEI_V50:
+        return keidei50_prepare(mipi);
+    case KEIDEI_V60:
+        return keidei60_prepare(mipi);
+    }
+
+    return -ENODEV;
+}
+
+/* Runs from the deferred init worker once the controller is prepared */
+static void keidei_deferred_enable(struct drm_simple_display_pipe *pipe,
+                                   struct drm_crtc_state *crtc_state)
+{
+    struct keidei *keidei = pipe_to_keidei(pipe);
     struct drm_framebuffer *fb = pipe->plane.fb;
+    struct device *dev = pipe->crtc.dev->dev;
+    int ret;
 
     DRM_DEBUG_KMS("\n");
 
-    mipi->enabled = true;
-    fb->funcs->dirty(fb, NULL, 0, 0, NULL, 0);
+    ret = pm_runtime_get_sync(dev);
+    if (ret < 0)
+        DRM_DEV_ERROR(dev, "Failed to resume (%d)\n", ret);
+    keidei->active = true;
+
+    /*
+     * The display is flushed while disabled until it's runtime suspended,
+     * so GRAM is only out of date if a flush was skipped or it was never
+     * flushed.
+     */
+    if (keidei->mipi.enabled)
+        return;
+
+    keidei->mipi.enabled = true;
+    if (fb)
+        fb->funcs->dirty(fb, NULL, 0, 0, NULL, 0);
+}
+
+static void keidei_enable(struct drm_simple_display_pipe *pipe,
+                          struct drm_crtc_state *crtc_state)
+{
+    drm_crtc_vblank_on(&pipe->crtc);
+    tinydrm_deferred_enable(&pipe_to_keidei(pipe)->dinit);
 }
 
 static void keidei_disable(struct drm_simple_display_pipe *pipe)
 {
+    struct keidei *keidei = pipe_to_keidei(pipe);
+    struct device *dev = pipe->crtc.dev->dev;
+
     DRM_DEBUG_KMS("\n");
+    drm_crtc_vblank_off(&pipe->crtc);
+    tinydrm_deferred_wait(&keidei->dinit);
+
+    if (!keidei->active)
+        return;
+
+    keidei->active = false;
+    pm_runtime_mark_last_busy(dev);
+    pm_runtime_put_autosuspend(dev);
+}
+
+static int __maybe_unused keidei_runtime_suspend(struct device *dev)
+{
+    struct mipi_dbi *mipi = dev_get_drvdata(dev);
+    struct keidei *keidei = container_of(mipi, struct keidei, mipi);
+
+    /* v1.0 has no command interface */
+    if (!mipi->command || !mipi->enabled)
+        return 0;
+
+    mutex_lock(&mipi->tinydrm.dirty_lock);
+    mipi->enabled = false;
+    mutex_unlock(&mipi->tinydrm.dirty_lock);
+
+    mipi_dbi_command(mipi, MIPI_DCS_SET_DISPLAY_OFF);
+    mipi_dbi_command(mipi, MIPI_DCS_ENTER_SLEEP_MODE);
+    keidei->sleeping = true;
+
+    return 0;
+}
+
+static int __maybe_unused keidei_runtime_resume(struct device *dev)
+{
+    struct mipi_dbi *mipi = dev_get_drvdata(dev);
+    struct keidei *keidei = container_of(mipi, struct keidei, mipi);
+
+    if (!keidei->sleeping)
+        return 0;
+
+    keidei->sleeping = false;
+    mipi_dbi_command(mipi, MIPI_DCS_EXIT_SLEEP_MODE);
+    /* Commands can be sent 5ms after Sleep Out */
+    usleep_range(5000, 10000);
+    mipi_dbi_command(mipi, MIPI_DCS_SET_DISPLAY_ON);
+
+    return 0;
+}
+
+static const struct dev_pm_ops keidei_pm_ops = {
+    SET_RUNTIME_PM_OPS(keidei_runtime_suspend, keidei_runtime_resume, NULL)
+};
+
+/* Same as mipi_dbi_fb_dirty() with the planes blended into the pixels */
+static int keidei_fb_dirty(struct drm_framebuffer *fb,
+                           struct drm_file *file_priv, unsigned int flags,
+                           unsigned int color, struct drm_clip_rect *clips,
+                           unsigned int num_clips)
+{
+    struct drm_gem_cma_object *cma_obj = drm_fb_cma_get_gem_obj(fb, 0);
+    struct tinydrm_device *tdev = fb->dev->dev_private;
+    struct mipi_dbi *mipi = mipi_dbi_from_tinydrm(tdev);
+    struct keidei *keidei = container_of(mipi, struct keidei, mipi);
+    bool swap = mipi->swap_bytes;
+    struct drm_clip_rect clip;
+    int ret = 0;
+    bool full;
+    void *tr;
+    int pm;
+
+    /* -EINVAL: runtime PM is disabled and the device is always powered */
+    pm = pm_runtime_get_if_in_use(fb->dev->dev);
+
+    mutex_lock(&tdev->dirty_lock);
+
+    /* Don't flush a suspended panel, the next enable flushes it all */
+    if (!pm)
+        mipi->enabled = false;
+
+    if (!mipi->enabled)
+        goto out_unlock;
+
+    /* fbdev can flush even when we're not interested */
+    if (tdev->pipe.plane.fb != fb)
+        goto out_unlock;
+
+    full = tinydrm_merge_clips(&clip, clips, num_clips, flags,
+                               fb->width, fb->height);
+
+    DRM_DEBUG("Flushing [FB:%d] x1=%u, x2=%u, y1=%u, y2=%u\n", fb->base.id,
+              clip.x1, clip.x2, clip.y1, clip.y2);
+
+    if (!mipi->dc || !full || swap ||
+        fb->format->format == DRM_FORMAT_XRGB8888 ||
+        tinydrm_sw_planes_overlap(keidei->sw_planes, keidei->num_sw_planes,
+                                  &clip))
+    {
+        tr = mipi->tx_buf;
+        ret = mipi_dbi_buf_copy(mipi->tx_buf, fb, &clip, swap);
+        if (ret)
+            goto out_unlock;
+        tinydrm_sw_planes_blend(keidei->sw_planes, keidei->num_sw_planes,
+                                tr, &clip, 16, swap);
+    }
+    else
+    {
+        tr = cma_obj->vaddr;
+    }
+
+    mipi_dbi_command(mipi, MIPI_DCS_SET_COLUMN_ADDRESS,
+                     (clip.x1 >> 8) & 0xFF, clip.x1 & 0xFF,
+                     ((clip.x2 - 1) >> 8) & 0xFF, (clip.x2 - 1) & 0xFF);
+    mipi_dbi_command(mipi, MIPI_DCS_SET_PAGE_ADDRESS,
+                     (clip.y1 >> 8) & 0xFF, clip.y1 & 0xFF,
+                     ((clip.y2 - 1) >> 8) & 0xFF, (clip.y2 - 1) & 0xFF);
+
+    ret = mipi_dbi_command_buf(mipi, MIPI_DCS_WRITE_MEMORY_START, tr,
+                               (clip.x2 - clip.x1) * (clip.y2 - clip.y1) * 2);
+
+out_unlock:
+    mutex_unlock(&tdev->dirty_lock);
+
+    if (pm > 0)
+    {
+        pm_runtime_mark_last_busy(fb->dev->dev);
+        pm_runtime_put_autosuspend(fb->dev->dev);
+    }
+
+    if (ret)
+        dev_err_once(fb->dev->dev, "Failed to update display %d\n", ret);
+
+    return ret;
 }
 
+static const struct drm_framebuffer_funcs keidei_fb_funcs = {
+    .destroy = drm_gem_fb_destroy,
+    .create_handle = drm_gem_fb_create_handle,
+    .dirty = keidei_fb_dirty,
+};
+
 static const struct drm_simple_display_pipe_funcs keidei_funcs = {
     .enable = keidei_enable,
     .disable = keidei_disable,
-    .update = tinydrm_display_pipe_update,
+    .update = tinydrm_display_pipe_damage_update,
     .prepare_fb = tinydrm_display_pipe_prepare_fb,
 };
 
@@ -575,6 +789,7 @@ static int keidei_probe(struct spi_device *spi)
     const struct of_device_id *match;
     struct device *dev = &spi->dev;
     struct tinydrm_device *tdev;
+    struct keidei *keidei;
     struct mipi_dbi *mipi;
     int ret = -ENODEV;
 
@@ -592,13 +807,16 @@ static int keidei_probe(struct spi_device *spi)
     if (!match)
         return -ENODEV;
 
-    mipi = devm_kzalloc(dev, sizeof(*mipi), GFP_KERNEL);
-    if (!mipi)
+    keidei = devm_kzalloc(dev, sizeof(*keidei), GFP_KERNEL);
+    if (!keidei)
         return -ENOMEM;
 
+    keidei->version = (enum keidei_version)match->data;
+    keidei->keep_alive = device_property_read_bool(dev, "keep-alive");
+    mipi = &keidei->mipi;
     mipi->spi = spi;
 
-    switch ((enum keidei_version)match->data)
+    switch (keidei->version)
     {
     case KEIDEI_V10:
         mipi->command = NULL;
@@ -619,32 +837,45 @@ static int keidei_probe(struct spi_device *spi)
     if (ret)
         return ret;
 
-    switch ((enum keidei_version)match->data)
-    {
-    case KEIDEI_V10:
-        ret = keidei10_prepare(mipi);
-        break;
-    case KEIDEI_V20:
-        ret = keidei20_prepare(mipi);
-        break;
-    case KEIDEI_V50:
-        ret = keidei50_prepare(mipi);
-        break;
-    case KEIDEI_V60:
-        ret = keidei60_prepare(mipi);
-        break;
-    }
+    tdev = &mipi->tinydrm;
+
+    ret = tinydrm_plane_enable_fb_damage_clips(&tdev->pipe.plane);
     if (ret)
         return ret;
 
-    tdev = &mipi->tinydrm;
+    ret = tinydrm_vblank_emulation_init(&tdev->pipe.crtc);
+    if (ret)
+        return ret;
 
-    ret = devm_tinydrm_register(tdev);
+    ret = tinydrm_flip_queue_init(&tdev->pipe);
+    if (ret)
+        return ret;
+
+    ret = tinydrm_sw_planes_init(keidei->sw_planes, &tdev->pipe);
+    if (ret < 0)
+        return ret;
+    keidei->num_sw_planes = ret;
+
+    tdev->fb_funcs = &keidei_fb_funcs;
+
+    /* The controller is prepared from a worker, it has long reset delays */
+    ret = devm_tinydrm_deferred_init(dev, &keidei->dinit, &tdev->pipe,
+                                     keidei_prepare, keidei_deferred_enable);
     if (ret)
         return ret;
 
     spi_set_drvdata(spi, mipi);
 
+    ret = devm_tinydrm_runtime_pm_init(dev);
+    if (ret)
+        return ret;
+
+    ret = devm_tinydrm_register(tdev);
+    if (ret)
+        return ret;
+
+    tinydrm_fbdev_init_deferred_io(tdev);
+
     DRM_DEBUG_DRIVER("Initialized %s:%s @%uMHz on minor %d\n",
                      tdev->drm->driver->name, dev_name(dev),
                      spi->max_speed_hz / 1000000,
@@ -663,6 +894,8 @@ static struct spi_driver keidei_spi_driver = {
     .driver = {
         .name = "keidei",
         .owner = THIS_MODULE,
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+        .pm = &keidei_pm_ops,
         .of_match_table = keidei_of_match,
     },
     .probe = keidei_probe,
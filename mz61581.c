@@ -18,6 +18,7 @@
 #include <drm/drm_fb_helper.h>
 #include <drm/tinydrm/mipi-dbi.h>
 #include <drm/tinydrm/tinydrm-helpers.h>
+#include <drm/tinydrm/tinydrm-mipi-dbi.h>
 
 #include <video/mipi_display.h>
 
@@ -27,11 +28,36 @@ static void mz61581_enable(struct drm_simple_display_pipe *pipe,
 {
     struct tinydrm_device *tdev = pipe_to_tinydrm(pipe);
     struct mipi_dbi *mipi = mipi_dbi_from_tinydrm(tdev);
-    struct drm_framebuffer *fb = pipe->plane.fb;
+    struct tinydrm_mipi_dbi *tmipi = mipi_to_tinydrm_mipi_dbi(mipi);
     u8 addr_mode;
 
     DRM_DEBUG_KMS("\n");
 
+#define MY BIT(7)
+#define MX BIT(6)
+#define MV BIT(5)
+#define BGR BIT(3)
+
+    switch (mipi->rotation)
+    {
+    case 90:
+        addr_mode = MY | MX;
+        break;
+    case 180:
+        addr_mode = MX | MV;
+        break;
+    case 270:
+        addr_mode = 0;
+        break;
+    default:
+        addr_mode = MY | MV;
+        break;
+    }
+    addr_mode |= BGR;
+
+    if (tinydrm_mipi_dbi_keep_alive(tmipi, addr_mode, 16))
+        goto out_enable;
+
     mipi_dbi_hw_reset(mipi);
 
     mipi_dbi_command(mipi, 0xb0, 0x00);
@@ -56,35 +82,12 @@ static void mz61581_enable(struct drm_simple_display_pipe *pipe,
     mipi_dbi_command(mipi, 0xd1, 0x03, 0x30, 0x10);
     mipi_dbi_command(mipi, 0xd2, 0x03, 0x14, 0x04);
 
-#define MY BIT(7)
-#define MX BIT(6)
-#define MV BIT(5)
-#define BGR BIT(3)
-
-    switch (mipi->rotation)
-    {
-    case 90:
-        addr_mode = MY | MX;
-        break;
-    case 180:
-        addr_mode = MX | MV;
-        break;
-    case 270:
-        addr_mode = 0;
-        break;
-    default:
-        addr_mode = MY | MV;
-        break;
-    }
-    addr_mode |= BGR;
-    mipi_dbi_command(mipi, MIPI_DCS_SET_ADDRESS_MODE, addr_mode);
+out_enable:
+    tinydrm_mipi_dbi_set_address_mode(tmipi, addr_mode);
 
     mipi_dbi_command(mipi, MIPI_DCS_SET_DISPLAY_ON);
 
-    mipi->enabled = true;
-    fb->funcs->dirty(fb, NULL, 0, 0, NULL, 0);
-
-    tinydrm_enable_backlight(mipi->backlight);
+    tinydrm_mipi_dbi_enable_flush(tmipi);
 }
 
 static void mz61581_disable(struct drm_simple_display_pipe *pipe)
@@ -101,7 +104,7 @@ static void mz61581_disable(struct drm_simple_display_pipe *pipe)
 static const struct drm_simple_display_pipe_funcs mz61581_funcs = {
     .enable = mz61581_enable,
     .disable = mz61581_disable,
-    .update = tinydrm_display_pipe_update,
+    .update = tinydrm_display_pipe_damage_update,
     .prepare_fb = tinydrm_display_pipe_prepare_fb,
 };
 
@@ -137,16 +140,19 @@ MODULE_DEVICE_TABLE(spi, mz61581_id);
 static int mz61581_probe(struct spi_device *spi)
 {
     struct device *dev = &spi->dev;
+    struct tinydrm_mipi_dbi *tmipi;
     struct tinydrm_device *tdev;
     struct mipi_dbi *mipi;
     struct gpio_desc *dc;
     u32 rotation = 0;
     int ret;
 
-    mipi = devm_kzalloc(dev, sizeof(*mipi), GFP_KERNEL);
-    if (!mipi)
+    tmipi = devm_kzalloc(dev, sizeof(*tmipi), GFP_KERNEL);
+    if (!tmipi)
         return -ENOMEM;
 
+    mipi = &tmipi->mipi;
+
     mipi->reset = devm_gpiod_get_optional(dev, "reset", GPIOD_OUT_HIGH);
     if (IS_ERR(mipi->reset))
     {
@@ -171,8 +177,8 @@ static int mz61581_probe(struct spi_device *spi)
     if (ret)
         return ret;
 
-    ret = mipi_dbi_init(dev, mipi, &mz61581_funcs, &mz61581_driver,
-                        &mz61581_mode, rotation);
+    ret = tinydrm_mipi_dbi_init(dev, tmipi, &mz61581_funcs, &mz61581_driver,
+                                &mz61581_mode, rotation);
     if (ret)
         return ret;
 
@@ -185,6 +191,8 @@ static int mz61581_probe(struct spi_device *spi)
     if (ret)
         return ret;
 
+    tinydrm_fbdev_init_deferred_io(tdev);
+
     spi_set_drvdata(spi, mipi);
 
     DRM_DEBUG_DRIVER("Initialized %s:%s @%uMHz on minor %d\n",
@@ -206,6 +214,8 @@ static struct spi_driver mz61581_spi_driver = {
     .driver = {
         .name = "mz61581",
         .owner = THIS_MODULE,
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+        .pm = &tinydrm_mipi_dbi_pm_ops,
         .of_match_table = mz61581_of_match,
     },
     .id_table = mz61581_id,
@@ -19,6 +19,7 @@
 #include <drm/drm_fb_helper.h>
 #include <drm/tinydrm/mipi-dbi.h>
 #include <drm/tinydrm/tinydrm-helpers.h>
+#include <drm/tinydrm/tinydrm-mipi-dbi.h>
 
 #include <video/mipi_display.h>
 
@@ -83,30 +84,11 @@ static void piscreen_enable(struct drm_simple_display_pipe *pipe,
 {
     struct tinydrm_device *tdev = pipe_to_tinydrm(pipe);
     struct mipi_dbi *mipi = mipi_dbi_from_tinydrm(tdev);
-    struct drm_framebuffer *fb = pipe->plane.fb;
+    struct tinydrm_mipi_dbi *tmipi = mipi_to_tinydrm_mipi_dbi(mipi);
     u8 addr_mode;
 
     DRM_DEBUG_KMS("\n");
 
-    mipi_dbi_hw_reset(mipi);
-
-    mipi_dbi_command(mipi, 0xb0, 0x00);
-    mipi_dbi_command(mipi, MIPI_DCS_EXIT_SLEEP_MODE);
-    msleep(120);
-
-    mipi_dbi_command(mipi, MIPI_DCS_SET_PIXEL_FORMAT, 0x55);
-    mipi_dbi_command(mipi, 0xc2, 0x44);
-    mipi_dbi_command(mipi, 0xc5, 0x00, 0x00, 0x00, 0x00);
-    mipi_dbi_command(mipi, 0xe0, 0x0f, 0x1f, 0x1c, 0x0c, 0x0f,
-                     0x08, 0x48, 0x98, 0x37, 0x0a,
-                     0x13, 0x04, 0x11, 0x0d, 0x00);
-    mipi_dbi_command(mipi, 0xe1, 0x0f, 0x32, 0x2e, 0x0b, 0x0d,
-                     0x05, 0x47, 0x75, 0x37, 0x06,
-                     0x10, 0x03, 0x24, 0x20, 0x00);
-    mipi_dbi_command(mipi, 0xe2, 0x0f, 0x32, 0x2e, 0x0b, 0x0d,
-                     0x05, 0x47, 0x75, 0x37, 0x06,
-                     0x10, 0x03, 0x24, 0x20, 0x00);
-
 #define MY BIT(7)
 #define MX BIT(6)
 #define MV BIT(5)
@@ -128,14 +110,35 @@ static void piscreen_enable(struct drm_simple_display_pipe *pipe,
         break;
     }
     addr_mode |= BGR;
-    mipi_dbi_command(mipi, MIPI_DCS_SET_ADDRESS_MODE, addr_mode);
 
-    mipi_dbi_command(mipi, MIPI_DCS_SET_DISPLAY_ON);
+    if (tinydrm_mipi_dbi_keep_alive(tmipi, addr_mode, 16))
+        goto out_enable;
+
+    mipi_dbi_hw_reset(mipi);
+
+    mipi_dbi_command(mipi, 0xb0, 0x00);
+    mipi_dbi_command(mipi, MIPI_DCS_EXIT_SLEEP_MODE);
+    msleep(120);
+
+    mipi_dbi_command(mipi, MIPI_DCS_SET_PIXEL_FORMAT, 0x55);
+    mipi_dbi_command(mipi, 0xc2, 0x44);
+    mipi_dbi_command(mipi, 0xc5, 0x00, 0x00, 0x00, 0x00);
+    mipi_dbi_command(mipi, 0xe0, 0x0f, 0x1f, 0x1c, 0x0c, 0x0f,
+                     0x08, 0x48, 0x98, 0x37, 0x0a,
+                     0x13, 0x04, 0x11, 0x0d, 0x00);
+    mipi_dbi_command(mipi, 0xe1, 0x0f, 0x32, 0x2e, 0x0b, 0x0d,
+                     0x05, 0x47, 0x75, 0x37, 0x06,
+                     0x10, 0x03, 0x24, 0x20, 0x00);
+    mipi_dbi_command(mipi, 0xe2, 0x0f, 0x32, 0x2e, 0x0b, 0x0d,
+                     0x05, 0x47, 0x75, 0x37, 0x06,
+                     0x10, 0x03, 0x24, 0x20, 0x00);
+
+out_enable:
+    tinydrm_mipi_dbi_set_address_mode(tmipi, addr_mode);
 
-    mipi->enabled = true;
-    fb->funcs->dirty(fb, NULL, 0, 0, NULL, 0);
+    mipi_dbi_command(mipi, MIPI_DCS_SET_DISPLAY_ON);
 
-    tinydrm_enable_backlight(mipi->backlight);
+    tinydrm_mipi_dbi_enable_flush(tmipi);
 }
 
 static void piscreen_disable(struct drm_simple_display_pipe *pipe)
@@ -152,7 +155,7 @@ static void piscreen_disable(struct drm_simple_display_pipe *pipe)
 static const struct drm_simple_display_pipe_funcs piscreen_funcs = {
     .enable = piscreen_enable,
     .disable = piscreen_disable,
-    .update = tinydrm_display_pipe_update,
+    .update = tinydrm_display_pipe_damage_update,
     .prepare_fb = tinydrm_display_pipe_prepare_fb,
 };
 
@@ -162,26 +165,11 @@ static void piscreen2_enable(struct drm_simple_display_pipe *pipe,
 {
     struct tinydrm_device *tdev = pipe_to_tinydrm(pipe);
     struct mipi_dbi *mipi = mipi_dbi_from_tinydrm(tdev);
-    struct drm_framebuffer *fb = pipe->plane.fb;
+    struct tinydrm_mipi_dbi *tmipi = mipi_to_tinydrm_mipi_dbi(mipi);
     u8 addr_mode;
 
     DRM_DEBUG_KMS("\n");
 
-    mipi_dbi_hw_reset(mipi);
-
-    mipi_dbi_command(mipi, 0xb0, 0x00);
-    mipi_dbi_command(mipi, MIPI_DCS_EXIT_SLEEP_MODE);
-    msleep(120);
-
-    mipi_dbi_command(mipi, MIPI_DCS_SET_PIXEL_FORMAT, 0x55);
-    mipi_dbi_command(mipi, 0xc0, 0x11, 0x09);
-    mipi_dbi_command(mipi, 0xc1, 0x41);
-    mipi_dbi_command(mipi, 0xc5, 0x00, 0x00, 0x00, 0x00);
-    mipi_dbi_command(mipi, 0xb6, 0x00, 0x02);
-    mipi_dbi_command(mipi, 0xf7, 0xa9, 0x51, 0x2c, 0x2);
-    mipi_dbi_command(mipi, 0xbe, 0x00, 0x04);
-    mipi_dbi_command(mipi, 0xe9, 0x00);
-
 #define MY BIT(7)
 #define MX BIT(6)
 #define MV BIT(5)
@@ -203,20 +191,37 @@ static void piscreen2_enable(struct drm_simple_display_pipe *pipe,
         break;
     }
     addr_mode |= BGR;
-    mipi_dbi_command(mipi, MIPI_DCS_SET_ADDRESS_MODE, addr_mode);
 
-    mipi_dbi_command(mipi, MIPI_DCS_SET_DISPLAY_ON);
+    if (tinydrm_mipi_dbi_keep_alive(tmipi, addr_mode, 16))
+        goto out_enable;
 
-    mipi->enabled = true;
-    fb->funcs->dirty(fb, NULL, 0, 0, NULL, 0);
+    mipi_dbi_hw_reset(mipi);
+
+    mipi_dbi_command(mipi, 0xb0, 0x00);
+    mipi_dbi_command(mipi, MIPI_DCS_EXIT_SLEEP_MODE);
+    msleep(120);
 
-    tinydrm_enable_backlight(mipi->backlight);
+    mipi_dbi_command(mipi, MIPI_DCS_SET_PIXEL_FORMAT, 0x55);
+    mipi_dbi_command(mipi, 0xc0, 0x11, 0x09);
+    mipi_dbi_command(mipi, 0xc1, 0x41);
+    mipi_dbi_command(mipi, 0xc5, 0x00, 0x00, 0x00, 0x00);
+    mipi_dbi_command(mipi, 0xb6, 0x00, 0x02);
+    mipi_dbi_command(mipi, 0xf7, 0xa9, 0x51, 0x2c, 0x2);
+    mipi_dbi_command(mipi, 0xbe, 0x00, 0x04);
+    mipi_dbi_command(mipi, 0xe9, 0x00);
+
+out_enable:
+    tinydrm_mipi_dbi_set_address_mode(tmipi, addr_mode);
+
+    mipi_dbi_command(mipi, MIPI_DCS_SET_DISPLAY_ON);
+
+    tinydrm_mipi_dbi_enable_flush(tmipi);
 }
 
 static const struct drm_simple_display_pipe_funcs piscreen2_funcs = {
     .enable = piscreen2_enable,
     .disable = piscreen_disable,
-    .update = tinydrm_display_pipe_update,
+    .update = tinydrm_display_pipe_damage_update,
     .prepare_fb = tinydrm_display_pipe_prepare_fb,
 };
 
@@ -249,6 +254,7 @@ static int piscreen_probe(struct spi_device *spi)
     const struct drm_simple_display_pipe_funcs *funcs;
     const struct of_device_id *match;
     struct device *dev = &spi->dev;
+    struct tinydrm_mipi_dbi *tmipi;
     struct tinydrm_device *tdev;
     struct mipi_dbi *mipi;
     struct gpio_desc *dc;
@@ -261,10 +267,12 @@ static int piscreen_probe(struct spi_device *spi)
 
     funcs = match->data;
 
-    mipi = devm_kzalloc(dev, sizeof(*mipi), GFP_KERNEL);
-    if (!mipi)
+    tmipi = devm_kzalloc(dev, sizeof(*tmipi), GFP_KERNEL);
+    if (!tmipi)
         return -ENOMEM;
 
+    mipi = &tmipi->mipi;
+
     mipi->reset = devm_gpiod_get_optional(dev, "reset", GPIOD_OUT_HIGH);
     if (IS_ERR(mipi->reset))
     {
@@ -289,8 +297,8 @@ static int piscreen_probe(struct spi_device *spi)
     if (ret)
         return ret;
 
-    ret = mipi_dbi_init(dev, mipi, funcs, &piscreen_driver,
-                        &piscreen_mode, rotation);
+    ret = tinydrm_mipi_dbi_init(dev, tmipi, funcs, &piscreen_driver,
+                                &piscreen_mode, rotation);
     if (ret)
         return ret;
 
@@ -303,6 +311,8 @@ static int piscreen_probe(struct spi_device *spi)
     if (ret)
         return ret;
 
+    tinydrm_fbdev_init_deferred_io(tdev);
+
     spi_set_drvdata(spi, mipi);
 
     DRM_DEBUG_DRIVER("Initialized %s:%s @%uMHz on minor %d\n",
@@ -324,6 +334,8 @@ static struct spi_driver piscreen_spi_driver = {
     .driver = {
         .name = "piscreen",
         .owner = THIS_MODULE,
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+        .pm = &tinydrm_mipi_dbi_pm_ops,
         .of_match_table = piscreen_of_match,
     },
     .probe = piscreen_probe,
@@ -14,9 +14,12 @@
 #include <linux/regmap.h>
 #include <linux/slab.h>
 #include <linux/string.h>
+#include <linux/swab.h>
 
+#include <drm/tinydrm/mipi-dbi.h>
 #include <drm/tinydrm/tinydrm.h>
 #include <drm/tinydrm/tinydrm-helpers2.h>
+#include <drm/tinydrm/tinydrm-regmap.h>
 
 #define FBTFT_INIT_CMD		BIT(24)
 #define FBTFT_INIT_DELAY	BIT(25)
@@ -29,84 +32,322 @@
  * They should NOT be used by new drivers.
  */
 
+enum tinydrm_fbtft_init_type {
+	TINYDRM_FBTFT_INIT_MULTI,	/* Single value registers */
+	TINYDRM_FBTFT_INIT_CMD,		/* Command with raw parameters */
+	TINYDRM_FBTFT_INIT_SLEEP,
+};
+
+struct tinydrm_fbtft_init_step {
+	enum tinydrm_fbtft_init_type type;
+	/* Command register */
+	unsigned int reg;
+	/* Number of registers, parameter bytes or milliseconds */
+	unsigned int count;
+	struct reg_sequence *regs;
+	u8 *params;
+};
+
+/* The parsed 'init' property, cached for the next enable */
+struct tinydrm_fbtft_init_seq {
+	bool present;
+	struct tinydrm_fbtft_init_step *steps;
+	unsigned int num_steps;
+	struct reg_sequence *regs;
+	u8 *params;
+};
+
+static void tinydrm_fbtft_init_release(struct device *dev, void *res)
+{
+	struct tinydrm_fbtft_init_seq *seq = res;
+
+	kfree(seq->steps);
+	kfree(seq->regs);
+	kfree(seq->params);
+}
+
+/* Parameters in the layout of regmap_raw_write(), one byte each for DCS */
+static u8 *tinydrm_fbtft_init_params(u8 *params, const u32 *vals,
+				     unsigned int num, size_t val_bytes,
+				     bool swap)
+{
+	unsigned int i;
+	u16 val;
+
+	for (i = 0; i < num; i++) {
+		if (val_bytes == 1) {
+			*params++ = vals[i];
+			continue;
+		}
+
+		val = swap ? swab16(vals[i]) : vals[i];
+		memcpy(params, &val, sizeof(val));
+		params += sizeof(val);
+	}
+
+	return params;
+}
+
+/* @reg is NULL for MIPI DCS controllers */
+static int tinydrm_fbtft_init_parse(struct device *dev, struct regmap *reg,
+				    struct tinydrm_fbtft_init_seq *seq)
+{
+	size_t val_bytes = reg ? regmap_get_val_bytes(reg) : 1;
+	struct tinydrm_fbtft_init_step *step = NULL;
+	int ret, num_vals, i, j, num_params;
+	struct reg_sequence *regs;
+	bool swap = false;
+	u8 *params;
+	u32 *prop;
+
+	if (!device_property_present(dev, "init"))
+		return 0;
+
+	if (val_bytes == 2)
+		swap = tinydrm_regmap_raw_swap_bytes(reg);
+
+	num_vals = device_property_read_u32_array(dev, "init", NULL, 0);
+	if (num_vals <= 0)
+		return num_vals ? num_vals : -EINVAL;
+
+	prop = kcalloc(num_vals, sizeof(u32), GFP_KERNEL);
+	seq->steps = kcalloc(num_vals, sizeof(*seq->steps), GFP_KERNEL);
+	seq->regs = kcalloc(num_vals, sizeof(*seq->regs), GFP_KERNEL);
+	seq->params = kcalloc(num_vals, val_bytes, GFP_KERNEL);
+	if (!prop || !seq->steps || !seq->regs || !seq->params) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	ret = device_property_read_u32_array(dev, "init", prop, num_vals);
+	if (ret < 0)
+		goto out_free;
+
+	regs = seq->regs;
+	params = seq->params;
+	for (i = 0; i < num_vals; i = j) {
+		if (prop[i] & FBTFT_INIT_DELAY) {
+			DRM_DEBUG_DRIVER("init: sleep(%u)\n", prop[i] & 0xffff);
+			step = &seq->steps[seq->num_steps++];
+			step->type = TINYDRM_FBTFT_INIT_SLEEP;
+			step->count = prop[i] & 0xffff;
+			j = i + 1;
+			continue;
+		}
+
+		if (!(prop[i] & FBTFT_INIT_CMD)) {
+			dev_err(dev, "init: illegal value 0x%X\n", prop[i]);
+			ret = -EINVAL;
+			goto out_free;
+		}
+
+		for (j = i + 1; j < num_vals; j++)
+			if (prop[j] & 0xffff0000)
+				break;
+
+		num_params = j - i - 1;
+		if (reg && !num_params) {
+			dev_err(dev, "init: Missing value for register 0x%X\n",
+				prop[i] & 0xffff);
+			ret = -EINVAL;
+			goto out_free;
+		}
+
+		/*
+		 * Writing several values through regmap would address
+		 * consecutive registers. Parameters belong to one command
+		 * register, so they are sent in one raw write that doesn't
+		 * touch the register cache. DCS commands always go this way.
+		 */
+		if (!reg || num_params > 1) {
+			if (val_bytes > 2) {
+				dev_err(dev, "init: Parameters for register 0x%X not supported\n",
+					prop[i] & 0xffff);
+				ret = -EINVAL;
+				goto out_free;
+			}
+
+			step = &seq->steps[seq->num_steps++];
+			step->type = TINYDRM_FBTFT_INIT_CMD;
+			step->reg = prop[i] & 0xffff;
+			step->params = params;
+			step->count = num_params * val_bytes;
+			params = tinydrm_fbtft_init_params(params, &prop[i + 1],
+							   num_params,
+							   val_bytes, swap);
+			continue;
+		}
+
+		/* Consecutive single value registers go in one multi write */
+		if (!step || step->type != TINYDRM_FBTFT_INIT_MULTI) {
+			step = &seq->steps[seq->num_steps++];
+			step->type = TINYDRM_FBTFT_INIT_MULTI;
+			step->regs = regs;
+		}
+		regs->reg = prop[i] & 0xffff;
+		regs->def = prop[i + 1];
+		regs++;
+		step->count++;
+	}
+
+	seq->present = true;
+out_free:
+	kfree(prop);
+
+	return ret;
+}
+
+static struct tinydrm_fbtft_init_seq *
+tinydrm_fbtft_init_get(struct device *dev, struct regmap *reg)
+{
+	struct tinydrm_fbtft_init_seq *seq;
+	int ret;
+
+	seq = devres_find(dev, tinydrm_fbtft_init_release, NULL, NULL);
+	if (seq)
+		return seq;
+
+	seq = devres_alloc(tinydrm_fbtft_init_release, sizeof(*seq),
+			   GFP_KERNEL);
+	if (!seq)
+		return ERR_PTR(-ENOMEM);
+
+	ret = tinydrm_fbtft_init_parse(dev, reg, seq);
+	if (ret) {
+		tinydrm_fbtft_init_release(dev, seq);
+		devres_free(seq);
+		return ERR_PTR(ret);
+	}
+
+	devres_add(dev, seq);
+
+	return seq;
+}
+
+static void tinydrm_fbtft_init_sleep(unsigned int ms)
+{
+	if (ms < 20)
+		usleep_range(ms * 1000, ms * 1000 + 500);
+	else
+		msleep(ms);
+}
+
+static int tinydrm_fbtft_init_cmd(struct regmap *reg,
+				  const struct tinydrm_regmap_stream *stream,
+				  struct tinydrm_fbtft_init_step *step)
+{
+	int ret;
+
+	if (stream && stream->write)
+		return tinydrm_regmap_stream_write(reg, stream, step->reg,
+						   step->params, step->count);
+
+	regcache_cache_bypass(reg, true);
+	ret = regmap_raw_write(reg, step->reg, step->params, step->count);
+	regcache_cache_bypass(reg, false);
+
+	return ret;
+}
+
 /*
- * tinydrm_fbtft_dt_init - Initialize from device property
+ * tinydrm_fbtft_init - Initialize from device property
  * @dev: Device
  * @reg: Register map
+ * @stream: Raw write operation for @reg (optional)
  *
- * If the 'init' property exists, apply the register settings.
+ * If the 'init' property exists, apply the register settings. Runs of single
+ * value registers are written using regmap_multi_reg_write(). A command with
+ * several parameters is written in one go to the command register using
+ * @stream, or regmap_raw_write() with the register cache bypassed if there's
+ * none. The property is parsed on the first call and the result is kept for
+ * the lifetime of @dev.
  *
  * Returns:
  * Zero on success, -ENOENT if the property doesn't exist, negative error code
  * on other failures.
  */
-int tinydrm_fbtft_init(struct device *dev, struct regmap *reg)
+int tinydrm_fbtft_init(struct device *dev, struct regmap *reg,
+		       const struct tinydrm_regmap_stream *stream)
 {
-	u32 *vals, regvals[64], *regnr = NULL;
-	int ret, num_vals, i, j;
-	void *buf;
+	struct tinydrm_fbtft_init_step *step;
+	struct tinydrm_fbtft_init_seq *seq;
+	unsigned int i;
+	int ret;
 
-	if (!device_property_present(dev, "init"))
+	seq = tinydrm_fbtft_init_get(dev, reg);
+	if (IS_ERR(seq))
+		return PTR_ERR(seq);
+
+	if (!seq->present)
 		return -ENOENT;
 
-	DRM_DEBUG_DRIVER("\n");
+	for (i = 0; i < seq->num_steps; i++) {
+		step = &seq->steps[i];
+
+		switch (step->type) {
+		case TINYDRM_FBTFT_INIT_MULTI:
+			ret = regmap_multi_reg_write(reg, step->regs,
+						     step->count);
+			break;
+		case TINYDRM_FBTFT_INIT_CMD:
+			ret = tinydrm_fbtft_init_cmd(reg, stream, step);
+			break;
+		case TINYDRM_FBTFT_INIT_SLEEP:
+			tinydrm_fbtft_init_sleep(step->count);
+			ret = 0;
+			break;
+		}
+		if (ret)
+			return ret;
+	}
 
-	num_vals = device_property_read_u32_array(dev, "init", NULL, 0);
-	if (num_vals <= 0)
-		return num_vals;
+	return 0;
+}
+EXPORT_SYMBOL(tinydrm_fbtft_init);
 
-	buf = kcalloc(num_vals, sizeof(u32), GFP_KERNEL);
-	if (!buf)
-		return -ENOMEM;
+/*
+ * tinydrm_fbtft_init_dcs - Initialize a DCS controller from device property
+ * @dev: Device
+ * @mipi: MIPI DBI structure
+ *
+ * Same as tinydrm_fbtft_init(), but every command, with or without
+ * parameters, is sent using mipi_dbi_command_buf().
+ *
+ * Returns:
+ * Zero on success, -ENOENT if the property doesn't exist, negative error code
+ * on other failures.
+ */
+int tinydrm_fbtft_init_dcs(struct device *dev, struct mipi_dbi *mipi)
+{
+	struct tinydrm_fbtft_init_step *step;
+	struct tinydrm_fbtft_init_seq *seq;
+	unsigned int i;
+	int ret;
 
-	vals = buf;
-	ret = device_property_read_u32_array(dev, "init", vals, num_vals);
-	if (ret < 0)
-		goto err_free;
-
-	for (i = 0; i < num_vals; i++) {
-		if (vals[i] & FBTFT_INIT_DELAY) {
-			vals[i] &= 0xffff;
-			DRM_DEBUG_DRIVER("init: msleep(%u)\n", vals[i]);
-			msleep(vals[i]);
-		} else if (vals[i] & FBTFT_INIT_CMD) {
-			vals[i] &= 0xffff;
-			regnr = &vals[i];
-			j = 0;
-		} else if (!regnr) {
-			dev_err(dev, "init: illegal value 0x%X\n", vals[i]);
-			ret = -EINVAL;
-			goto err_free;
-		} else {
-			if (j > 63) {
-				dev_err(dev, "init: Maximum register values exceeded\n");
-				ret = -EINVAL;
-				goto err_free;
-			}
-			regvals[j++] = vals[i];
-		}
+	seq = tinydrm_fbtft_init_get(dev, NULL);
+	if (IS_ERR(seq))
+		return PTR_ERR(seq);
 
-		/* write values if this is the last entry or regvalue */
-		if (regnr &&
-		    (i == (num_vals - 1) || vals[i + 1] & 0xffff0000)) {
-			/* FIXME support mipi dcs */
-			if (WARN_ON_ONCE(j != 1))
-				return -EINVAL;
+	if (!seq->present)
+		return -ENOENT;
 
-			ret = regmap_write(reg, *regnr, regvals[0]);
-			if (ret)
-				goto err_free;
+	for (i = 0; i < seq->num_steps; i++) {
+		step = &seq->steps[i];
 
-			regnr = NULL;
+		if (step->type == TINYDRM_FBTFT_INIT_SLEEP) {
+			tinydrm_fbtft_init_sleep(step->count);
+			continue;
 		}
-	}
 
-err_free:
-	kfree(buf);
+		ret = mipi_dbi_command_buf(mipi, step->reg, step->params,
+					   step->count);
+		if (ret)
+			return ret;
+	}
 
-	return ret;
+	return 0;
 }
-EXPORT_SYMBOL(tinydrm_fbtft_init);
+EXPORT_SYMBOL(tinydrm_fbtft_init_dcs);
 
 static int get_next_ulong(char **str_p, unsigned long *val, char *sep, int base)
 {
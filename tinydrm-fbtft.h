@@ -13,9 +13,13 @@
 #include <drm/tinydrm/tinydrm.h>
 
 struct backlight_device;
+struct mipi_dbi;
 struct regmap;
+struct tinydrm_regmap_stream;
 
-int tinydrm_fbtft_init(struct device *dev, struct regmap *reg);
+int tinydrm_fbtft_init(struct device *dev, struct regmap *reg,
+		       const struct tinydrm_regmap_stream *stream);
+int tinydrm_fbtft_init_dcs(struct device *dev, struct mipi_dbi *mipi);
 int tinydrm_fbtft_get_gamma(struct device *dev, u16 *curves,
 			    const char *gamma_str, size_t num_curves,
 			    size_t num_values);
@@ -7,12 +7,25 @@
  * (at your option) any later version.
  */
 
+#include <linux/debugfs.h>
 #include <linux/device.h>
 #include <linux/dma-buf.h>
+#include <linux/fb.h>
 #include <linux/gpio/consumer.h>
+#include <linux/jhash.h>
+#include <linux/kernel.h>
+#include <linux/major.h>
+#include <linux/pm_runtime.h>
+#include <linux/property.h>
+#include <linux/slab.h>
+#include <linux/spi/spi.h>
 
+#include <drm/drmP.h>
 #include <drm/drm_gem_cma_helper.h>
 #include <drm/drm_fb_cma_helper.h>
+#include <drm/drm_fb_helper.h>
+#include <drm/tinydrm/tinydrm.h>
+#include <drm/tinydrm/tinydrm-helpers.h>
 #include <drm/tinydrm/tinydrm-helpers2.h>
 
 /*
@@ -72,6 +85,155 @@ int tinydrm_rgb565_buf_copy(void *dst, struct drm_framebuffer *fb,
 }
 EXPORT_SYMBOL(tinydrm_rgb565_buf_copy);
 
+static inline u16 tinydrm_rgb565_to_rgb444(u16 val)
+{
+	return ((val >> 4) & 0xf00) | ((val >> 3) & 0x0f0) |
+	       ((val >> 1) & 0x00f);
+}
+
+static inline u16 tinydrm_xrgb8888_to_rgb444(u32 val)
+{
+	return ((val >> 12) & 0xf00) | ((val >> 8) & 0x0f0) |
+	       ((val >> 4) & 0x00f);
+}
+
+static void tinydrm_rgb444_line(u8 *dst, const void *src, u32 format,
+				unsigned int width)
+{
+	const u16 *src16 = src;
+	const u32 *src32 = src;
+	unsigned int x;
+	u16 a, b;
+
+	for (x = 0; x < width; x += 2, dst += 3) {
+		if (format == DRM_FORMAT_RGB565) {
+			a = tinydrm_rgb565_to_rgb444(src16[x]);
+			b = tinydrm_rgb565_to_rgb444(src16[x + 1]);
+		} else {
+			a = tinydrm_xrgb8888_to_rgb444(src32[x]);
+			b = tinydrm_xrgb8888_to_rgb444(src32[x + 1]);
+		}
+		dst[0] = a >> 4;
+		dst[1] = (a << 4) | (b >> 8);
+		dst[2] = b;
+	}
+}
+
+static void tinydrm_rgb666_line(u8 *dst, const void *src, u32 format,
+				unsigned int width)
+{
+	const u16 *src16 = src;
+	const u32 *src32 = src;
+	unsigned int x;
+	u32 val;
+
+	for (x = 0; x < width; x++, dst += 3) {
+		if (format == DRM_FORMAT_RGB565) {
+			val = src16[x];
+			dst[0] = (val >> 8) & 0xf8;
+			dst[1] = (val >> 3) & 0xfc;
+			dst[2] = val << 3;
+		} else {
+			val = src32[x];
+			dst[0] = val >> 16;
+			dst[1] = val >> 8;
+			dst[2] = val;
+		}
+	}
+}
+
+static int tinydrm_packed_buf_copy(void *dst, size_t dst_pitch, void *linebuf,
+				   struct drm_framebuffer *fb,
+				   struct drm_clip_rect *clip,
+				   void (*line)(u8 *dst, const void *src,
+						u32 format, unsigned int width))
+{
+	struct drm_gem_cma_object *cma_obj = drm_fb_cma_get_gem_obj(fb, 0);
+	struct dma_buf_attachment *import_attach = cma_obj->base.import_attach;
+	unsigned int width = clip->x2 - clip->x1;
+	u32 format = fb->format->format;
+	size_t len = width * fb->format->cpp[0];
+	unsigned int y;
+	void *src;
+	int ret;
+
+	if (format != DRM_FORMAT_RGB565 && format != DRM_FORMAT_XRGB8888)
+		return -EINVAL;
+
+	if (import_attach) {
+		ret = dma_buf_begin_cpu_access(import_attach->dmabuf,
+					       DMA_FROM_DEVICE);
+		if (ret)
+			return ret;
+	}
+
+	src = cma_obj->vaddr + clip->y1 * fb->pitches[0] +
+	      clip->x1 * fb->format->cpp[0];
+	for (y = clip->y1; y < clip->y2; y++) {
+		/* The framebuffer is write-combined, read a line in one go */
+		memcpy(linebuf, src, len);
+		line(dst, linebuf, format, width);
+		src += fb->pitches[0];
+		dst += dst_pitch;
+	}
+
+	if (import_attach)
+		return dma_buf_end_cpu_access(import_attach->dmabuf,
+					      DMA_FROM_DEVICE);
+
+	return 0;
+}
+
+/**
+ * tinydrm_rgb444_buf_copy - Copy RGB565/XRGB8888 to packed RGB444 buffer
+ * @dst: Destination buffer, 3 bytes for every 2 pixels
+ * @linebuf: Scratch buffer holding one source line, 4 bytes per pixel
+ * @fb: DRM framebuffer
+ * @clip: Clip rectangle area to copy, the width must be even
+ *
+ * Two pixels are packed in 3 bytes, red first. This is the MIPI DCS
+ * 12 bits per pixel format (MIPI_DCS_PIXEL_FMT_12BIT).
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int tinydrm_rgb444_buf_copy(void *dst, void *linebuf,
+			    struct drm_framebuffer *fb,
+			    struct drm_clip_rect *clip)
+{
+	unsigned int width = clip->x2 - clip->x1;
+
+	if (width & 1)
+		return -EINVAL;
+
+	return tinydrm_packed_buf_copy(dst, width / 2 * 3, linebuf, fb, clip,
+				       tinydrm_rgb444_line);
+}
+EXPORT_SYMBOL(tinydrm_rgb444_buf_copy);
+
+/**
+ * tinydrm_rgb666_buf_copy - Copy RGB565/XRGB8888 to RGB666 buffer
+ * @dst: Destination buffer, 3 bytes per pixel
+ * @linebuf: Scratch buffer holding one source line, 4 bytes per pixel
+ * @fb: DRM framebuffer
+ * @clip: Clip rectangle area to copy
+ *
+ * Each component is sent in its own byte with the value in the upper bits.
+ * This is the MIPI DCS 18 bits per pixel format (MIPI_DCS_PIXEL_FMT_18BIT).
+ * XRGB8888 keeps its full precision, the controller drops the low bits.
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int tinydrm_rgb666_buf_copy(void *dst, void *linebuf,
+			    struct drm_framebuffer *fb,
+			    struct drm_clip_rect *clip)
+{
+	return tinydrm_packed_buf_copy(dst, (clip->x2 - clip->x1) * 3, linebuf,
+				       fb, clip, tinydrm_rgb666_line);
+}
+EXPORT_SYMBOL(tinydrm_rgb666_buf_copy);
+
 /**
  * tinydrm_hw_reset - Hardware reset of controller
  * @reset: GPIO connected to reset pin. Can be NULL.
@@ -97,4 +259,841 @@ void tinydrm_hw_reset(struct gpio_desc *reset, unsigned int assert_ms,
 }
 EXPORT_SYMBOL(tinydrm_hw_reset);
 
+/**
+ * tinydrm_row_hashes - Hash buffer rows
+ * @hashes: Array indexed by row number
+ * @vaddr: Buffer
+ * @pitch: Buffer pitch in bytes
+ * @len: Number of bytes to hash in each row
+ * @y1: First row
+ * @y2: Row after the last row
+ *
+ * Two hashes with different seeds are combined to make collisions unlikely
+ * enough to trust a match without comparing pixels.
+ */
+void tinydrm_row_hashes(u64 *hashes, const void *vaddr, unsigned int pitch,
+			size_t len, unsigned int y1, unsigned int y2)
+{
+	const void *row = vaddr + y1 * pitch;
+	unsigned int y;
+
+	for (y = y1; y < y2; y++, row += pitch)
+		hashes[y] = (u64)jhash(row, len, 0) << 32 |
+			    jhash(row, len, 0x9e3779b9);
+}
+EXPORT_SYMBOL(tinydrm_row_hashes);
+
+static bool tinydrm_vscroll_match(const u64 *old, const u64 *new,
+				  unsigned int y1, unsigned int y2, int dy)
+{
+	unsigned int y;
+
+	if (dy > 0) {
+		for (y = y1 + dy; y < y2; y++)
+			if (new[y] != old[y - dy])
+				return false;
+	} else {
+		for (y = y1; y < y2 + dy; y++)
+			if (new[y] != old[y - dy])
+				return false;
+	}
+
+	return true;
+}
+
+/**
+ * tinydrm_find_vscroll - Find vertical translation using row hashes
+ * @old: Row hashes of the content on the display
+ * @new: Row hashes of the new content
+ * @y1: First damaged row
+ * @y2: Row after the last damaged row
+ * @min_overlap: Minimum number of rows that must be reused
+ *
+ * Finds the smallest vertical shift where the damaged rows, except for
+ * the revealed strip, are the previous content moved by that amount.
+ *
+ * Returns:
+ * Shift in rows, positive when the content moved down, or zero if the new
+ * content isn't a translation.
+ */
+int tinydrm_find_vscroll(const u64 *old, const u64 *new, unsigned int y1,
+			 unsigned int y2, unsigned int min_overlap)
+{
+	unsigned int mid = y1 + (y2 - y1) / 2;
+	int dy, best = 0;
+	unsigned int r;
+
+	if (y2 - y1 < 2)
+		return 0;
+
+	for (r = y1; r < y2; r++) {
+		if (old[r] != new[mid])
+			continue;
+
+		dy = mid - r;
+		if (!dy || (y2 - y1) - abs(dy) < min_overlap)
+			continue;
+		if (best && abs(dy) >= abs(best))
+			continue;
+		if (tinydrm_vscroll_match(old, new, y1, y2, dy))
+			best = dy;
+	}
+
+	return best;
+}
+EXPORT_SYMBOL(tinydrm_find_vscroll);
+
+static void tinydrm_bw_policy_restore_work(struct work_struct *work)
+{
+	struct tinydrm_bw_policy *policy = container_of(to_delayed_work(work),
+							struct tinydrm_bw_policy,
+							restore_work);
+	int ret;
+
+	/* Nothing to restore on a suspended panel, resume does a full flush */
+	ret = pm_runtime_get_if_in_use(policy->dev);
+	if (!ret)
+		return;
+
+	policy->restore(policy);
+
+	/* -EINVAL: runtime PM is disabled and the device is always powered */
+	if (ret > 0) {
+		pm_runtime_mark_last_busy(policy->dev);
+		pm_runtime_put_autosuspend(policy->dev);
+	}
+}
+
+static void tinydrm_bw_policy_fini(void *data)
+{
+	struct tinydrm_bw_policy *policy = data;
+
+	cancel_delayed_work_sync(&policy->restore_work);
+}
+
+/**
+ * devm_tinydrm_bw_policy_init - Initialize reduced bandwidth policy
+ * @dev: Device
+ * @policy: Policy to initialize
+ * @restore: Exact frame restore callback, see &tinydrm_bw_policy
+ *
+ * The policy drops to a reduced transfer format during sustained large
+ * damage that flushing can't keep up with. When the content settles or the
+ * damage gets small, the exact format is used again and @restore makes sure
+ * the final frame is exact. @restore is skipped while @dev is runtime
+ * suspended. The policy is disabled by default.
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int devm_tinydrm_bw_policy_init(struct device *dev,
+				struct tinydrm_bw_policy *policy,
+				void (*restore)(struct tinydrm_bw_policy *policy))
+{
+	policy->threshold = 3;
+	policy->settle_ms = 200;
+	policy->restore = restore;
+	policy->dev = dev;
+	INIT_DELAYED_WORK(&policy->restore_work,
+			  tinydrm_bw_policy_restore_work);
+
+	return devm_add_action(dev, tinydrm_bw_policy_fini, policy);
+}
+EXPORT_SYMBOL(devm_tinydrm_bw_policy_init);
+
+static u32 tinydrm_bw_policy_avg(u32 avg, s64 val)
+{
+	val = clamp_t(s64, val, 0, U32_MAX);
+
+	return avg ? (avg * 3 + val) / 4 : val;
+}
+
+/**
+ * tinydrm_bw_policy_begin - Flush is starting
+ * @policy: Policy
+ * @large: The damage covers a large part of the display
+ *
+ * Callers must serialize begin/end.
+ *
+ * Returns:
+ * True if the reduced format should be used for this flush. If false and
+ * &tinydrm_bw_policy->lossy is set, the whole display should be flushed.
+ */
+bool tinydrm_bw_policy_begin(struct tinydrm_bw_policy *policy, bool large)
+{
+	ktime_t now = ktime_get();
+	s64 interval = ktime_us_delta(now, policy->last_damage);
+
+	policy->last_damage = now;
+	policy->flush_start = now;
+	cancel_delayed_work(&policy->restore_work);
+
+	if (!policy->adaptive || !large ||
+	    interval >= policy->settle_ms * USEC_PER_MSEC) {
+		policy->damage_us = 0;
+		policy->streak = 0;
+		policy->reduced = false;
+		return false;
+	}
+
+	policy->damage_us = tinydrm_bw_policy_avg(policy->damage_us, interval);
+
+	/* Once reduced, stay there as long as the large damage keeps coming */
+	if (!policy->reduced && policy->flush_us * 4 >= policy->damage_us * 3)
+		policy->streak++;
+	else if (!policy->reduced)
+		policy->streak = 0;
+
+	policy->reduced = policy->streak >= policy->threshold;
+
+	return policy->reduced;
+}
+EXPORT_SYMBOL(tinydrm_bw_policy_begin);
+
+/**
+ * tinydrm_bw_policy_end - Flush is done
+ * @policy: Policy
+ * @reduced: The reduced format was used
+ * @full: The whole display was flushed
+ */
+void tinydrm_bw_policy_end(struct tinydrm_bw_policy *policy, bool reduced,
+			   bool full)
+{
+	s64 duration = ktime_us_delta(ktime_get(), policy->flush_start);
+
+	/* The reduced format is faster, don't let it hide the real cost */
+	if (!reduced)
+		policy->flush_us = tinydrm_bw_policy_avg(policy->flush_us,
+							 duration);
+
+	if (reduced)
+		policy->lossy = true;
+	else if (full)
+		policy->lossy = false;
+
+	if (policy->lossy)
+		schedule_delayed_work(&policy->restore_work,
+				      msecs_to_jiffies(policy->settle_ms));
+}
+EXPORT_SYMBOL(tinydrm_bw_policy_end);
+
+/**
+ * tinydrm_bw_policy_restore_needed - Should the exact frame be restored?
+ * @policy: Policy
+ *
+ * Returns:
+ * True if the content is lossy and there's been no damage for
+ * &tinydrm_bw_policy->settle_ms.
+ */
+bool tinydrm_bw_policy_restore_needed(struct tinydrm_bw_policy *policy)
+{
+	return policy->lossy &&
+	       ktime_ms_delta(ktime_get(), policy->last_damage) >=
+	       policy->settle_ms;
+}
+EXPORT_SYMBOL(tinydrm_bw_policy_restore_needed);
+
+#ifdef CONFIG_DEBUG_FS
+
+/**
+ * tinydrm_bw_policy_debugfs_init - Create debugfs files for the policy
+ * @policy: Policy
+ * @parent: Parent directory
+ */
+void tinydrm_bw_policy_debugfs_init(struct tinydrm_bw_policy *policy,
+				    struct dentry *parent)
+{
+	debugfs_create_bool("bw_adaptive", 0644, parent, &policy->adaptive);
+	debugfs_create_u32("bw_threshold", 0644, parent, &policy->threshold);
+	debugfs_create_u32("bw_settle_ms", 0644, parent, &policy->settle_ms);
+	debugfs_create_bool("bw_reduced", 0444, parent, &policy->reduced);
+	debugfs_create_bool("bw_lossy", 0444, parent, &policy->lossy);
+	debugfs_create_u32("bw_damage_us", 0444, parent, &policy->damage_us);
+	debugfs_create_u32("bw_flush_us", 0444, parent, &policy->flush_us);
+}
+
+#else
+
+void tinydrm_bw_policy_debugfs_init(struct tinydrm_bw_policy *policy,
+				    struct dentry *parent)
+{
+}
+
+#endif
+EXPORT_SYMBOL(tinydrm_bw_policy_debugfs_init);
+
+/* Chunk size when only a utilisation cap is given */
+#define TINYDRM_SPI_QOS_DEFAULT_CHUNK	4096
+
+static u32 tinydrm_spi_qos_max_util(u64 val)
+{
+	return clamp_t(u64, val, 1, 100);
+}
+
+/* Keep 16-bit words and 9-bit pairs together, zero is no limit */
+static u32 tinydrm_spi_qos_chunk_size(u64 val)
+{
+	if (!val)
+		return 0;
+
+	return max_t(u32, round_down(min_t(u64, val, U32_MAX), 4), 4);
+}
+
+/**
+ * tinydrm_spi_qos_init - Read the SPI bus sharing settings
+ * @dev: Device
+ * @qos: Settings to initialize
+ *
+ * "spi-chunk-size" is the largest transfer in bytes and bounds how long
+ * another device on the bus has to wait. "spi-max-utilization" caps the
+ * share of the bus time used for pixels in percent. The display idles
+ * between chunks so that the bus is free the rest of the time. Without
+ * either property transfers are sent as before.
+ */
+void tinydrm_spi_qos_init(struct device *dev, struct tinydrm_spi_qos *qos)
+{
+	u32 val;
+
+	qos->max_util = 100;
+	if (!device_property_read_u32(dev, "spi-max-utilization", &val))
+		qos->max_util = tinydrm_spi_qos_max_util(val);
+
+	if (!device_property_read_u32(dev, "spi-chunk-size", &val))
+		qos->chunk_size = tinydrm_spi_qos_chunk_size(val);
+	else if (qos->max_util < 100)
+		qos->chunk_size = TINYDRM_SPI_QOS_DEFAULT_CHUNK;
+}
+EXPORT_SYMBOL(tinydrm_spi_qos_init);
+
+static void tinydrm_spi_qos_account(struct tinydrm_spi_qos *qos,
+				    struct spi_device *spi, u32 speed_hz,
+				    size_t len, s64 display_hold_us)
+{
+	u64 wire_us;
+
+	if (!speed_hz)
+		speed_hz = spi->max_speed_hz;
+	wire_us = speed_hz ? div_u64((u64)len * 8 * USEC_PER_SEC, speed_hz) : 0;
+
+	qos->display_hold_us = tinydrm_bw_policy_avg(qos->display_hold_us,
+						     display_hold_us);
+	qos->max_display_hold_us = max_t(u32, qos->max_display_hold_us,
+					 clamp_t(s64, display_hold_us, 0,
+						 U32_MAX));
+	qos->overhead_us = tinydrm_bw_policy_avg(qos->overhead_us,
+						 display_hold_us -
+						 (s64)wire_us);
+}
+
+/**
+ * tinydrm_spi_qos_transfer - SPI transfer that shares the bus
+ * @qos: Bus sharing settings
+ * @spi: SPI device
+ * @speed_hz: Override speed (optional)
+ * @bpw: Bits per word
+ * @buf: Buffer to transfer
+ * @len: Buffer length
+ *
+ * Splits the transfer in &tinydrm_spi_qos->chunk_size messages. Other
+ * devices get the bus between them, and with a utilisation cap the display
+ * idles so the others are not just squeezed in between. The time the display
+ * held the bus for each chunk is recorded. Transfers to the other devices are
+ * not observed, so their latency is not measured: the display hold time is
+ * only the upper bound of the delay the display can add to them.
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int tinydrm_spi_qos_transfer(struct tinydrm_spi_qos *qos,
+			     struct spi_device *spi, u32 speed_hz, u8 bpw,
+			     const void *buf, size_t len)
+{
+	u32 max_util = READ_ONCE(qos->max_util);
+	size_t chunk, max_chunk = READ_ONCE(qos->chunk_size);
+	ktime_t start, first = ktime_get();
+	s64 hold_us, busy_us = 0, idle_us, elapsed_us;
+	int ret;
+
+	if (!max_chunk)
+		max_chunk = len;
+
+	while (len) {
+		chunk = min(len, max_chunk);
+
+		start = ktime_get();
+		ret = tinydrm_spi_transfer(spi, speed_hz, NULL, bpw, buf,
+					   chunk);
+		if (ret)
+			return ret;
+
+		hold_us = ktime_us_delta(ktime_get(), start);
+		tinydrm_spi_qos_account(qos, spi, speed_hz, chunk, hold_us);
+		busy_us += hold_us;
+
+		buf += chunk;
+		len -= chunk;
+		if (!len)
+			break;
+
+		/* Yield point */
+		idle_us = hold_us * (100 - max_util) / max_util;
+		if (idle_us > 0)
+			usleep_range(idle_us, idle_us + idle_us / 4 + 1);
+		else
+			cond_resched();
+	}
+
+	elapsed_us = ktime_us_delta(ktime_get(), first);
+	if (elapsed_us > 0)
+		qos->util = div64_s64(busy_us * 100, elapsed_us);
+
+	return 0;
+}
+EXPORT_SYMBOL(tinydrm_spi_qos_transfer);
+
+#ifdef CONFIG_DEBUG_FS
+
+static int tinydrm_spi_qos_chunk_size_get(void *data, u64 *val)
+{
+	struct tinydrm_spi_qos *qos = data;
+
+	*val = READ_ONCE(qos->chunk_size);
+
+	return 0;
+}
+
+static int tinydrm_spi_qos_chunk_size_set(void *data, u64 val)
+{
+	struct tinydrm_spi_qos *qos = data;
+
+	WRITE_ONCE(qos->chunk_size, tinydrm_spi_qos_chunk_size(val));
+
+	return 0;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(tinydrm_spi_qos_chunk_size_fops,
+			 tinydrm_spi_qos_chunk_size_get,
+			 tinydrm_spi_qos_chunk_size_set, "%llu\n");
+
+static int tinydrm_spi_qos_max_util_get(void *data, u64 *val)
+{
+	struct tinydrm_spi_qos *qos = data;
+
+	*val = READ_ONCE(qos->max_util);
+
+	return 0;
+}
+
+static int tinydrm_spi_qos_max_util_set(void *data, u64 val)
+{
+	struct tinydrm_spi_qos *qos = data;
+
+	WRITE_ONCE(qos->max_util, tinydrm_spi_qos_max_util(val));
+
+	return 0;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(tinydrm_spi_qos_max_util_fops,
+			 tinydrm_spi_qos_max_util_get,
+			 tinydrm_spi_qos_max_util_set, "%llu\n");
+
+/**
+ * tinydrm_spi_qos_debugfs_init - Create debugfs files for bus sharing
+ * @qos: Bus sharing settings
+ * @parent: Parent directory
+ *
+ * spi_chunk_size is rounded down to a multiple of 4 and spi_max_util is
+ * clamped to 1-100. Write zero to spi_max_display_hold_us to restart the
+ * measurement.
+ */
+void tinydrm_spi_qos_debugfs_init(struct tinydrm_spi_qos *qos,
+				  struct dentry *parent)
+{
+	debugfs_create_file_unsafe("spi_chunk_size", 0644, parent, qos,
+				   &tinydrm_spi_qos_chunk_size_fops);
+	debugfs_create_file_unsafe("spi_max_util", 0644, parent, qos,
+				   &tinydrm_spi_qos_max_util_fops);
+	debugfs_create_u32("spi_display_hold_us", 0444, parent,
+			   &qos->display_hold_us);
+	debugfs_create_u32("spi_max_display_hold_us", 0644, parent,
+			   &qos->max_display_hold_us);
+	debugfs_create_u32("spi_overhead_us", 0444, parent, &qos->overhead_us);
+	debugfs_create_u32("spi_util", 0444, parent, &qos->util);
+}
+
+#else
+
+void tinydrm_spi_qos_debugfs_init(struct tinydrm_spi_qos *qos,
+				  struct dentry *parent)
+{
+}
+
+#endif
+EXPORT_SYMBOL(tinydrm_spi_qos_debugfs_init);
+
+/* Must be called with &tinydrm_deferred_init->lock held */
+static void tinydrm_deferred_run_enable(struct tinydrm_deferred_init *dinit)
+{
+	if (xchg(&dinit->enable_pending, false) && !dinit->init_ret)
+		dinit->enable(dinit->pipe, NULL);
+}
+
+static void tinydrm_deferred_work(struct work_struct *work)
+{
+	struct tinydrm_deferred_init *dinit =
+		container_of(work, struct tinydrm_deferred_init, work);
+	struct drm_device *drm = dinit->pipe->crtc.dev;
+
+	if (!dinit->init_done) {
+		dinit->init_ret = dinit->init ? dinit->init(dinit) : 0;
+		dinit->init_done = true;
+		if (dinit->init_ret)
+			DRM_DEV_ERROR(drm->dev, "Panel initialization failed %d\n",
+				      dinit->init_ret);
+		complete_all(&dinit->done);
+	}
+
+	if (!READ_ONCE(dinit->enable_pending))
+		return;
+
+	/*
+	 * The enable is part of a modeset, so serialize it with other commits.
+	 * A disable that runs while we wait for the locks does the enable
+	 * itself, see tinydrm_deferred_wait(). An enable queued while running
+	 * is picked up by the next run.
+	 */
+	drm_modeset_lock_all(drm);
+	mutex_lock(&dinit->lock);
+	tinydrm_deferred_run_enable(dinit);
+	mutex_unlock(&dinit->lock);
+	drm_modeset_unlock_all(drm);
+}
+
+static void tinydrm_deferred_fini(void *data)
+{
+	struct tinydrm_deferred_init *dinit = data;
+
+	cancel_work_sync(&dinit->work);
+}
+
+/**
+ * devm_tinydrm_deferred_init - Set up deferred panel bring-up
+ * @dev: Device
+ * @dinit: Structure to initialize
+ * @pipe: Display pipe
+ * @init: Optional one-time initialization, queued right away
+ * @enable: Pipe enable to run from the worker
+ *
+ * Drivers call tinydrm_deferred_enable() from their pipe enable callback and
+ * tinydrm_deferred_wait() at the start of their disable callback. Call this
+ * before registering the device.
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int devm_tinydrm_deferred_init(struct device *dev,
+			       struct tinydrm_deferred_init *dinit,
+			       struct drm_simple_display_pipe *pipe,
+			       int (*init)(struct tinydrm_deferred_init *dinit),
+			       void (*enable)(struct drm_simple_display_pipe *pipe,
+					      struct drm_crtc_state *crtc_state))
+{
+	int ret;
+
+	dinit->pipe = pipe;
+	dinit->init = init;
+	dinit->enable = enable;
+	INIT_WORK(&dinit->work, tinydrm_deferred_work);
+	init_completion(&dinit->done);
+	mutex_init(&dinit->lock);
+
+	ret = devm_add_action(dev, tinydrm_deferred_fini, dinit);
+	if (ret)
+		return ret;
+
+	/* The panel sleeps can be long, keep them off the system workqueue */
+	if (init)
+		queue_work(system_long_wq, &dinit->work);
+	else
+		complete_all(&dinit->done);
+
+	return 0;
+}
+EXPORT_SYMBOL(devm_tinydrm_deferred_init);
+
+/**
+ * tinydrm_deferred_enable - Queue pipe enable
+ * @dinit: Deferred init structure
+ *
+ * Runs &tinydrm_deferred_init->enable from a worker when the one-time
+ * initialization is done.
+ */
+void tinydrm_deferred_enable(struct tinydrm_deferred_init *dinit)
+{
+	WRITE_ONCE(dinit->enable_pending, true);
+	queue_work(system_long_wq, &dinit->work);
+}
+EXPORT_SYMBOL(tinydrm_deferred_enable);
+
+/**
+ * tinydrm_deferred_wait - Wait for the panel bring-up
+ * @dinit: Deferred init structure
+ *
+ * Waits for the one-time initialization and a running enable to finish.
+ * The worker might be waiting for modeset locks held by the caller, so an
+ * enable that hasn't started yet is run right here instead.
+ *
+ * Returns:
+ * The result of the one-time initialization. Enables are skipped if it
+ * failed.
+ */
+int tinydrm_deferred_wait(struct tinydrm_deferred_init *dinit)
+{
+	wait_for_completion(&dinit->done);
+
+	mutex_lock(&dinit->lock);
+	tinydrm_deferred_run_enable(dinit);
+	mutex_unlock(&dinit->lock);
+
+	return dinit->init_ret;
+}
+EXPORT_SYMBOL(tinydrm_deferred_wait);
+
+/* Long enough to ride out a blank/unblank cycle without a sleep */
+#define TINYDRM_AUTOSUSPEND_DELAY_MS	5000
+
+static void tinydrm_runtime_pm_fini(void *data)
+{
+	struct device *dev = data;
+
+	pm_runtime_dont_use_autosuspend(dev);
+	pm_runtime_disable(dev);
+}
+
+/**
+ * devm_tinydrm_runtime_pm_init - Enable runtime PM with autosuspend
+ * @dev: Device
+ *
+ * Drivers take a runtime PM reference when the pipe is enabled and drop it
+ * with pm_runtime_put_autosuspend() when disabled. The panel is put to sleep
+ * by the runtime suspend callback once it has been idle for the autosuspend
+ * delay, which can be changed through sysfs. Drvdata must be set before
+ * calling this since the callbacks can run as soon as the pipe is enabled.
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int devm_tinydrm_runtime_pm_init(struct device *dev)
+{
+	pm_runtime_set_autosuspend_delay(dev, TINYDRM_AUTOSUSPEND_DELAY_MS);
+	pm_runtime_use_autosuspend(dev);
+	pm_runtime_enable(dev);
+
+	return devm_add_action_or_reset(dev, tinydrm_runtime_pm_fini, dev);
+}
+EXPORT_SYMBOL(devm_tinydrm_runtime_pm_init);
+
+static unsigned int tinydrm_clip_area(const struct drm_clip_rect *clip)
+{
+	return (clip->x2 - clip->x1) * (clip->y2 - clip->y1);
+}
+
+/**
+ * tinydrm_plan_clips - Merge damage clips into flushes
+ * @clips: Clip rectangles, merged in place
+ * @num_clips: Number of clips
+ * @max_clips: Maximum number of flushes
+ * @overhead: Cost of starting a flush in pixels
+ *
+ * Merges the pair of clips that adds the fewest pixels as long as that costs
+ * less than the @overhead of flushing them separately, or while there are
+ * more than @max_clips left. This keeps a status bar and a clock at opposite
+ * ends of the screen apart while a block of nearby lines goes out as one.
+ *
+ * Returns:
+ * Number of clips left in @clips.
+ */
+unsigned int tinydrm_plan_clips(struct drm_clip_rect *clips,
+				unsigned int num_clips, unsigned int max_clips,
+				unsigned int overhead)
+{
+	unsigned int i, j, best_i = 0, best_j = 0;
+	struct drm_clip_rect r, best_r = { 0 };
+	long extra, best;
+
+	while (num_clips > 1) {
+		best = LONG_MAX;
+		for (i = 0; i < num_clips; i++) {
+			for (j = i + 1; j < num_clips; j++) {
+				r.x1 = min(clips[i].x1, clips[j].x1);
+				r.y1 = min(clips[i].y1, clips[j].y1);
+				r.x2 = max(clips[i].x2, clips[j].x2);
+				r.y2 = max(clips[i].y2, clips[j].y2);
+				extra = (long)tinydrm_clip_area(&r) -
+					tinydrm_clip_area(&clips[i]) -
+					tinydrm_clip_area(&clips[j]);
+				if (extra < best) {
+					best = extra;
+					best_i = i;
+					best_j = j;
+					best_r = r;
+				}
+			}
+		}
+
+		if (best > (long)overhead && num_clips <= max_clips)
+			break;
+
+		clips[best_i] = best_r;
+		clips[best_j] = clips[--num_clips];
+	}
+
+	return num_clips;
+}
+EXPORT_SYMBOL(tinydrm_plan_clips);
+
+/* Flushes a single fbdev deferred I/O run can be split into */
+#define TINYDRM_FBDEV_MAX_CLIPS		8
+
+/* Bytes on the wire that cost about the same as setting up a flush */
+#define TINYDRM_FBDEV_FLUSH_OVERHEAD	512
+
+/*
+ * Each dirty page only touches the rows it covers, so a status bar that's
+ * redrawn through mmap is flushed as a band instead of everything between the
+ * first and the last page written.
+ */
+static void tinydrm_fbdev_deferred_io(struct fb_info *info,
+				      struct list_head *pagelist)
+{
+	struct drm_fb_helper *helper = info->par;
+	struct drm_framebuffer *fb = helper->fb;
+	unsigned int pitch = info->fix.line_length;
+	unsigned int height = info->var.yres;
+	unsigned int i, y1, y2, num_clips = 0;
+	struct drm_clip_rect *clips;
+	unsigned long start;
+	struct page *page;
+
+	if (!fb || !fb->funcs->dirty)
+		return;
+
+	list_for_each_entry(page, pagelist, lru)
+		num_clips++;
+	if (!num_clips)
+		return;
+
+	clips = kmalloc_array(num_clips, sizeof(*clips), GFP_KERNEL);
+	if (!clips) {
+		fb->funcs->dirty(fb, NULL, 0, 0, NULL, 0);
+		return;
+	}
+
+	/* The pagelist is sorted, so touching pages end up in one clip */
+	num_clips = 0;
+	list_for_each_entry(page, pagelist, lru) {
+		start = page->index << PAGE_SHIFT;
+		y1 = start / pitch;
+		y2 = min_t(unsigned int, DIV_ROUND_UP(start + PAGE_SIZE, pitch),
+			   height);
+		if (y1 >= y2)
+			continue;
+
+		if (num_clips && y1 <= clips[num_clips - 1].y2) {
+			if (y2 > clips[num_clips - 1].y2)
+				clips[num_clips - 1].y2 = y2;
+			continue;
+		}
+
+		clips[num_clips].x1 = 0;
+		clips[num_clips].x2 = info->var.xres;
+		clips[num_clips].y1 = y1;
+		clips[num_clips].y2 = y2;
+		num_clips++;
+	}
+
+	num_clips = tinydrm_plan_clips(clips, num_clips,
+				       TINYDRM_FBDEV_MAX_CLIPS,
+				       TINYDRM_FBDEV_FLUSH_OVERHEAD /
+				       (info->var.bits_per_pixel / 8));
+
+	for (i = 0; i < num_clips; i++)
+		fb->funcs->dirty(fb, NULL, 0, 0, &clips[i], 1);
+
+	kfree(clips);
+}
+
+/*
+ * The fbdev emulation registers its fb_info with the DRM device as parent.
+ * &drm_fbdev_cma is opaque, so look it up through the device model instead.
+ */
+static int tinydrm_fbdev_match(struct device *dev, void *data)
+{
+	struct drm_device *drm = data;
+	struct drm_fb_helper *helper;
+	struct fb_info *info;
+
+	if (!dev->devt || MAJOR(dev->devt) != FB_MAJOR)
+		return 0;
+
+	info = dev_get_drvdata(dev);
+	if (!info || !info->fbops ||
+	    info->fbops->fb_check_var != drm_fb_helper_check_var)
+		return 0;
+
+	helper = info->par;
+
+	return helper->dev == drm;
+}
+
+static struct fb_info *tinydrm_fbdev_info(struct drm_device *drm)
+{
+	struct device *dev;
+	struct fb_info *info;
+
+	dev = device_find_child(drm->dev, drm, tinydrm_fbdev_match);
+	if (!dev)
+		return NULL;
+
+	info = dev_get_drvdata(dev);
+	put_device(dev);
+
+	return info;
+}
+
+/**
+ * tinydrm_fbdev_init_deferred_io - Set up row granular fbdev damage
+ * @tdev: tinydrm device
+ *
+ * The fbdev emulation turns writes through mmap into one flush covering every
+ * row between the first and the last dirty page. This replaces the deferred
+ * I/O handler with one that flushes the rows touched by each page and only
+ * merges bands that are close. The flush delay can be changed with the
+ * "fbdev-flush-delay-ms" property. Call this after devm_tinydrm_register().
+ * Nothing is done if fbdev emulation isn't available.
+ */
+void tinydrm_fbdev_init_deferred_io(struct tinydrm_device *tdev)
+{
+	struct fb_deferred_io *fbdefio;
+	struct fb_info *info;
+	u32 delay_ms;
+
+	if (IS_ERR_OR_NULL(tdev->fbdev_cma))
+		return;
+
+	info = tinydrm_fbdev_info(tdev->drm);
+	if (!info || !info->fbdefio)
+		return;
+
+	fbdefio = info->fbdefio;
+
+	mutex_lock(&fbdefio->lock);
+	fbdefio->deferred_io = tinydrm_fbdev_deferred_io;
+	if (!device_property_read_u32(tdev->drm->dev, "fbdev-flush-delay-ms",
+				      &delay_ms))
+		fbdefio->delay = msecs_to_jiffies(delay_ms);
+	mutex_unlock(&fbdefio->lock);
+}
+EXPORT_SYMBOL(tinydrm_fbdev_init_deferred_io);
+
 MODULE_LICENSE("GPL");
@@ -0,0 +1,385 @@
+/*
+ * Copyright (C) 2018 The tinydrm contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/cpumask.h>
+#include <linux/device.h>
+#include <linux/gpio/consumer.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/sizes.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/wait.h>
+
+#include <drm/tinydrm/tinydrm-i80.h>
+
+/**
+ * DOC: overview
+ *
+ * GPIO bit-banged I80 (8080) bus write engine shared by the I80 regmap and
+ * the fbtft parallel bus writers.
+ *
+ * The raw line levels for every possible byte value are computed on
+ * initialization (taking active low lines into account), so writing a bus
+ * word is a table lookup and one raw array set. gpiolib hands lines sitting
+ * on the same chip to the driver in one go. When the data word doesn't
+ * change, only the WR line is strobed.
+ *
+ * Optionally the bus can be driven by a kthread pinned to a CPU, see
+ * tinydrm_i80_bus_start_thread().
+ */
+
+#define TINYDRM_I80_SLOTS	4
+#define TINYDRM_I80_SLOT_SIZE	SZ_8K
+
+struct tinydrm_i80_slot {
+	void *buf;
+	size_t len;
+	unsigned int flags;
+};
+
+struct tinydrm_i80_bus {
+	struct gpio_desc *wr;
+	struct gpio_descs *db;
+	unsigned int width;
+	unsigned int lanes;
+	bool can_sleep;
+	int wr_assert;
+	int wr_deassert;
+
+	/* Raw line values per byte lane */
+	int (*values)[256][8];
+	int buf[16];
+
+	u16 prev;
+	bool prev_valid;
+
+	/* Optional control lines, only used by the thread */
+	struct gpio_desc *cs;
+	struct gpio_desc *dc;
+
+	/*
+	 * Single producer, single consumer ring: the producer (serialized by
+	 * the bus user) only writes @head, the thread only writes @tail.
+	 */
+	struct task_struct *thread;
+	struct tinydrm_i80_slot slots[TINYDRM_I80_SLOTS];
+	unsigned int head;
+	unsigned int tail;
+	wait_queue_head_t work_wait;
+	wait_queue_head_t space_wait;
+};
+
+static void tinydrm_i80_bus_set_wr(struct tinydrm_i80_bus *bus, int value)
+{
+	if (bus->can_sleep)
+		gpiod_set_raw_value_cansleep(bus->wr, value);
+	else
+		gpiod_set_raw_value(bus->wr, value);
+}
+
+static void tinydrm_i80_bus_set_data(struct tinydrm_i80_bus *bus, u16 word)
+{
+	u8 lo = word, hi = word >> 8;
+
+	memcpy(bus->buf, bus->values[0][lo], sizeof(bus->values[0][lo]));
+	if (bus->lanes == 2)
+		memcpy(bus->buf + 8, bus->values[1][hi],
+		       sizeof(bus->values[1][hi]));
+
+	if (bus->can_sleep)
+		gpiod_set_raw_array_value_cansleep(bus->width, bus->db->desc,
+						   bus->buf);
+	else
+		gpiod_set_raw_array_value(bus->width, bus->db->desc, bus->buf);
+}
+
+/**
+ * tinydrm_i80_bus_write_word - Write one bus word
+ * @bus: I80 bus
+ * @word: Word to write, only the lower 8 bits are used on an 8-bit bus
+ *
+ * The data lines are only touched if @word differs from the previous word.
+ */
+void tinydrm_i80_bus_write_word(struct tinydrm_i80_bus *bus, u16 word)
+{
+	if (bus->width == 8)
+		word &= 0xff;
+
+	tinydrm_i80_bus_set_wr(bus, bus->wr_assert);
+
+	if (!bus->prev_valid || word != bus->prev) {
+		tinydrm_i80_bus_set_data(bus, word);
+		bus->prev = word;
+		bus->prev_valid = true;
+	}
+
+	tinydrm_i80_bus_set_wr(bus, bus->wr_deassert);
+}
+EXPORT_SYMBOL(tinydrm_i80_bus_write_word);
+
+/**
+ * tinydrm_i80_bus_write_buf - Write buffer
+ * @bus: I80 bus
+ * @buf: Buffer, bytes on an 8-bit bus and native endian words on a 16-bit bus
+ * @len: Buffer length in bytes
+ */
+void tinydrm_i80_bus_write_buf(struct tinydrm_i80_bus *bus, const void *buf,
+			       size_t len)
+{
+	size_t i;
+
+	if (bus->width == 8) {
+		const u8 *buf8 = buf;
+
+		for (i = 0; i < len; i++)
+			tinydrm_i80_bus_write_word(bus, *buf8++);
+	} else {
+		const u16 *buf16 = buf;
+
+		for (i = 0; i < (len / 2); i++)
+			tinydrm_i80_bus_write_word(bus, *buf16++);
+	}
+}
+EXPORT_SYMBOL(tinydrm_i80_bus_write_buf);
+
+static void tinydrm_i80_bus_run_slot(struct tinydrm_i80_bus *bus,
+				     struct tinydrm_i80_slot *slot)
+{
+	if (bus->cs && (slot->flags & TINYDRM_I80_BEGIN))
+		gpiod_set_value_cansleep(bus->cs, 0);
+
+	if (bus->dc)
+		gpiod_set_value_cansleep(bus->dc,
+					 !(slot->flags & TINYDRM_I80_CMD));
+
+	tinydrm_i80_bus_write_buf(bus, slot->buf, slot->len);
+
+	if (bus->cs && (slot->flags & TINYDRM_I80_END))
+		gpiod_set_value_cansleep(bus->cs, 1);
+}
+
+static int tinydrm_i80_bus_thread(void *data)
+{
+	struct tinydrm_i80_bus *bus = data;
+	unsigned int tail;
+
+	while (!kthread_should_stop()) {
+		tail = bus->tail;
+		wait_event_interruptible(bus->work_wait,
+					 smp_load_acquire(&bus->head) != tail ||
+					 kthread_should_stop());
+		if (smp_load_acquire(&bus->head) == tail)
+			continue;
+
+		tinydrm_i80_bus_run_slot(bus,
+					 &bus->slots[tail % TINYDRM_I80_SLOTS]);
+
+		smp_store_release(&bus->tail, tail + 1);
+		wake_up(&bus->space_wait);
+	}
+
+	return 0;
+}
+
+static void tinydrm_i80_bus_stop_thread(void *data)
+{
+	struct tinydrm_i80_bus *bus = data;
+
+	kthread_stop(bus->thread);
+	bus->thread = NULL;
+}
+
+/**
+ * tinydrm_i80_bus_start_thread - Hand bus writes to a CPU pinned kthread
+ * @dev: Device
+ * @bus: I80 bus
+ * @cs: Chip Select gpio (optional)
+ * @dc: Index/data gpio, low for commands (optional)
+ * @cpu: CPU to run the thread on
+ *
+ * After this, writes are submitted using tinydrm_i80_bus_get_slot() and
+ * tinydrm_i80_bus_queue_slot(). The submitter can prepare the next slot
+ * while the thread writes the previous one.
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int tinydrm_i80_bus_start_thread(struct device *dev,
+				 struct tinydrm_i80_bus *bus,
+				 struct gpio_desc *cs, struct gpio_desc *dc,
+				 unsigned int cpu)
+{
+	struct task_struct *thread;
+	unsigned int i;
+
+	if (cpu >= nr_cpu_ids || !cpu_online(cpu))
+		return -EINVAL;
+
+	for (i = 0; i < TINYDRM_I80_SLOTS; i++) {
+		bus->slots[i].buf = devm_kmalloc(dev, TINYDRM_I80_SLOT_SIZE,
+						 GFP_KERNEL);
+		if (!bus->slots[i].buf)
+			return -ENOMEM;
+	}
+
+	bus->cs = cs;
+	bus->dc = dc;
+	init_waitqueue_head(&bus->work_wait);
+	init_waitqueue_head(&bus->space_wait);
+
+	thread = kthread_create(tinydrm_i80_bus_thread, bus, "i80/%s",
+				dev_name(dev));
+	if (IS_ERR(thread))
+		return PTR_ERR(thread);
+
+	kthread_bind(thread, cpu);
+	bus->thread = thread;
+	wake_up_process(thread);
+
+	return devm_add_action_or_reset(dev, tinydrm_i80_bus_stop_thread, bus);
+}
+EXPORT_SYMBOL(tinydrm_i80_bus_start_thread);
+
+/**
+ * tinydrm_i80_bus_threaded - Is the bus driven by a thread?
+ * @bus: I80 bus
+ */
+bool tinydrm_i80_bus_threaded(struct tinydrm_i80_bus *bus)
+{
+	return bus->thread;
+}
+EXPORT_SYMBOL(tinydrm_i80_bus_threaded);
+
+/**
+ * tinydrm_i80_bus_get_slot - Get a free slot
+ * @bus: I80 bus
+ * @size: Returns the slot size in bytes
+ *
+ * Wait for a free slot. The caller must serialize submission.
+ *
+ * Returns:
+ * Slot buffer.
+ */
+void *tinydrm_i80_bus_get_slot(struct tinydrm_i80_bus *bus, size_t *size)
+{
+	unsigned int head = bus->head;
+
+	wait_event(bus->space_wait,
+		   head - smp_load_acquire(&bus->tail) < TINYDRM_I80_SLOTS);
+	*size = TINYDRM_I80_SLOT_SIZE;
+
+	return bus->slots[head % TINYDRM_I80_SLOTS].buf;
+}
+EXPORT_SYMBOL(tinydrm_i80_bus_get_slot);
+
+/**
+ * tinydrm_i80_bus_queue_slot - Queue slot for writing
+ * @bus: I80 bus
+ * @len: Number of bytes to write from the slot buffer
+ * @flags: TINYDRM_I80_CMD, TINYDRM_I80_BEGIN, TINYDRM_I80_END
+ */
+void tinydrm_i80_bus_queue_slot(struct tinydrm_i80_bus *bus, size_t len,
+				unsigned int flags)
+{
+	struct tinydrm_i80_slot *slot;
+	unsigned int head = bus->head;
+
+	slot = &bus->slots[head % TINYDRM_I80_SLOTS];
+	slot->len = len;
+	slot->flags = flags;
+
+	smp_store_release(&bus->head, head + 1);
+	wake_up(&bus->work_wait);
+}
+EXPORT_SYMBOL(tinydrm_i80_bus_queue_slot);
+
+/**
+ * tinydrm_i80_bus_wait_idle - Wait for queued slots to be written
+ * @bus: I80 bus
+ */
+void tinydrm_i80_bus_wait_idle(struct tinydrm_i80_bus *bus)
+{
+	wait_event(bus->space_wait,
+		   smp_load_acquire(&bus->tail) == bus->head);
+}
+EXPORT_SYMBOL(tinydrm_i80_bus_wait_idle);
+
+/**
+ * tinydrm_i80_bus_width - Bus width
+ * @bus: I80 bus
+ *
+ * Returns:
+ * Bus width in bits, 8 or 16.
+ */
+unsigned int tinydrm_i80_bus_width(struct tinydrm_i80_bus *bus)
+{
+	return bus->width;
+}
+EXPORT_SYMBOL(tinydrm_i80_bus_width);
+
+/**
+ * devm_tinydrm_i80_bus_init - Initialize I80 bus
+ * @dev: Device
+ * @wr: Write latch gpio, data is latched when it's set high (deasserted)
+ * @db: Databus gpio array, 8 or 16 lines
+ *
+ * Objects created by this function will be automatically freed on driver
+ * detach (devres).
+ *
+ * Returns:
+ * I80 bus on success or ERR_PTR on failure.
+ */
+struct tinydrm_i80_bus *devm_tinydrm_i80_bus_init(struct device *dev,
+						  struct gpio_desc *wr,
+						  struct gpio_descs *db)
+{
+	struct tinydrm_i80_bus *bus;
+	unsigned int lane, i, bit;
+	int active_low[16];
+
+	if (!wr || !db || (db->ndescs != 8 && db->ndescs != 16))
+		return ERR_PTR(-EINVAL);
+
+	bus = devm_kzalloc(dev, sizeof(*bus), GFP_KERNEL);
+	if (!bus)
+		return ERR_PTR(-ENOMEM);
+
+	bus->wr = wr;
+	bus->db = db;
+	bus->width = db->ndescs;
+	bus->lanes = db->ndescs / 8;
+	bus->can_sleep = gpiod_cansleep(wr);
+	for (i = 0; i < db->ndescs; i++) {
+		bus->can_sleep |= gpiod_cansleep(db->desc[i]);
+		active_low[i] = gpiod_is_active_low(db->desc[i]);
+	}
+
+	/* Raw levels, asserting WR means driving it low */
+	bus->wr_assert = gpiod_is_active_low(wr);
+	bus->wr_deassert = !bus->wr_assert;
+
+	bus->values = devm_kcalloc(dev, bus->lanes, sizeof(*bus->values),
+				   GFP_KERNEL);
+	if (!bus->values)
+		return ERR_PTR(-ENOMEM);
+
+	for (lane = 0; lane < bus->lanes; lane++)
+		for (i = 0; i < 256; i++)
+			for (bit = 0; bit < 8; bit++)
+				bus->values[lane][i][bit] =
+					((i >> bit) & 1) ^
+					active_low[lane * 8 + bit];
+
+	dev_dbg(dev, "I80 bus: %u-bit%s\n", bus->width,
+		bus->can_sleep ? ", can sleep" : "");
+
+	return bus;
+}
+EXPORT_SYMBOL(devm_tinydrm_i80_bus_init);
@@ -7,6 +7,9 @@
  * (at your option) any later version.
  */
 
+#include <linux/delay.h>
+#include <linux/mutex.h>
+#include <linux/pm_runtime.h>
 #include <linux/regmap.h>
 #include <linux/spi/spi.h>
 #include <asm/unaligned.h>
@@ -17,6 +20,25 @@
 #include <drm/tinydrm/tinydrm-ili9325.h>
 #include <drm/tinydrm/tinydrm-regmap.h>
 
+struct tinydrm_ili9325_fill {
+	struct drm_framebuffer *fb;
+	struct drm_clip_rect *clip;
+	bool swap;
+};
+
+static int tinydrm_ili9325_fill(void *dst, size_t offset, size_t len,
+				void *arg)
+{
+	struct tinydrm_ili9325_fill *fill = arg;
+	unsigned int pitch = (fill->clip->x2 - fill->clip->x1) * 2;
+	struct drm_clip_rect lines = *fill->clip;
+
+	lines.y1 += offset / pitch;
+	lines.y2 = lines.y1 + len / pitch;
+
+	return tinydrm_rgb565_buf_copy(dst, fill->fb, &lines, fill->swap);
+}
+
 static int tinydrm_ili9325_fb_dirty(struct drm_framebuffer *fb,
 			     struct drm_file *file_priv,
 			     unsigned int flags, unsigned int color,
@@ -31,13 +53,16 @@ static int tinydrm_ili9325_fb_dirty(struct drm_framebuffer *fb,
 	struct drm_clip_rect clip;
 	u16 ac_low, ac_high;
 	int ret = 0;
+	size_t len;
 	bool full;
 	void *tr;
 
 	mutex_lock(&tdev->dirty_lock);
 
-	if (!ili9325->enabled)
+	if (!ili9325->enabled) {
+		ili9325->stale = true;
 		goto out_unlock;
+	}
 
 	/* fbdev can flush even when we're not interested */
 	if (tdev->pipe.plane.fb != fb)
@@ -52,16 +77,6 @@ static int tinydrm_ili9325_fb_dirty(struct drm_framebuffer *fb,
 	DRM_DEBUG("Flushing [FB:%d] x1=%u, x2=%u, y1=%u, y2=%u, swap=%u\n",
 		  fb->base.id, clip.x1, clip.x2, clip.y1, clip.y2, swap);
 
-	if (ili9325->always_tx_buf || swap || !full ||
-	    fb->format->format == DRM_FORMAT_XRGB8888) {
-		tr = ili9325->tx_buf;
-		ret = tinydrm_rgb565_buf_copy(tr, fb, &clip, swap);
-		if (ret)
-			goto out_unlock;
-	} else {
-		tr = cma_obj->vaddr;
-	}
-
 	/*
 	 * FIXME
 	 * This should support clips that are not full width,
@@ -92,9 +107,39 @@ static int tinydrm_ili9325_fb_dirty(struct drm_framebuffer *fb,
 	regmap_write(reg, 0x0020, ac_low);
 	regmap_write(reg, 0x0021, ac_high);
 
-	ret = regmap_raw_write(reg, 0x0022, tr,
-			       (clip.x2 - clip.x1) * (clip.y2 - clip.y1) * 2);
+	len = (clip.x2 - clip.x1) * (clip.y2 - clip.y1) * 2;
+
+	/* Convert the next lines while the bus thread writes the previous */
+	if (ili9325->stream.fill) {
+		struct tinydrm_ili9325_fill fill = {
+			.fb = fb,
+			.clip = &clip,
+			.swap = swap,
+		};
+
+		ret = tinydrm_regmap_stream_fill(reg, &ili9325->stream, 0x0022,
+						 ili9325->tx_buf, len,
+						 (clip.x2 - clip.x1) * 2,
+						 tinydrm_ili9325_fill, &fill);
+		goto out_flushed;
+	}
 
+	if (ili9325->always_tx_buf || swap || !full ||
+	    fb->format->format == DRM_FORMAT_XRGB8888) {
+		tr = ili9325->tx_buf;
+		ret = tinydrm_rgb565_buf_copy(tr, fb, &clip, swap);
+		if (ret)
+			goto out_flushed;
+	} else {
+		tr = cma_obj->vaddr;
+	}
+
+	ret = tinydrm_regmap_stream_write(reg, &ili9325->stream, 0x0022, tr,
+					  len);
+
+out_flushed:
+	/* The reference keeps a new framebuffer from reusing the pointer */
+	drm_framebuffer_assign(&ili9325->last_fb, ret ? NULL : fb);
 out_unlock:
 	mutex_unlock(&tdev->dirty_lock);
 
@@ -111,6 +156,59 @@ static const struct drm_framebuffer_funcs tinydrm_ili9325_fb_funcs = {
 	.dirty		= tinydrm_ili9325_fb_dirty,
 };
 
+/* Runs from the deferred init worker */
+static void
+tinydrm_ili9325_deferred_enable(struct drm_simple_display_pipe *pipe,
+				struct drm_crtc_state *crtc_state)
+{
+	struct tinydrm_device *tdev = pipe_to_tinydrm(pipe);
+	struct tinydrm_ili9325 *ili9325 = tinydrm_to_ili9325(tdev);
+	struct device *dev = tdev->drm->dev;
+	int ret;
+
+	ret = pm_runtime_get_sync(dev);
+	if (ret < 0)
+		DRM_DEV_ERROR(dev, "Failed to resume (%d)\n", ret);
+
+	ili9325->funcs->enable(pipe, crtc_state);
+}
+
+/* Runs before the framebuffers are torn down */
+static void tinydrm_ili9325_release_last_fb(void *data)
+{
+	struct tinydrm_ili9325 *ili9325 = data;
+
+	drm_framebuffer_assign(&ili9325->last_fb, NULL);
+}
+
+static void tinydrm_ili9325_pipe_enable(struct drm_simple_display_pipe *pipe,
+					struct drm_crtc_state *crtc_state)
+{
+	struct tinydrm_device *tdev = pipe_to_tinydrm(pipe);
+
+	drm_crtc_vblank_on(&pipe->crtc);
+	tinydrm_deferred_enable(&tinydrm_to_ili9325(tdev)->dinit);
+}
+
+static void tinydrm_ili9325_pipe_disable(struct drm_simple_display_pipe *pipe)
+{
+	struct tinydrm_device *tdev = pipe_to_tinydrm(pipe);
+	struct tinydrm_ili9325 *ili9325 = tinydrm_to_ili9325(tdev);
+	struct device *dev = tdev->drm->dev;
+	bool enabled;
+
+	drm_crtc_vblank_off(&pipe->crtc);
+	tinydrm_deferred_wait(&ili9325->dinit);
+
+	enabled = ili9325->enabled;
+	ili9325->funcs->disable(pipe);
+	/* Registers and GRAM survive unless the power was cut */
+	ili9325->retained = enabled && !ili9325->regulator;
+
+	pm_runtime_mark_last_busy(dev);
+	pm_runtime_put_autosuspend(dev);
+}
+
 static const uint32_t tinydrm_ili9325_formats[] = {
 	DRM_FORMAT_RGB565,
 	DRM_FORMAT_XRGB8888,
@@ -122,12 +220,16 @@ static const uint32_t tinydrm_ili9325_formats[] = {
  * @panel: &tinydrm_panel structure to initialize
  * @funcs: Callbacks for the panel (optional)
  * @reg: Register map
+ * @stream: Pixel stream operation for @reg (optional)
  * @driver: DRM driver
  * @mode: Display mode
  * @rotation: Initial rotation in degrees Counter Clock Wise
  *
  * This function initializes a &tinydrm_panel structure and it's underlying
- * @tinydrm_device. It also sets up the display pipeline.
+ * @tinydrm_device. It also sets up the display pipeline. The @funcs enable
+ * callback is run from a worker so the controller power on sequence doesn't
+ * hold up probing or modesets. Runtime PM is enabled and idle controllers are
+ * put in standby, see &tinydrm_ili9325_pm_ops.
  *
  * Supported formats: Native RGB565 and emulated XRGB8888.
  *
@@ -139,17 +241,30 @@ static const uint32_t tinydrm_ili9325_formats[] = {
  */
 int tinydrm_ili9325_init(struct device *dev, struct tinydrm_ili9325 *ili9325,
 			 const struct drm_simple_display_pipe_funcs *funcs,
-			 struct regmap *reg, struct drm_driver *driver,
+			 struct regmap *reg,
+			 const struct tinydrm_regmap_stream *stream,
+			 struct drm_driver *driver,
 			 const struct drm_display_mode *mode,
 			 unsigned int rotation)
 {
 	size_t bufsize = mode->vdisplay * mode->hdisplay * sizeof(u16);
 	struct tinydrm_device *tdev = &ili9325->tinydrm;
+	struct drm_simple_display_pipe_funcs *pipe_funcs;
 	int ret;
 
+	pipe_funcs = devm_kmemdup(dev, funcs, sizeof(*pipe_funcs), GFP_KERNEL);
+	if (!pipe_funcs)
+		return -ENOMEM;
+
+	pipe_funcs->enable = tinydrm_ili9325_pipe_enable;
+	pipe_funcs->disable = tinydrm_ili9325_pipe_disable;
+	ili9325->funcs = funcs;
+
 	ili9325->swap_bytes = tinydrm_regmap_raw_swap_bytes(reg);
 	ili9325->rotation = rotation;
 	ili9325->reg = reg;
+	if (stream)
+		ili9325->stream = *stream;
 
 	ili9325->tx_buf = devm_kmalloc(dev, bufsize, GFP_KERNEL);
 	if (!ili9325->tx_buf)
@@ -159,8 +274,12 @@ int tinydrm_ili9325_init(struct device *dev, struct tinydrm_ili9325 *ili9325,
 	if (ret)
 		return ret;
 
+	ret = devm_add_action(dev, tinydrm_ili9325_release_last_fb, ili9325);
+	if (ret)
+		return ret;
+
 	/* TODO: Maybe add DRM_MODE_CONNECTOR_SPI */
-	ret = tinydrm_display_pipe_init(tdev, funcs,
+	ret = tinydrm_display_pipe_init(tdev, pipe_funcs,
 					DRM_MODE_CONNECTOR_VIRTUAL,
 					tinydrm_ili9325_formats,
 					ARRAY_SIZE(tinydrm_ili9325_formats), mode,
@@ -168,6 +287,29 @@ int tinydrm_ili9325_init(struct device *dev, struct tinydrm_ili9325 *ili9325,
 	if (ret)
 		return ret;
 
+	ret = tinydrm_plane_enable_fb_damage_clips(&tdev->pipe.plane);
+	if (ret)
+		return ret;
+
+	ret = tinydrm_vblank_emulation_init(&tdev->pipe.crtc);
+	if (ret)
+		return ret;
+
+	ret = tinydrm_flip_queue_init(&tdev->pipe);
+	if (ret)
+		return ret;
+
+	ret = devm_tinydrm_deferred_init(dev, &ili9325->dinit, &tdev->pipe,
+					 NULL, tinydrm_ili9325_deferred_enable);
+	if (ret)
+		return ret;
+
+	/* The runtime PM callbacks need it before the driver sets it */
+	dev_set_drvdata(dev, tdev->drm);
+	ret = devm_tinydrm_runtime_pm_init(dev);
+	if (ret)
+		return ret;
+
 	tdev->drm->mode_config.preferred_depth = 16;
 
 	drm_mode_config_reset(tdev->drm);
@@ -179,11 +321,285 @@ int tinydrm_ili9325_init(struct device *dev, struct tinydrm_ili9325 *ili9325,
 }
 EXPORT_SYMBOL(tinydrm_ili9325_init);
 
+/**
+ * tinydrm_ili9325_reset - Hardware reset controller
+ * @ili9325: tinydrm ILI9325 device
+ *
+ * Pulse the reset gpio if there is one. The register cache is dropped since
+ * the registers are now back at their reset values, and GRAM is no longer
+ * assumed to hold the last flushed framebuffer.
+ */
+void tinydrm_ili9325_reset(struct tinydrm_ili9325 *ili9325)
+{
+	struct regmap *reg = ili9325->reg;
+
+	ili9325->standby = false;
+	ili9325->retained = false;
+	regcache_cache_only(reg, false);
+
+	if (!ili9325->reset)
+		return;
+
+	tinydrm_hw_reset(ili9325->reset, 1, 10);
+	regcache_drop_region(reg, 0, 0xff);
+}
+EXPORT_SYMBOL(tinydrm_ili9325_reset);
+
+/**
+ * tinydrm_ili9325_update - Write register if the value has changed
+ * @ili9325: tinydrm ILI9325 device
+ * @regnr: Register number
+ * @val: Value
+ *
+ * The write is skipped if the register cache (or the hardware on a readable
+ * bus) already holds @val.
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int tinydrm_ili9325_update(struct tinydrm_ili9325 *ili9325,
+			   unsigned int regnr, unsigned int val)
+{
+	int ret;
+
+	ret = regmap_update_bits(ili9325->reg, regnr, 0xffff, val);
+	/* Not cached and the bus can't be read */
+	if (ret == -ENOTSUPP)
+		ret = regmap_write(ili9325->reg, regnr, val);
+
+	return ret;
+}
+EXPORT_SYMBOL(tinydrm_ili9325_update);
+
+/**
+ * tinydrm_ili9325_standby - Turn off display and enter standby mode
+ * @ili9325: tinydrm ILI9325 device
+ *
+ * Standby mode stops the oscillator and the power circuits, but retains
+ * register and GRAM contents. Register writes are cached until
+ * tinydrm_ili9325_wake() is called.
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int tinydrm_ili9325_standby(struct tinydrm_ili9325 *ili9325)
+{
+	struct regmap *reg = ili9325->reg;
+	int ret;
+
+	ret = regmap_read(reg, 0x0007, &ili9325->display_ctrl);
+	if (ret)
+		return ret;
+
+	/* Display Control 1: display off */
+	ret = regmap_write(reg, 0x0007, 0x0000);
+	if (ret)
+		return ret;
+
+	/* Power Control 1: STB */
+	ret = regmap_update_bits(reg, 0x0010, BIT(0), BIT(0));
+	if (ret)
+		return ret;
+
+	regcache_cache_only(reg, true);
+	ili9325->standby = true;
+
+	return 0;
+}
+EXPORT_SYMBOL(tinydrm_ili9325_standby);
+
+/**
+ * tinydrm_ili9325_wake - Leave standby mode and turn on display
+ * @ili9325: tinydrm ILI9325 device
+ *
+ * Fast resume path which avoids a reset and a full initialization. Registers
+ * written while in standby are synced from the cache.
+ *
+ * Returns:
+ * Zero on success, negative error code on failure in which case the
+ * controller needs a full initialization.
+ */
+int tinydrm_ili9325_wake(struct tinydrm_ili9325 *ili9325)
+{
+	struct regmap *reg = ili9325->reg;
+	int ret;
+
+	if (!ili9325->standby)
+		return -EINVAL;
+
+	ili9325->standby = false;
+	regcache_cache_only(reg, false);
+
+	ret = regmap_update_bits(reg, 0x0010, BIT(0), 0);
+	if (ret)
+		return ret;
+
+	/* Wait for the power circuits to stabilize */
+	msleep(50);
+
+	ret = regcache_sync(reg);
+	if (ret)
+		return ret;
+
+	return regmap_write(reg, 0x0007, ili9325->display_ctrl);
+}
+EXPORT_SYMBOL(tinydrm_ili9325_wake);
+
+/**
+ * tinydrm_ili9325_enable_flush - Enable and flush the display
+ * @ili9325: tinydrm ILI9325 device
+ *
+ * Flushes the framebuffer and enables the backlight. Drivers call this at the
+ * end of their enable callback.
+ *
+ * If the controller kept its GRAM since it was disabled and the framebuffer
+ * has not changed, the display is already up to date and nothing is flushed.
+ */
+void tinydrm_ili9325_enable_flush(struct tinydrm_ili9325 *ili9325)
+{
+	struct tinydrm_device *tdev = &ili9325->tinydrm;
+	struct drm_framebuffer *fb = tdev->pipe.plane.fb;
+	bool retained;
+
+	mutex_lock(&tdev->dirty_lock);
+	retained = ili9325->retained && !ili9325->stale && fb &&
+		   fb == ili9325->last_fb;
+	ili9325->retained = false;
+	ili9325->stale = false;
+	ili9325->enabled = true;
+	mutex_unlock(&tdev->dirty_lock);
+
+	if (retained)
+		DRM_DEBUG_KMS("GRAM is up to date\n");
+	else if (fb)
+		fb->funcs->dirty(fb, NULL, 0, 0, NULL, 0);
+
+	tinydrm_enable_backlight(ili9325->backlight);
+}
+EXPORT_SYMBOL(tinydrm_ili9325_enable_flush);
+
+static int __maybe_unused tinydrm_ili9325_runtime_suspend(struct device *dev)
+{
+	struct drm_device *drm = dev_get_drvdata(dev);
+	struct tinydrm_ili9325 *ili9325 = tinydrm_to_ili9325(drm->dev_private);
+	int ret;
+
+	/* The next enable does a full initialization anyway */
+	if (!ili9325->retained)
+		return 0;
+
+	ret = tinydrm_ili9325_standby(ili9325);
+	if (ret) {
+		DRM_DEBUG_DRIVER("Failed to enter standby %d\n", ret);
+		ili9325->retained = false;
+	}
+
+	return 0;
+}
+
+static int __maybe_unused tinydrm_ili9325_runtime_resume(struct device *dev)
+{
+	struct drm_device *drm = dev_get_drvdata(dev);
+	struct tinydrm_ili9325 *ili9325 = tinydrm_to_ili9325(drm->dev_private);
+	int ret;
+
+	if (!ili9325->standby)
+		return 0;
+
+	ret = tinydrm_ili9325_wake(ili9325);
+	if (ret) {
+		DRM_DEBUG_DRIVER("Fast resume failed (%d), reinitializing\n",
+				 ret);
+		ili9325->retained = false;
+	}
+
+	return 0;
+}
+
+/**
+ * tinydrm_ili9325_pm_ops - Runtime PM operations
+ *
+ * Drivers using tinydrm_ili9325_init() set this as their &device_driver->pm.
+ * The controller is put in standby when it has been disabled for the
+ * autosuspend delay and woken up with tinydrm_ili9325_wake() on resume.
+ * Drivers skip the initialization in their enable callback if
+ * &tinydrm_ili9325->retained is still set.
+ */
+const struct dev_pm_ops tinydrm_ili9325_pm_ops = {
+	SET_RUNTIME_PM_OPS(tinydrm_ili9325_runtime_suspend,
+			   tinydrm_ili9325_runtime_resume, NULL)
+};
+EXPORT_SYMBOL(tinydrm_ili9325_pm_ops);
+
+static bool tinydrm_ili9325_volatile_reg(struct device *dev, unsigned int reg)
+{
+	switch (reg) {
+	case 0x0000: /* Driver Code Read */
+	case 0x0020: /* GRAM address, changed by GRAM access */
+	case 0x0021:
+	case 0x0022: /* GRAM data */
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool tinydrm_ili9325_readable_reg(struct device *dev, unsigned int reg)
+{
+	/* GRAM is accessed through the pixel stream */
+	return reg != 0x0022;
+}
+
+/*
+ * An rbtree cache is used instead of a flat one because it only holds the
+ * registers that have been written. regcache_sync() will then leave alone
+ * registers that still have their (undocumented) reset value, and the cache
+ * can be dropped on reset.
+ */
+static const struct regmap_config tinydrm_ili9325_regmap_config = {
+	.reg_bits = 16,
+	.val_bits = 16,
+	.max_register = 0xff,
+	.readable_reg = tinydrm_ili9325_readable_reg,
+	.volatile_reg = tinydrm_ili9325_volatile_reg,
+	.cache_type = REGCACHE_RBTREE,
+};
+
+/**
+ * tinydrm_ili9325_i80_init - Initialize an ILI9325 I80 bus regmap
+ * @dev: Device
+ * @cs: Chip Select gpio (optional).
+ * @idx: Index gpio (optional).
+ * @wr: Write latch gpio.
+ * @db: Databus gpio array.
+ * @stream: Pixel stream operation to fill in (optional)
+ *
+ * See tinydrm_i80_init().
+ *
+ * Returns ILI9325 I80 &regmap on success or ERR_PTR on failure.
+ */
+struct regmap *tinydrm_ili9325_i80_init(struct device *dev,
+					struct gpio_desc *cs,
+					struct gpio_desc *idx,
+					struct gpio_desc *wr,
+					struct gpio_descs *db,
+					struct tinydrm_regmap_stream *stream)
+{
+	return tinydrm_i80_init(dev, &tinydrm_ili9325_regmap_config, cs, idx,
+				wr, db, stream);
+}
+EXPORT_SYMBOL(tinydrm_ili9325_i80_init);
+
 #if IS_ENABLED(CONFIG_SPI)
 
 struct tinydrm_ili9325_spi {
 	struct spi_device *spi;
 	struct regmap *reg;
+	/* Serializes the stream operation with regmap bus access */
+	struct mutex lock;
+	/* DMA safe buffers */
+	u8 *startbyte;
+	u16 *regnr;
 	unsigned int bpw;
 	unsigned int id;
 };
@@ -202,30 +618,27 @@ static int tinydrm_ili9325_spi_gather_write(void *context, const void *reg,
 	/* For reliability only run pixel data above spec */
 	u32 norm_speed_hz = min_t(u32, 10000000, spih->spi->max_speed_hz);
 	struct spi_transfer header = {
+		.tx_buf = spih->startbyte,
 		.speed_hz = norm_speed_hz,
 		.bits_per_word = 8,
 		.len = 1,
 	};
-	u8 *startbyte;
 	int ret;
 
-	startbyte = kmalloc(1, GFP_KERNEL);
-	if (!startbyte)
-		return -ENOMEM;
+	mutex_lock(&spih->lock);
 
-	header.tx_buf = startbyte;
-	*startbyte = tinydrm_ili9325_spi_get_startbyte(spih->id, 0, false);
+	*spih->startbyte = tinydrm_ili9325_spi_get_startbyte(spih->id, 0, false);
 	ret = tinydrm_spi_transfer(spih->spi, norm_speed_hz, &header,
 				   spih->bpw, reg, reg_len);
 	if (ret)
-		goto err_free;
+		goto out_unlock;
 
-	*startbyte = tinydrm_ili9325_spi_get_startbyte(spih->id, 1, false);
+	*spih->startbyte = tinydrm_ili9325_spi_get_startbyte(spih->id, 1, false);
 	ret = tinydrm_spi_transfer(spih->spi, val_len > 64 ? 0 : norm_speed_hz,
 				   &header, spih->bpw, val, val_len);
 
-err_free:
-	kfree(startbyte);
+out_unlock:
+	mutex_unlock(&spih->lock);
 
 	return ret;
 }
@@ -273,12 +686,14 @@ static int tinydrm_ili9325_spi_read(void *context, const void *reg,
 		goto err_free;
 	}
 
+	mutex_lock(&spih->lock);
+
 	header.tx_buf = startbyte;
 	*startbyte = tinydrm_ili9325_spi_get_startbyte(spih->id, 0, false);
 	ret = tinydrm_spi_transfer(spi, speed_hz, &header, spih->bpw,
 				   reg, reg_len);
 	if (ret)
-		goto err_free;
+		goto err_unlock;
 
 	//tinydrm_ili9325_spi_set_header(spih, headerbuf, 1, true);
 	*startbyte = tinydrm_ili9325_spi_get_startbyte(spih->id, 1, true);
@@ -287,7 +702,7 @@ static int tinydrm_ili9325_spi_read(void *context, const void *reg,
 	spi_message_add_tail(&trrx, &m);
 	ret = spi_sync(spi, &m);
 	if (ret)
-		goto err_free;
+		goto err_unlock;
 
 	/* throw away dummy byte */
 	if (tinydrm_regmap_raw_swap_bytes(spih->reg))
@@ -295,6 +710,8 @@ static int tinydrm_ili9325_spi_read(void *context, const void *reg,
 	else
 		*((u16 *)val) = get_unaligned_be16(trrx.rx_buf + 1);
 
+err_unlock:
+	mutex_unlock(&spih->lock);
 err_free:
 	kfree(startbyte);
 	kfree(trrx.rx_buf);
@@ -302,6 +719,46 @@ err_free:
 	return ret;
 }
 
+/*
+ * Select the GRAM register once and hand the pixel buffer directly to
+ * tinydrm_spi_transfer() which splits it into max sized transfers, each
+ * preceded by the data startbyte.
+ */
+static int tinydrm_ili9325_spi_stream_write(void *context, unsigned int regnr,
+					    const void *buf, size_t len)
+{
+	struct tinydrm_ili9325_spi *spih = context;
+	u32 norm_speed_hz = min_t(u32, 10000000, spih->spi->max_speed_hz);
+	struct spi_transfer header = {
+		.tx_buf = spih->startbyte,
+		.speed_hz = norm_speed_hz,
+		.bits_per_word = 8,
+		.len = 1,
+	};
+	int ret;
+
+	mutex_lock(&spih->lock);
+
+	if (spih->bpw == 16)
+		*spih->regnr = regnr;
+	else
+		put_unaligned_be16(regnr, spih->regnr);
+
+	*spih->startbyte = tinydrm_ili9325_spi_get_startbyte(spih->id, 0, false);
+	ret = tinydrm_spi_transfer(spih->spi, norm_speed_hz, &header,
+				   spih->bpw, spih->regnr, 2);
+	if (ret)
+		goto out_unlock;
+
+	*spih->startbyte = tinydrm_ili9325_spi_get_startbyte(spih->id, 1, false);
+	ret = tinydrm_spi_transfer(spih->spi, 0, &header, spih->bpw, buf, len);
+
+out_unlock:
+	mutex_unlock(&spih->lock);
+
+	return ret;
+}
+
 static const struct regmap_bus tinydrm_ili9325_spi_bus = {
 	.write = tinydrm_ili9325_spi_write,
 	.gather_write = tinydrm_ili9325_spi_gather_write,
@@ -310,22 +767,32 @@ static const struct regmap_bus tinydrm_ili9325_spi_bus = {
 	.val_format_endian_default = REGMAP_ENDIAN_NATIVE,
 };
 
+/**
+ * tinydrm_ili9325_spi_init - Initialize an ILI9325 SPI bus regmap
+ * @spi: SPI device
+ * @id: Device ID bit in the startbyte
+ * @stream: Pixel stream operation to fill in (optional)
+ *
+ * Returns ILI9325 SPI &regmap on success or ERR_PTR on failure.
+ */
 struct regmap *tinydrm_ili9325_spi_init(struct spi_device *spi,
-					unsigned int id)
+					unsigned int id,
+					struct tinydrm_regmap_stream *stream)
 {
 	struct tinydrm_ili9325_spi *spih;
+	struct regmap_config config = tinydrm_ili9325_regmap_config;
 	struct device *dev = &spi->dev;
-	struct regmap_config config = {
-		.reg_bits = 16,
-		.val_bits = 16,
-		.max_register = 0xff,
-		.cache_type = REGCACHE_NONE,
-	};
 
 	spih = devm_kzalloc(dev, sizeof(*spih), GFP_KERNEL);
 	if (!spih)
 		return ERR_PTR(-ENOMEM);
 
+	spih->startbyte = devm_kmalloc(dev, 1, GFP_KERNEL);
+	spih->regnr = devm_kmalloc(dev, sizeof(*spih->regnr), GFP_KERNEL);
+	if (!spih->startbyte || !spih->regnr)
+		return ERR_PTR(-ENOMEM);
+
+	mutex_init(&spih->lock);
 	spih->spi = spi;
 	spih->bpw = 16;
 	spih->id = id;
@@ -338,6 +805,13 @@ struct regmap *tinydrm_ili9325_spi_init(struct spi_device *spi,
 
 	spih->reg = devm_regmap_init(dev, &tinydrm_ili9325_spi_bus, spih,
 				     &config);
+	if (IS_ERR(spih->reg))
+		return spih->reg;
+
+	if (stream) {
+		stream->write = tinydrm_ili9325_spi_stream_write;
+		stream->context = spih;
+	}
 
 	return spih->reg;
 }
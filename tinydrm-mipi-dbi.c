@@ -0,0 +1,1000 @@
+/*
+ * Copyright (C) 2018 The tinydrm contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/device.h>
+#include <linux/gpio/consumer.h>
+#include <linux/pm_runtime.h>
+#include <linux/property.h>
+#include <linux/slab.h>
+#include <linux/spi/spi.h>
+#include <video/mipi_display.h>
+
+#include <drm/drm_fb_cma_helper.h>
+#include <drm/drm_gem_cma_helper.h>
+#include <drm/drm_gem_framebuffer_helper.h>
+#include <drm/tinydrm/tinydrm-helpers2.h>
+#include <drm/tinydrm/tinydrm-mipi-dbi.h>
+
+/**
+ * DOC: overview
+ *
+ * This adds flush stages on top of &mipi_dbi: if the "hardware-scroll"
+ * device property is set, a vertically scrolled frame is detected using row
+ * hashes and shown by moving the hardware scroll start, sending only the
+ * revealed lines. The scroll offset is folded into all address windows.
+ *
+ * Scrolling requires a controller memory that has the same number of rows
+ * as the panel, and an address mode without row/column exchange.
+ *
+ * Pixels can also be sent as packed RGB444 which moves 25% fewer bytes than
+ * RGB565, either always or only during sustained large damage using a
+ * &tinydrm_bw_policy. In the adaptive case the exact RGB565 frame is sent
+ * when the content settles. Controllers that only take RGB666 can use that
+ * as the wire format. See tinydrm_mipi_dbi_set_wire_format().
+ *
+ * Overlay and cursor planes are composited into the pixels while they are
+ * sent, see &tinydrm_sw_plane. Hardware scrolling is not used while one of
+ * them is visible.
+ *
+ * Panels that share the SPI bus with a touch controller can limit how long a
+ * flush holds the bus and how much of it the flush takes, see
+ * &tinydrm_spi_qos.
+ */
+
+static void tinydrm_mipi_dbi_set_window(struct mipi_dbi *mipi,
+					unsigned int x1, unsigned int x2,
+					unsigned int y1, unsigned int y2)
+{
+	mipi_dbi_command(mipi, MIPI_DCS_SET_COLUMN_ADDRESS,
+			 (x1 >> 8) & 0xFF, x1 & 0xFF,
+			 ((x2 - 1) >> 8) & 0xFF, (x2 - 1) & 0xFF);
+	mipi_dbi_command(mipi, MIPI_DCS_SET_PAGE_ADDRESS,
+			 (y1 >> 8) & 0xFF, y1 & 0xFF,
+			 ((y2 - 1) >> 8) & 0xFF, (y2 - 1) & 0xFF);
+}
+
+/*
+ * RAMWR through &mipi_dbi->command would send packed pixels as 16-bit words
+ * and the pixels in one go. Must be called with &mipi_dbi->cmdlock held.
+ */
+static int tinydrm_mipi_dbi_start_write(struct tinydrm_mipi_dbi *tmipi)
+{
+	struct mipi_dbi *mipi = &tmipi->mipi;
+	struct spi_device *spi = mipi->spi;
+	int ret;
+
+	tmipi->cmd_buf[0] = MIPI_DCS_WRITE_MEMORY_START;
+	gpiod_set_value_cansleep(mipi->dc, 0);
+	ret = tinydrm_spi_transfer(spi, min_t(u32, 10000000,
+					      spi->max_speed_hz),
+				   NULL, 8, tmipi->cmd_buf, 1);
+	if (!ret)
+		gpiod_set_value_cansleep(mipi->dc, 1);
+
+	return ret;
+}
+
+/* Send pixels after RAMWR in chunks that let other devices use the bus */
+static int tinydrm_mipi_dbi_write_buf(struct tinydrm_mipi_dbi *tmipi,
+				      void *buf, size_t len, u8 bpw)
+{
+	struct mipi_dbi *mipi = &tmipi->mipi;
+	int ret;
+
+	mutex_lock(&mipi->cmdlock);
+	ret = tinydrm_mipi_dbi_start_write(tmipi);
+	if (!ret)
+		ret = tinydrm_spi_qos_transfer(&tmipi->qos, mipi->spi, 0, bpw,
+					       buf, len);
+	mutex_unlock(&mipi->cmdlock);
+
+	return ret;
+}
+
+/* Convert while sending so a full frame RGB666 buffer isn't needed */
+static int tinydrm_mipi_dbi_write_rgb666(struct tinydrm_mipi_dbi *tmipi,
+					 struct drm_framebuffer *fb,
+					 const struct drm_clip_rect *clip)
+{
+	size_t pitch = (clip->x2 - clip->x1) * 3;
+	struct mipi_dbi *mipi = &tmipi->mipi;
+	struct drm_mode_config *mode_config = &mipi->tinydrm.drm->mode_config;
+	struct drm_clip_rect chunk = *clip;
+	unsigned int chunk_rows;
+	size_t max_chunk;
+	int ret;
+
+	/* tx_buf is sized for a full RGB565 panel, @fb can be a video wall */
+	max_chunk = tinydrm_spi_max_transfer_size(mipi->spi,
+						  mode_config->min_width *
+						  mode_config->min_height * 2);
+	chunk_rows = max_t(size_t, max_chunk / pitch, 1);
+
+	mutex_lock(&mipi->cmdlock);
+
+	ret = tinydrm_mipi_dbi_start_write(tmipi);
+	while (!ret && chunk.y1 < clip->y2) {
+		chunk.y2 = min(chunk.y1 + chunk_rows, clip->y2);
+		ret = tinydrm_rgb666_buf_copy(mipi->tx_buf, tmipi->linebuf,
+					      fb, &chunk);
+		if (!ret)
+			tinydrm_sw_planes_blend(tmipi->sw_planes,
+						tmipi->num_sw_planes,
+						mipi->tx_buf, &chunk, 18, false);
+		if (!ret)
+			ret = tinydrm_spi_qos_transfer(&tmipi->qos, mipi->spi,
+						       0, 8, mipi->tx_buf,
+						       (chunk.y2 - chunk.y1) *
+						       pitch);
+		chunk.y1 = chunk.y2;
+	}
+
+	mutex_unlock(&mipi->cmdlock);
+
+	return ret;
+}
+
+static size_t tinydrm_mipi_dbi_pitch(const struct drm_clip_rect *clip,
+				     unsigned int bpp)
+{
+	unsigned int width = clip->x2 - clip->x1;
+
+	return bpp == 18 ? width * 3 : width * bpp / 8;
+}
+
+/* RGB666 is converted from @fb while sending, the others are sent from @tr */
+static int tinydrm_mipi_dbi_write_memory(struct tinydrm_mipi_dbi *tmipi,
+					 struct drm_framebuffer *fb, void *tr,
+					 const struct drm_clip_rect *clip,
+					 unsigned int bpp)
+{
+	size_t len = (clip->y2 - clip->y1) * tinydrm_mipi_dbi_pitch(clip, bpp);
+
+	switch (bpp) {
+	case 16:
+		/* 9-bit Type C goes through &mipi_dbi->command */
+		if (!tmipi->mipi.dc)
+			return mipi_dbi_command_buf(&tmipi->mipi,
+						    MIPI_DCS_WRITE_MEMORY_START,
+						    tr, len);
+		return tinydrm_mipi_dbi_write_buf(tmipi, tr, len,
+						  tmipi->mipi.swap_bytes ?
+						  8 : 16);
+	case 18:
+		return tinydrm_mipi_dbi_write_rgb666(tmipi, fb, clip);
+	default:
+		return tinydrm_mipi_dbi_write_buf(tmipi, tr, len, 8);
+	}
+}
+
+/* Send the @clip rows, split in two windows if they wrap */
+static int tinydrm_mipi_dbi_send(struct tinydrm_mipi_dbi *tmipi,
+				 struct drm_framebuffer *fb, void *tr,
+				 const struct drm_clip_rect *clip,
+				 unsigned int bpp)
+{
+	unsigned int rows = clip->y2 - clip->y1;
+	struct mipi_dbi *mipi = &tmipi->mipi;
+	unsigned int height = fb->height;
+	struct drm_clip_rect part = *clip;
+	unsigned int y1, first;
+	int ret;
+
+	y1 = (clip->y1 + tmipi->scroll_offset) % height;
+	first = min(rows, height - y1);
+	part.y2 = part.y1 + first;
+
+	tinydrm_mipi_dbi_set_window(mipi, clip->x1, clip->x2, y1, y1 + first);
+	ret = tinydrm_mipi_dbi_write_memory(tmipi, fb, tr, &part, bpp);
+	if (ret || first == rows)
+		return ret;
+
+	if (tr)
+		tr += first * tinydrm_mipi_dbi_pitch(clip, bpp);
+	part.y1 = part.y2;
+	part.y2 = clip->y2;
+
+	tinydrm_mipi_dbi_set_window(mipi, clip->x1, clip->x2, 0, rows - first);
+
+	return tinydrm_mipi_dbi_write_memory(tmipi, fb, tr, &part, bpp);
+}
+
+/* Only send SET_PIXEL_FORMAT when the wire format changes */
+static int tinydrm_mipi_dbi_switch_format(struct tinydrm_mipi_dbi *tmipi,
+					  unsigned int bpp)
+{
+	if (tmipi->cur_bpp == bpp)
+		return 0;
+
+	return tinydrm_mipi_dbi_set_pixel_format(tmipi, bpp);
+}
+
+static int tinydrm_mipi_dbi_set_scroll(struct tinydrm_mipi_dbi *tmipi,
+				       unsigned int offset,
+				       unsigned int height)
+{
+	unsigned int start;
+	int ret;
+
+	start = tmipi->scroll_reversed ? (height - offset) % height : offset;
+	ret = mipi_dbi_command(&tmipi->mipi, MIPI_DCS_SET_SCROLL_START,
+			       (start >> 8) & 0xFF, start & 0xFF);
+	if (!ret)
+		tmipi->scroll_offset = offset;
+
+	return ret;
+}
+
+/*
+ * If the whole frame is the previous one scrolled, move the scroll start
+ * and shrink @clip to the revealed lines.
+ */
+static int tinydrm_mipi_dbi_scroll(struct tinydrm_mipi_dbi *tmipi,
+				   struct drm_framebuffer *fb,
+				   struct drm_clip_rect *clip)
+{
+	struct drm_gem_cma_object *cma_obj = drm_fb_cma_get_gem_obj(fb, 0);
+	unsigned int y1 = clip->y1, y2 = clip->y2;
+	unsigned int height = fb->height;
+	unsigned int offset;
+	int dy, ret = 0;
+
+	/* Imported buffers would need CPU access around hashing */
+	if (cma_obj->base.import_attach) {
+		tmipi->hashes_valid = false;
+		return 0;
+	}
+
+	tinydrm_row_hashes(tmipi->next_hashes, cma_obj->vaddr, fb->pitches[0],
+			   fb->width * fb->format->cpp[0], y1, y2);
+
+	if (!tmipi->scroll_usable || !tmipi->hashes_valid ||
+	    clip->x1 || clip->x2 != fb->width || y1 || y2 != height)
+		goto out_update;
+
+	dy = tinydrm_find_vscroll(tmipi->sent_hashes, tmipi->next_hashes,
+				  0, height, height / 2);
+	if (!dy)
+		goto out_update;
+
+	offset = (tmipi->scroll_offset + height - dy) % height;
+	ret = tinydrm_mipi_dbi_set_scroll(tmipi, offset, height);
+	if (ret)
+		goto out_update;
+
+	DRM_DEBUG("Scrolled %d lines, offset=%u\n", dy, offset);
+
+	if (dy > 0)
+		clip->y2 = dy;
+	else
+		clip->y1 = height + dy;
+
+out_update:
+	memcpy(tmipi->sent_hashes + y1, tmipi->next_hashes + y1,
+	       (y2 - y1) * sizeof(u64));
+	if (!y1 && y2 == height && clip->x1 == 0 && clip->x2 == fb->width)
+		tmipi->hashes_valid = true;
+
+	return ret;
+}
+
+static int tinydrm_mipi_dbi_fb_dirty(struct drm_framebuffer *fb,
+				     struct drm_file *file_priv,
+				     unsigned int flags, unsigned int color,
+				     struct drm_clip_rect *clips,
+				     unsigned int num_clips)
+{
+	struct drm_gem_cma_object *cma_obj = drm_fb_cma_get_gem_obj(fb, 0);
+	struct tinydrm_device *tdev = fb->dev->dev_private;
+	struct mipi_dbi *mipi = mipi_dbi_from_tinydrm(tdev);
+	struct tinydrm_mipi_dbi *tmipi = mipi_to_tinydrm_mipi_dbi(mipi);
+	bool swap = mipi->swap_bytes;
+	unsigned int bpp = tmipi->bpp;
+	struct drm_clip_rect screen = { 0, 0, fb->width, fb->height };
+	struct drm_clip_rect clip;
+	bool full, large, reduced;
+	int ret = 0;
+	void *tr;
+
+	mutex_lock(&tdev->dirty_lock);
+
+	if (!mipi->enabled) {
+		tmipi->stale = true;
+		goto out_unlock;
+	}
+
+	/* fbdev can flush even when we're not interested */
+	if (tdev->pipe.plane.fb != fb)
+		goto out_unlock;
+
+	full = tinydrm_merge_clips(&clip, clips, num_clips, flags,
+				   fb->width, fb->height);
+
+	DRM_DEBUG("Flushing [FB:%d] x1=%u, x2=%u, y1=%u, y2=%u\n", fb->base.id,
+		  clip.x1, clip.x2, clip.y1, clip.y2);
+
+	large = (clip.x2 - clip.x1) * (clip.y2 - clip.y1) * 2 >=
+		fb->width * fb->height;
+	reduced = tinydrm_bw_policy_begin(&tmipi->policy, large);
+	if (reduced)
+		bpp = 12;
+
+	/* Scrolling would move the planes along with the content */
+	if (tmipi->hw_scroll &&
+	    tinydrm_sw_planes_overlap(tmipi->sw_planes, tmipi->num_sw_planes,
+				      &screen)) {
+		tmipi->hashes_valid = false;
+	} else if (tmipi->hw_scroll) {
+		ret = tinydrm_mipi_dbi_scroll(tmipi, fb, &clip);
+		if (ret)
+			goto out_end;
+	}
+
+	/* Replace what was sent in the reduced format */
+	if (!reduced && tmipi->policy.lossy) {
+		clip.x1 = 0;
+		clip.x2 = fb->width;
+		clip.y1 = 0;
+		clip.y2 = fb->height;
+	}
+
+	/* RGB444 packs two pixels in three bytes */
+	if (bpp == 12) {
+		clip.x1 &= ~1;
+		clip.x2 = min_t(unsigned int, ALIGN(clip.x2, 2), fb->width);
+		if ((clip.x2 - clip.x1) & 1)
+			bpp = 16;
+	}
+
+	/* The planes are blended into RGB565 or RGB666 */
+	if (bpp == 12 &&
+	    tinydrm_sw_planes_overlap(tmipi->sw_planes, tmipi->num_sw_planes,
+				      &clip))
+		bpp = 16;
+
+	full = !clip.x1 && clip.x2 == fb->width &&
+	       !clip.y1 && clip.y2 == fb->height;
+
+	ret = tinydrm_mipi_dbi_switch_format(tmipi, bpp);
+	if (ret)
+		goto out_end;
+
+	tr = mipi->tx_buf;
+	if (bpp == 18)
+		tr = NULL;
+	else if (bpp == 12)
+		ret = tinydrm_rgb444_buf_copy(mipi->tx_buf, tmipi->linebuf,
+					      fb, &clip);
+	else if (!mipi->dc || !full || swap ||
+		 fb->format->format == DRM_FORMAT_XRGB8888 ||
+		 tinydrm_sw_planes_overlap(tmipi->sw_planes,
+					   tmipi->num_sw_planes, &clip))
+		ret = mipi_dbi_buf_copy(mipi->tx_buf, fb, &clip, swap);
+	else
+		tr = cma_obj->vaddr;
+	if (ret)
+		goto out_end;
+
+	if (bpp == 16 && tr == mipi->tx_buf)
+		tinydrm_sw_planes_blend(tmipi->sw_planes, tmipi->num_sw_planes,
+					tr, &clip, 16, swap);
+
+	ret = tinydrm_mipi_dbi_send(tmipi, fb, tr, &clip, bpp);
+
+out_end:
+	tinydrm_bw_policy_end(&tmipi->policy, reduced && bpp == 12,
+			      full && !ret);
+	/* The reference keeps a new framebuffer from reusing the pointer */
+	drm_framebuffer_assign(&tmipi->last_fb, ret ? NULL : fb);
+
+out_unlock:
+	if (ret)
+		tmipi->hashes_valid = false;
+
+	mutex_unlock(&tdev->dirty_lock);
+
+	if (ret)
+		dev_err_once(fb->dev->dev, "Failed to update display %d\n",
+			     ret);
+
+	return ret;
+}
+
+static const struct drm_framebuffer_funcs tinydrm_mipi_dbi_fb_funcs = {
+	.destroy	= drm_gem_fb_destroy,
+	.create_handle	= drm_gem_fb_create_handle,
+	.dirty		= tinydrm_mipi_dbi_fb_dirty,
+};
+
+static struct tinydrm_mipi_dbi *
+pipe_to_tinydrm_mipi_dbi(struct drm_simple_display_pipe *pipe)
+{
+	struct tinydrm_device *tdev = pipe_to_tinydrm(pipe);
+
+	return mipi_to_tinydrm_mipi_dbi(mipi_dbi_from_tinydrm(tdev));
+}
+
+/* Runs from the deferred init worker */
+static void
+tinydrm_mipi_dbi_deferred_enable(struct drm_simple_display_pipe *pipe,
+				 struct drm_crtc_state *crtc_state)
+{
+	struct tinydrm_mipi_dbi *tmipi = pipe_to_tinydrm_mipi_dbi(pipe);
+	struct device *dev = tmipi->mipi.tinydrm.drm->dev;
+	int ret;
+
+	ret = pm_runtime_get_sync(dev);
+	if (ret < 0)
+		DRM_DEV_ERROR(dev, "Failed to resume (%d)\n", ret);
+
+	tmipi->funcs->enable(pipe, crtc_state);
+}
+
+/* Runs before the framebuffers are torn down */
+static void tinydrm_mipi_dbi_release_last_fb(void *data)
+{
+	struct tinydrm_mipi_dbi *tmipi = data;
+
+	drm_framebuffer_assign(&tmipi->last_fb, NULL);
+}
+
+static void tinydrm_mipi_dbi_pipe_enable(struct drm_simple_display_pipe *pipe,
+					 struct drm_crtc_state *crtc_state)
+{
+	drm_crtc_vblank_on(&pipe->crtc);
+	tinydrm_deferred_enable(&pipe_to_tinydrm_mipi_dbi(pipe)->dinit);
+}
+
+static void tinydrm_mipi_dbi_power_off(struct tinydrm_mipi_dbi *tmipi)
+{
+	struct mipi_dbi *mipi = &tmipi->mipi;
+	struct device *dev = mipi->tinydrm.drm->dev;
+	bool enabled;
+
+	enabled = mipi->enabled;
+	tmipi->funcs->disable(&mipi->tinydrm.pipe);
+	/* Registers and GRAM survive unless the power was cut */
+	tmipi->retained = enabled && !mipi->regulator;
+	if (!tmipi->retained)
+		tmipi->cur_bpp = 0;
+
+	pm_runtime_mark_last_busy(dev);
+	pm_runtime_put_autosuspend(dev);
+}
+
+static void tinydrm_mipi_dbi_pipe_disable(struct drm_simple_display_pipe *pipe)
+{
+	struct tinydrm_mipi_dbi *tmipi = pipe_to_tinydrm_mipi_dbi(pipe);
+
+	drm_crtc_vblank_off(&pipe->crtc);
+	tinydrm_deferred_wait(&tmipi->dinit);
+	tinydrm_mipi_dbi_power_off(tmipi);
+}
+
+static struct tinydrm_mipi_dbi *
+tile_to_tinydrm_mipi_dbi(struct tinydrm_wall_tile *tile)
+{
+	return container_of(tile, struct tinydrm_mipi_dbi, tile);
+}
+
+/* The panel's own pipe is never enabled when it's part of a video wall */
+static void tinydrm_mipi_dbi_tile_enable(struct tinydrm_wall_tile *tile)
+{
+	struct tinydrm_mipi_dbi *tmipi = tile_to_tinydrm_mipi_dbi(tile);
+
+	tinydrm_mipi_dbi_deferred_enable(&tmipi->mipi.tinydrm.pipe, NULL);
+}
+
+static void tinydrm_mipi_dbi_tile_disable(struct tinydrm_wall_tile *tile)
+{
+	tinydrm_mipi_dbi_power_off(tile_to_tinydrm_mipi_dbi(tile));
+}
+
+static int tinydrm_mipi_dbi_tile_flush(struct tinydrm_wall_tile *tile,
+				       struct drm_framebuffer *fb,
+				       struct drm_clip_rect *clip)
+{
+	struct tinydrm_mipi_dbi *tmipi = tile_to_tinydrm_mipi_dbi(tile);
+	struct mipi_dbi *mipi = &tmipi->mipi;
+	unsigned int bpp = tmipi->bpp == 18 ? 18 : 16;
+	int ret = 0;
+
+	mutex_lock(&mipi->tinydrm.dirty_lock);
+
+	if (!mipi->enabled)
+		goto out_unlock;
+
+	if (bpp == 16)
+		ret = tinydrm_rgb565_buf_copy(mipi->tx_buf, fb, clip,
+					      mipi->swap_bytes);
+	if (!ret)
+		ret = tinydrm_mipi_dbi_switch_format(tmipi, bpp);
+	if (ret)
+		goto out_unlock;
+
+	tinydrm_mipi_dbi_set_window(mipi, clip->x1 - tile->x,
+				    clip->x2 - tile->x, clip->y1 - tile->y,
+				    clip->y2 - tile->y);
+	ret = tinydrm_mipi_dbi_write_memory(tmipi, fb, mipi->tx_buf, clip, bpp);
+
+out_unlock:
+	mutex_unlock(&mipi->tinydrm.dirty_lock);
+
+	return ret;
+}
+
+static const struct tinydrm_wall_tile_funcs tinydrm_mipi_dbi_tile_funcs = {
+	.enable = tinydrm_mipi_dbi_tile_enable,
+	.disable = tinydrm_mipi_dbi_tile_disable,
+	.flush = tinydrm_mipi_dbi_tile_flush,
+};
+
+static void tinydrm_mipi_dbi_restore(struct tinydrm_bw_policy *policy)
+{
+	struct tinydrm_mipi_dbi *tmipi = container_of(policy,
+						      struct tinydrm_mipi_dbi,
+						      policy);
+	struct tinydrm_device *tdev = &tmipi->mipi.tinydrm;
+	struct drm_framebuffer *fb;
+
+	mutex_lock(&tdev->dirty_lock);
+	fb = tdev->pipe.plane.fb;
+	if (fb && tinydrm_bw_policy_restore_needed(policy))
+		drm_framebuffer_get(fb);
+	else
+		fb = NULL;
+	mutex_unlock(&tdev->dirty_lock);
+
+	/* A flush that isn't reduced sends the whole frame while lossy */
+	if (fb) {
+		fb->funcs->dirty(fb, NULL, 0, 0, NULL, 0);
+		drm_framebuffer_put(fb);
+	}
+}
+
+static int tinydrm_mipi_dbi_pipe_init(struct tinydrm_mipi_dbi *tmipi)
+{
+	struct drm_simple_display_pipe *pipe = &tmipi->mipi.tinydrm.pipe;
+	int ret;
+
+	ret = tinydrm_plane_enable_fb_damage_clips(&pipe->plane);
+	if (ret)
+		return ret;
+
+	ret = tinydrm_vblank_emulation_init(&pipe->crtc);
+	if (ret)
+		return ret;
+
+	ret = tinydrm_flip_queue_init(pipe);
+	if (ret)
+		return ret;
+
+	ret = tinydrm_sw_planes_init(tmipi->sw_planes, pipe);
+	if (ret < 0)
+		return ret;
+	tmipi->num_sw_planes = ret;
+
+	return 0;
+}
+
+/**
+ * tinydrm_mipi_dbi_init - MIPI DBI initialization with extra flush stages
+ * @dev: Parent device
+ * @tmipi: &tinydrm_mipi_dbi structure to initialize
+ * @pipe_funcs: Display pipe functions
+ * @driver: DRM driver
+ * @mode: Display mode
+ * @rotation: Initial rotation in degrees Counter Clock Wise
+ *
+ * Same as mipi_dbi_init(), but framebuffers are flushed using the stages
+ * described in the overview. The @pipe_funcs enable callback is run from a
+ * worker so modesets, and the initial one during registration, don't wait
+ * for the panel reset and initialization sleeps. Runtime PM is enabled and
+ * idle panels are put in sleep mode, see &tinydrm_mipi_dbi_pm_ops.
+ *
+ * Vblank emulation, the flip queue and the software planes are only set up
+ * for a standalone panel. A video wall tile, see tinydrm_wall_is_tile(),
+ * never registers its own DRM device so it doesn't get them.
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int tinydrm_mipi_dbi_init(struct device *dev, struct tinydrm_mipi_dbi *tmipi,
+			  const struct drm_simple_display_pipe_funcs *pipe_funcs,
+			  struct drm_driver *driver,
+			  const struct drm_display_mode *mode,
+			  unsigned int rotation)
+{
+	unsigned int rows = max(mode->hdisplay, mode->vdisplay);
+	struct drm_simple_display_pipe_funcs *funcs;
+	int ret;
+
+	funcs = devm_kmemdup(dev, pipe_funcs, sizeof(*funcs), GFP_KERNEL);
+	if (!funcs)
+		return -ENOMEM;
+
+	funcs->enable = tinydrm_mipi_dbi_pipe_enable;
+	funcs->disable = tinydrm_mipi_dbi_pipe_disable;
+	tmipi->funcs = pipe_funcs;
+
+	ret = mipi_dbi_init(dev, &tmipi->mipi, funcs, driver, mode, rotation);
+	if (ret)
+		return ret;
+
+	ret = devm_add_action(dev, tinydrm_mipi_dbi_release_last_fb, tmipi);
+	if (ret)
+		return ret;
+
+	/* A video wall tile is flushed by the wall, its own pipe is never used */
+	if (!tinydrm_wall_is_tile(dev)) {
+		ret = tinydrm_mipi_dbi_pipe_init(tmipi);
+		if (ret)
+			return ret;
+	}
+
+	ret = devm_tinydrm_deferred_init(dev, &tmipi->dinit,
+					 &tmipi->mipi.tinydrm.pipe, NULL,
+					 tinydrm_mipi_dbi_deferred_enable);
+	if (ret)
+		return ret;
+
+	/* The runtime PM callbacks need it before the driver sets it */
+	dev_set_drvdata(dev, &tmipi->mipi);
+	ret = devm_tinydrm_runtime_pm_init(dev);
+	if (ret)
+		return ret;
+
+	/* The line buffer covers both rotations */
+	tmipi->cmd_buf = devm_kmalloc(dev, 1, GFP_KERNEL);
+	tmipi->linebuf = devm_kmalloc_array(dev, rows, 4, GFP_KERNEL);
+	if (!tmipi->cmd_buf || !tmipi->linebuf)
+		return -ENOMEM;
+
+	tmipi->mipi.tinydrm.fb_funcs = &tinydrm_mipi_dbi_fb_funcs;
+	tmipi->bpp = 16;
+	tmipi->cur_bpp = 16;
+	tmipi->keep_alive = device_property_read_bool(dev, "keep-alive");
+	tinydrm_spi_qos_init(dev, &tmipi->qos);
+
+	ret = devm_tinydrm_bw_policy_init(dev, &tmipi->policy,
+					  tinydrm_mipi_dbi_restore);
+	if (ret)
+		return ret;
+
+	tmipi->hw_scroll = device_property_read_bool(dev, "hardware-scroll");
+	if (!tmipi->hw_scroll)
+		return 0;
+
+	tmipi->sent_hashes = devm_kcalloc(dev, rows, sizeof(u64), GFP_KERNEL);
+	tmipi->next_hashes = devm_kcalloc(dev, rows, sizeof(u64), GFP_KERNEL);
+	if (!tmipi->sent_hashes || !tmipi->next_hashes)
+		return -ENOMEM;
+
+	return 0;
+}
+EXPORT_SYMBOL(tinydrm_mipi_dbi_init);
+
+/**
+ * tinydrm_mipi_dbi_set_wire_format - Set the pixel format used on the bus
+ * @tmipi: tinydrm MIPI DBI structure
+ * @bpp: Bits per pixel, 16 (RGB565), 12 (packed RGB444) or 18 (RGB666)
+ * @adaptive: Use RGB444 during heavy motion when @bpp is 16
+ *
+ * RGB444 and RGB666 are sent as a byte stream bypassing &mipi_dbi->command,
+ * so they need a MIPI DBI Type C Option 3 interface. The controller must
+ * support the pixel format. Call this before registering the device.
+ *
+ * RGB666 is converted in chunks while sending. Drivers for controllers that
+ * only take RGB666 should call tinydrm_mipi_dbi_set_pixel_format() from
+ * their enable callback instead of setting the format themselves.
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int tinydrm_mipi_dbi_set_wire_format(struct tinydrm_mipi_dbi *tmipi,
+				     unsigned int bpp, bool adaptive)
+{
+	if (bpp != 16 && bpp != 12 && bpp != 18)
+		return -EINVAL;
+
+	if ((bpp != 16 || adaptive) && (!tmipi->mipi.spi || !tmipi->mipi.dc))
+		return -EINVAL;
+
+	tmipi->bpp = bpp;
+	tmipi->policy.adaptive = adaptive && bpp == 16;
+
+	return 0;
+}
+EXPORT_SYMBOL(tinydrm_mipi_dbi_set_wire_format);
+
+static u8 tinydrm_mipi_dbi_dcs_format(unsigned int bpp)
+{
+	switch (bpp) {
+	case 12:
+		return MIPI_DCS_PIXEL_FMT_12BIT;
+	case 16:
+		return MIPI_DCS_PIXEL_FMT_16BIT;
+	case 18:
+		return MIPI_DCS_PIXEL_FMT_18BIT;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * tinydrm_mipi_dbi_set_pixel_format - Set controller pixel format
+ * @tmipi: tinydrm MIPI DBI structure
+ * @bpp: Bits per pixel: 12, 16 or 18
+ *
+ * Sends MIPI_DCS_SET_PIXEL_FORMAT and records the format so the flush stage
+ * knows what the controller expects.
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int tinydrm_mipi_dbi_set_pixel_format(struct tinydrm_mipi_dbi *tmipi,
+				      unsigned int bpp)
+{
+	u8 fmt = tinydrm_mipi_dbi_dcs_format(bpp);
+	int ret;
+
+	if (!fmt)
+		return -EINVAL;
+
+	/* Some controllers only look at the DPI or the DBI field */
+	ret = mipi_dbi_command(&tmipi->mipi, MIPI_DCS_SET_PIXEL_FORMAT,
+			       fmt << 4 | fmt);
+	if (!ret)
+		tmipi->cur_bpp = bpp;
+
+	return ret;
+}
+EXPORT_SYMBOL(tinydrm_mipi_dbi_set_pixel_format);
+
+/**
+ * tinydrm_mipi_dbi_add_tile - Add the panel to a video wall
+ * @tmipi: tinydrm MIPI DBI structure
+ *
+ * Drivers call this instead of devm_tinydrm_register() when
+ * tinydrm_wall_is_tile() says the panel is part of a video wall. The panel
+ * is then flushed by the wall in RGB565, or RGB666 if that's the wire format.
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int tinydrm_mipi_dbi_add_tile(struct tinydrm_mipi_dbi *tmipi)
+{
+	struct drm_device *drm = tmipi->mipi.tinydrm.drm;
+
+	tmipi->tile.funcs = &tinydrm_mipi_dbi_tile_funcs;
+	tmipi->tile.width = drm->mode_config.min_width;
+	tmipi->tile.height = drm->mode_config.min_height;
+
+	return devm_tinydrm_wall_tile_add(drm->dev, &tmipi->tile);
+}
+EXPORT_SYMBOL(tinydrm_mipi_dbi_add_tile);
+
+/**
+ * tinydrm_mipi_dbi_set_address_mode - Set address mode
+ * @tmipi: tinydrm MIPI DBI structure
+ * @addr_mode: MIPI_DCS_SET_ADDRESS_MODE value
+ *
+ * Drivers should use this instead of sending the command so the flush
+ * stages know whether hardware scrolling can be used.
+ */
+void tinydrm_mipi_dbi_set_address_mode(struct tinydrm_mipi_dbi *tmipi,
+				       u8 addr_mode)
+{
+	mipi_dbi_command(&tmipi->mipi, MIPI_DCS_SET_ADDRESS_MODE, addr_mode);
+	tmipi->scroll_usable = !(addr_mode & MIPI_DBI_MADCTL_MV);
+	tmipi->scroll_reversed = addr_mode & MIPI_DBI_MADCTL_MY;
+}
+EXPORT_SYMBOL(tinydrm_mipi_dbi_set_address_mode);
+
+/* MIPI_DCS_GET_POWER_MODE: Sleep Out and Display On */
+#define TINYDRM_DCS_POWER_MODE_ON	(BIT(4) | BIT(2))
+
+/**
+ * tinydrm_mipi_dbi_keep_alive - Take over the panel as left by the bootloader
+ * @tmipi: tinydrm MIPI DBI structure
+ * @addr_mode: Expected address mode, negative if unknown
+ * @bpp: Expected pixel format, zero if unknown
+ *
+ * Panels with the "keep-alive" DT property are not reset and initialized on
+ * the first enable, keeping the splash screen and saving the init delays.
+ * If the controller can be read, it has to be awake with the display on and
+ * the pixel format and address mode must match, otherwise the panel is
+ * initialized as usual.
+ *
+ * Later enables skip the initialization if the panel kept its configuration
+ * since the last disable, only waking it with sleep out.
+ *
+ * Drivers call this from their enable callback before the reset.
+ *
+ * Returns:
+ * True if the reset and initialization should be skipped.
+ */
+bool tinydrm_mipi_dbi_keep_alive(struct tinydrm_mipi_dbi *tmipi,
+				 int addr_mode, unsigned int bpp)
+{
+	struct mipi_dbi *mipi = &tmipi->mipi;
+	u8 val;
+
+	if (tmipi->retained)
+		return true;
+
+	if (!tmipi->keep_alive)
+		return false;
+
+	tmipi->keep_alive = false;
+
+	if (!mipi->read_commands)
+		return true;
+
+	if (mipi_dbi_command_read(mipi, MIPI_DCS_GET_POWER_MODE, &val) ||
+	    (val & TINYDRM_DCS_POWER_MODE_ON) != TINYDRM_DCS_POWER_MODE_ON)
+		goto err_init;
+
+	if (bpp && (mipi_dbi_command_read(mipi, MIPI_DCS_GET_PIXEL_FORMAT,
+					  &val) ||
+		    (val & 0x7) != tinydrm_mipi_dbi_dcs_format(bpp)))
+		goto err_init;
+
+	if (addr_mode >= 0 &&
+	    (mipi_dbi_command_read(mipi, MIPI_DCS_GET_ADDRESS_MODE, &val) ||
+	     val != addr_mode))
+		goto err_init;
+
+	DRM_DEBUG_KMS("Keeping panel configuration\n");
+
+	return true;
+
+err_init:
+	DRM_DEBUG_KMS("Panel is not configured, initializing\n");
+
+	return false;
+}
+EXPORT_SYMBOL(tinydrm_mipi_dbi_keep_alive);
+
+/**
+ * tinydrm_mipi_dbi_enable_flush - Enable and flush the display
+ * @tmipi: tinydrm MIPI DBI structure
+ *
+ * Resets the scroll state, flushes the framebuffer and enables the
+ * backlight. Drivers call this at the end of their enable callback.
+ *
+ * If the panel kept its GRAM since it was disabled and the framebuffer has
+ * not changed, the display is already up to date and nothing is flushed.
+ */
+void tinydrm_mipi_dbi_enable_flush(struct tinydrm_mipi_dbi *tmipi)
+{
+	struct mipi_dbi *mipi = &tmipi->mipi;
+	struct tinydrm_device *tdev = &mipi->tinydrm;
+	struct drm_framebuffer *fb = tdev->pipe.plane.fb;
+	unsigned int height = tdev->drm->mode_config.min_height;
+	bool retained;
+
+	mutex_lock(&tdev->dirty_lock);
+	retained = tmipi->retained && !tmipi->stale && fb &&
+		   fb == tmipi->last_fb && !tmipi->policy.lossy;
+	tmipi->retained = false;
+	tmipi->stale = false;
+	mutex_unlock(&tdev->dirty_lock);
+
+	if (retained) {
+		DRM_DEBUG_KMS("GRAM is up to date\n");
+		mipi->enabled = true;
+		goto out_backlight;
+	}
+
+	tmipi->hashes_valid = false;
+	tmipi->scroll_offset = 0;
+	if (tmipi->hw_scroll && tmipi->scroll_usable) {
+		mipi_dbi_command(mipi, MIPI_DCS_SET_SCROLL_AREA, 0x00, 0x00,
+				 (height >> 8) & 0xFF, height & 0xFF,
+				 0x00, 0x00);
+		tinydrm_mipi_dbi_set_scroll(tmipi, 0, height);
+	}
+
+	mipi->enabled = true;
+	if (fb)
+		fb->funcs->dirty(fb, NULL, 0, 0, NULL, 0);
+
+out_backlight:
+	tinydrm_enable_backlight(mipi->backlight);
+}
+EXPORT_SYMBOL(tinydrm_mipi_dbi_enable_flush);
+
+static int __maybe_unused tinydrm_mipi_dbi_runtime_suspend(struct device *dev)
+{
+	struct mipi_dbi *mipi = dev_get_drvdata(dev);
+	struct tinydrm_mipi_dbi *tmipi = mipi_to_tinydrm_mipi_dbi(mipi);
+
+	/* The next enable does a full initialization anyway */
+	if (!tmipi->retained)
+		return 0;
+
+	mipi_dbi_command(mipi, MIPI_DCS_SET_DISPLAY_OFF);
+	if (mipi_dbi_command(mipi, MIPI_DCS_ENTER_SLEEP_MODE)) {
+		tmipi->retained = false;
+		tmipi->cur_bpp = 0;
+	} else {
+		tmipi->sleeping = true;
+	}
+
+	return 0;
+}
+
+static int __maybe_unused tinydrm_mipi_dbi_runtime_resume(struct device *dev)
+{
+	struct mipi_dbi *mipi = dev_get_drvdata(dev);
+	struct tinydrm_mipi_dbi *tmipi = mipi_to_tinydrm_mipi_dbi(mipi);
+
+	if (!tmipi->sleeping)
+		return 0;
+
+	tmipi->sleeping = false;
+	if (mipi_dbi_command(mipi, MIPI_DCS_EXIT_SLEEP_MODE)) {
+		tmipi->retained = false;
+		tmipi->cur_bpp = 0;
+		return 0;
+	}
+
+	/* Commands can be sent 5ms after Sleep Out */
+	usleep_range(5000, 10000);
+
+	return 0;
+}
+
+/**
+ * tinydrm_mipi_dbi_pm_ops - Runtime PM operations
+ *
+ * Drivers using tinydrm_mipi_dbi_init() set this as their &device_driver->pm.
+ * The panel is put in sleep mode when it has been disabled for the
+ * autosuspend delay. On wake it only gets sleep out since the configuration
+ * and GRAM are retained.
+ */
+const struct dev_pm_ops tinydrm_mipi_dbi_pm_ops = {
+	SET_RUNTIME_PM_OPS(tinydrm_mipi_dbi_runtime_suspend,
+			   tinydrm_mipi_dbi_runtime_resume, NULL)
+};
+EXPORT_SYMBOL(tinydrm_mipi_dbi_pm_ops);
+
+#ifdef CONFIG_DEBUG_FS
+
+/**
+ * tinydrm_mipi_dbi_debugfs_init - Create debugfs entries
+ * @minor: DRM minor
+ *
+ * Drivers can use this as their &drm_driver->debugfs_init callback. It adds
+ * the &tinydrm_bw_policy and &tinydrm_spi_qos files to the
+ * mipi_dbi_debugfs_init() ones.
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int tinydrm_mipi_dbi_debugfs_init(struct drm_minor *minor)
+{
+	struct tinydrm_device *tdev = minor->dev->dev_private;
+	struct mipi_dbi *mipi = mipi_dbi_from_tinydrm(tdev);
+	struct tinydrm_mipi_dbi *tmipi = mipi_to_tinydrm_mipi_dbi(mipi);
+	int ret;
+
+	ret = mipi_dbi_debugfs_init(minor);
+	if (ret)
+		return ret;
+
+	tinydrm_bw_policy_debugfs_init(&tmipi->policy, minor->debugfs_root);
+	tinydrm_spi_qos_debugfs_init(&tmipi->qos, minor->debugfs_root);
+
+	return 0;
+}
+EXPORT_SYMBOL(tinydrm_mipi_dbi_debugfs_init);
+
+#endif
@@ -0,0 +1,821 @@
+/*
+ * Copyright (C) 2018 The tinydrm contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/gpio/consumer.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/property.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+
+#include <drm/drmP.h>
+#include <drm/drm_atomic_helper.h>
+#include <drm/drm_modeset_helper_vtables.h>
+#include <drm/drm_simple_kms_helper.h>
+#include <drm/tinydrm/tinydrm.h>
+#include <drm/tinydrm/tinydrm-helpers2.h>
+
+/*
+
+	This should be added to tinydrm-pipe.c
+
+*/
+
+/**
+ * DOC: Damage clips
+ *
+ * This is a backport of the plane FB_DAMAGE_CLIPS property so atomic clients
+ * can pass the area that changed with each commit, instead of a full flush
+ * on every page flip. The property blob is an array of &tinydrm_mode_rect in
+ * framebuffer coordinates, the same layout as &drm_mode_rect in newer
+ * kernels. Like upstream, the damage is not carried over to the next commit.
+ *
+ * Drivers call tinydrm_plane_enable_fb_damage_clips() after the display pipe
+ * is initialized and use tinydrm_display_pipe_damage_update() as their
+ * &drm_simple_display_pipe_funcs->update callback. The damage is passed on
+ * to the framebuffer dirty callback, so it's flushed like DIRTYFB clips.
+ */
+
+struct tinydrm_damage_plane_state {
+	struct drm_plane_state base;
+	struct drm_property_blob *fb_damage_clips;
+};
+
+static inline struct tinydrm_damage_plane_state *
+to_tinydrm_damage_plane_state(struct drm_plane_state *state)
+{
+	return container_of(state, struct tinydrm_damage_plane_state, base);
+}
+
+struct tinydrm_damage_plane {
+	struct drm_plane_funcs funcs;
+	struct drm_property *prop;
+};
+
+static inline struct tinydrm_damage_plane *
+plane_to_tinydrm_damage_plane(struct drm_plane *plane)
+{
+	return container_of(plane->funcs, struct tinydrm_damage_plane, funcs);
+}
+
+static void tinydrm_damage_plane_destroy_state(struct drm_plane *plane,
+					       struct drm_plane_state *state)
+{
+	struct tinydrm_damage_plane_state *dstate =
+		to_tinydrm_damage_plane_state(state);
+
+	__drm_atomic_helper_plane_destroy_state(state);
+	drm_property_blob_put(dstate->fb_damage_clips);
+	kfree(dstate);
+}
+
+static void tinydrm_damage_plane_reset(struct drm_plane *plane)
+{
+	struct tinydrm_damage_plane_state *dstate;
+
+	if (plane->state)
+		tinydrm_damage_plane_destroy_state(plane, plane->state);
+
+	dstate = kzalloc(sizeof(*dstate), GFP_KERNEL);
+	if (!dstate) {
+		plane->state = NULL;
+		return;
+	}
+
+	dstate->base.plane = plane;
+	dstate->base.rotation = DRM_MODE_ROTATE_0;
+	plane->state = &dstate->base;
+}
+
+static struct drm_plane_state *
+tinydrm_damage_plane_duplicate_state(struct drm_plane *plane)
+{
+	struct tinydrm_damage_plane_state *dstate;
+
+	if (WARN_ON(!plane->state))
+		return NULL;
+
+	/* Damage belongs to a single commit, so it's not copied */
+	dstate = kzalloc(sizeof(*dstate), GFP_KERNEL);
+	if (!dstate)
+		return NULL;
+
+	__drm_atomic_helper_plane_duplicate_state(plane, &dstate->base);
+
+	return &dstate->base;
+}
+
+static int tinydrm_damage_plane_set_property(struct drm_plane *plane,
+					     struct drm_plane_state *state,
+					     struct drm_property *property,
+					     uint64_t val)
+{
+	struct tinydrm_damage_plane_state *dstate =
+		to_tinydrm_damage_plane_state(state);
+	struct drm_property_blob *blob = NULL;
+
+	if (property != plane_to_tinydrm_damage_plane(plane)->prop)
+		return -EINVAL;
+
+	if (val) {
+		blob = drm_property_lookup_blob(plane->dev, val);
+		if (!blob)
+			return -EINVAL;
+
+		if (blob->length % sizeof(struct tinydrm_mode_rect)) {
+			drm_property_blob_put(blob);
+			return -EINVAL;
+		}
+	}
+
+	drm_property_blob_put(dstate->fb_damage_clips);
+	dstate->fb_damage_clips = blob;
+
+	return 0;
+}
+
+static int tinydrm_damage_plane_get_property(struct drm_plane *plane,
+					     const struct drm_plane_state *state,
+					     struct drm_property *property,
+					     uint64_t *val)
+{
+	struct tinydrm_damage_plane_state *dstate =
+		container_of(state, struct tinydrm_damage_plane_state, base);
+
+	if (property != plane_to_tinydrm_damage_plane(plane)->prop)
+		return -EINVAL;
+
+	*val = dstate->fb_damage_clips ? dstate->fb_damage_clips->base.id : 0;
+
+	return 0;
+}
+
+/**
+ * tinydrm_plane_enable_fb_damage_clips - Enable the FB_DAMAGE_CLIPS property
+ * @plane: Plane
+ *
+ * Attaches the FB_DAMAGE_CLIPS property to @plane and switches it to a plane
+ * state that can hold the damage. Call this after the display pipe is
+ * initialized and before registering the device.
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int tinydrm_plane_enable_fb_damage_clips(struct drm_plane *plane)
+{
+	struct drm_device *drm = plane->dev;
+	struct tinydrm_damage_plane *dplane;
+
+	dplane = devm_kzalloc(drm->dev, sizeof(*dplane), GFP_KERNEL);
+	if (!dplane)
+		return -ENOMEM;
+
+	dplane->prop = drm_property_create(drm, DRM_MODE_PROP_ATOMIC |
+					   DRM_MODE_PROP_BLOB,
+					   "FB_DAMAGE_CLIPS", 0);
+	if (!dplane->prop)
+		return -ENOMEM;
+
+	dplane->funcs = *plane->funcs;
+	dplane->funcs.reset = tinydrm_damage_plane_reset;
+	dplane->funcs.atomic_duplicate_state =
+					tinydrm_damage_plane_duplicate_state;
+	dplane->funcs.atomic_destroy_state = tinydrm_damage_plane_destroy_state;
+	dplane->funcs.atomic_set_property = tinydrm_damage_plane_set_property;
+	dplane->funcs.atomic_get_property = tinydrm_damage_plane_get_property;
+
+	/* The current state, if any, was allocated by the old funcs */
+	if (plane->state) {
+		plane->funcs->atomic_destroy_state(plane, plane->state);
+		plane->state = NULL;
+	}
+
+	plane->funcs = &dplane->funcs;
+	plane->funcs->reset(plane);
+	if (!plane->state)
+		return -ENOMEM;
+
+	drm_object_attach_property(&plane->base, dplane->prop, 0);
+
+	return 0;
+}
+EXPORT_SYMBOL(tinydrm_plane_enable_fb_damage_clips);
+
+/**
+ * tinydrm_plane_damage_clips - Get the damage of a commit
+ * @state: Plane state
+ * @clips: Returns an array of clips that the caller must free
+ *
+ * Converts the FB_DAMAGE_CLIPS of @state to clips inside the framebuffer.
+ * The plane must have been set up with tinydrm_plane_enable_fb_damage_clips().
+ *
+ * Returns:
+ * Number of clips, zero if there's no damage or negative error code on
+ * failure. @clips is only set when there are clips.
+ */
+int tinydrm_plane_damage_clips(struct drm_plane_state *state,
+			       struct drm_clip_rect **clips)
+{
+	struct drm_property_blob *blob =
+		to_tinydrm_damage_plane_state(state)->fb_damage_clips;
+	struct drm_framebuffer *fb = state->fb;
+	struct tinydrm_mode_rect *rects;
+	unsigned int i, num_rects;
+	int num_clips = 0;
+
+	if (!blob)
+		return 0;
+
+	rects = blob->data;
+	num_rects = blob->length / sizeof(*rects);
+	if (!num_rects)
+		return 0;
+
+	*clips = kmalloc_array(num_rects, sizeof(**clips), GFP_KERNEL);
+	if (!*clips)
+		return -ENOMEM;
+
+	for (i = 0; i < num_rects; i++) {
+		s32 x1 = clamp_t(s32, rects[i].x1, 0, fb->width);
+		s32 y1 = clamp_t(s32, rects[i].y1, 0, fb->height);
+		s32 x2 = clamp_t(s32, rects[i].x2, 0, fb->width);
+		s32 y2 = clamp_t(s32, rects[i].y2, 0, fb->height);
+
+		if (x1 >= x2 || y1 >= y2)
+			continue;
+
+		(*clips)[num_clips].x1 = x1;
+		(*clips)[num_clips].y1 = y1;
+		(*clips)[num_clips].x2 = x2;
+		(*clips)[num_clips].y2 = y2;
+		num_clips++;
+	}
+
+	/* All of it was outside the framebuffer */
+	if (!num_clips)
+		kfree(*clips);
+
+	return num_clips;
+}
+EXPORT_SYMBOL(tinydrm_plane_damage_clips);
+
+/**
+ * DOC: Vblank emulation
+ *
+ * The panels have no vblank interrupt, so page flips used to complete right
+ * away and clients rendered far more frames than the bus could deliver.
+ * tinydrm_vblank_emulation_init() gives the CRTC a vblank driven by a
+ * hrtimer. The period follows the measured flush duration, but is never
+ * shorter than 60Hz. If the device has a "te-gpios" property, the tearing
+ * effect signal is used as the vblank instead of the timer.
+ *
+ * Page flip events are sent by tinydrm_display_pipe_damage_update() when the
+ * flush has completed. Commits that don't touch the primary plane, like a
+ * cursor move, get their event from the CRTC atomic_flush after the other
+ * planes have been flushed. Flips targeting a vblank (DRM_MODE_PAGE_FLIP_TARGET)
+ * are held back until that vblank, this lets video players pace the frames.
+ * Drivers must call drm_crtc_vblank_on() and drm_crtc_vblank_off() in their
+ * pipe enable and disable callbacks.
+ */
+
+#define TINYDRM_VBLANK_MIN_PERIOD_US	(USEC_PER_SEC / 60)
+/* Don't let a flip wait forever on a target that is never reached */
+#define TINYDRM_VBLANK_TARGET_TIMEOUT_MS	1000
+
+struct tinydrm_vblank {
+	struct drm_crtc_funcs funcs;
+	struct drm_crtc_helper_funcs helper_funcs;
+	struct drm_crtc *crtc;
+	struct hrtimer timer;
+	/* Protects @enabled and @armed against the timer callback */
+	spinlock_t lock;
+	bool enabled;
+	bool armed;
+	u32 period_us;
+	u32 flush_us;
+	int te_irq;
+};
+
+static int tinydrm_vblank_enable(struct drm_crtc *crtc);
+
+static struct tinydrm_vblank *crtc_to_tinydrm_vblank(struct drm_crtc *crtc)
+{
+	if (crtc->funcs->enable_vblank != tinydrm_vblank_enable)
+		return NULL;
+
+	return container_of(crtc->funcs, struct tinydrm_vblank, funcs);
+}
+
+static enum hrtimer_restart tinydrm_vblank_timer(struct hrtimer *timer)
+{
+	struct tinydrm_vblank *vbl = container_of(timer, struct tinydrm_vblank,
+						  timer);
+	enum hrtimer_restart restart = HRTIMER_NORESTART;
+	unsigned long flags;
+
+	drm_crtc_handle_vblank(vbl->crtc);
+
+	spin_lock_irqsave(&vbl->lock, flags);
+	if (vbl->enabled) {
+		hrtimer_forward_now(timer,
+				    us_to_ktime(READ_ONCE(vbl->period_us)));
+		restart = HRTIMER_RESTART;
+	} else {
+		vbl->armed = false;
+	}
+	spin_unlock_irqrestore(&vbl->lock, flags);
+
+	return restart;
+}
+
+static irqreturn_t tinydrm_vblank_te_handler(int irq, void *data)
+{
+	struct tinydrm_vblank *vbl = data;
+
+	drm_crtc_handle_vblank(vbl->crtc);
+
+	return IRQ_HANDLED;
+}
+
+static int tinydrm_vblank_enable(struct drm_crtc *crtc)
+{
+	struct tinydrm_vblank *vbl = crtc_to_tinydrm_vblank(crtc);
+	unsigned long flags;
+
+	if (vbl->te_irq) {
+		WRITE_ONCE(vbl->enabled, true);
+		enable_irq(vbl->te_irq);
+		return 0;
+	}
+
+	/* A callback still in flight sees @enabled and keeps the timer going */
+	spin_lock_irqsave(&vbl->lock, flags);
+	vbl->enabled = true;
+	if (!vbl->armed) {
+		hrtimer_start(&vbl->timer, us_to_ktime(vbl->period_us),
+			      HRTIMER_MODE_REL);
+		vbl->armed = true;
+	}
+	spin_unlock_irqrestore(&vbl->lock, flags);
+
+	return 0;
+}
+
+/*
+ * Called with the vblank locks held which the timer callback takes, so
+ * hrtimer_cancel() could deadlock. If the callback is running it stops the
+ * timer itself and clears @armed.
+ */
+static void tinydrm_vblank_disable(struct drm_crtc *crtc)
+{
+	struct tinydrm_vblank *vbl = crtc_to_tinydrm_vblank(crtc);
+	unsigned long flags;
+
+	if (vbl->te_irq) {
+		WRITE_ONCE(vbl->enabled, false);
+		disable_irq_nosync(vbl->te_irq);
+		return;
+	}
+
+	spin_lock_irqsave(&vbl->lock, flags);
+	vbl->enabled = false;
+	if (hrtimer_try_to_cancel(&vbl->timer) >= 0)
+		vbl->armed = false;
+	spin_unlock_irqrestore(&vbl->lock, flags);
+}
+
+/* Send the event of a commit that the primary plane update didn't take */
+static void tinydrm_vblank_atomic_flush(struct drm_crtc *crtc,
+					struct drm_crtc_state *old_state)
+{
+	struct drm_pending_vblank_event *event = crtc->state->event;
+
+	if (!event)
+		return;
+
+	crtc->state->event = NULL;
+
+	/* Signals the out-fence as well */
+	spin_lock_irq(&crtc->dev->event_lock);
+	drm_crtc_send_vblank_event(crtc, event);
+	spin_unlock_irq(&crtc->dev->event_lock);
+}
+
+static void tinydrm_vblank_fini(void *data)
+{
+	struct tinydrm_vblank *vbl = data;
+
+	hrtimer_cancel(&vbl->timer);
+}
+
+/*
+ * The flip is complete when the planes are updated, so the commit doesn't
+ * wait for a vblank afterwards like the default commit tail does.
+ */
+static void tinydrm_vblank_commit_tail(struct drm_atomic_state *state)
+{
+	struct drm_device *drm = state->dev;
+
+	drm_atomic_helper_commit_modeset_disables(drm, state);
+	drm_atomic_helper_commit_modeset_enables(drm, state);
+	drm_atomic_helper_commit_planes(drm, state, 0);
+	drm_atomic_helper_commit_hw_done(state);
+	drm_atomic_helper_cleanup_planes(drm, state);
+}
+
+static const struct drm_mode_config_helper_funcs tinydrm_vblank_mode_config = {
+	.atomic_commit_tail = tinydrm_vblank_commit_tail,
+};
+
+/**
+ * tinydrm_vblank_emulation_init - Emulate vblank for a CRTC
+ * @crtc: CRTC
+ *
+ * Sets up vblank handling for @crtc, driven by the tearing effect signal if
+ * the device has "te-gpios" and by a timer otherwise. Call this after the
+ * display pipe is initialized and before registering the device.
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int tinydrm_vblank_emulation_init(struct drm_crtc *crtc)
+{
+	struct drm_device *drm = crtc->dev;
+	struct device *dev = drm->dev;
+	struct tinydrm_vblank *vbl;
+	struct gpio_desc *te;
+	int ret;
+
+	vbl = devm_kzalloc(dev, sizeof(*vbl), GFP_KERNEL);
+	if (!vbl)
+		return -ENOMEM;
+
+	vbl->crtc = crtc;
+	vbl->period_us = TINYDRM_VBLANK_MIN_PERIOD_US;
+	spin_lock_init(&vbl->lock);
+	hrtimer_init(&vbl->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	vbl->timer.function = tinydrm_vblank_timer;
+
+	ret = devm_add_action(dev, tinydrm_vblank_fini, vbl);
+	if (ret)
+		return ret;
+
+	te = devm_gpiod_get_optional(dev, "te", GPIOD_IN);
+	if (IS_ERR(te)) {
+		ret = PTR_ERR(te);
+		if (ret != -EPROBE_DEFER)
+			dev_err(dev, "Failed to get gpio 'te'\n");
+		return ret;
+	}
+
+	if (te) {
+		ret = gpiod_to_irq(te);
+		if (ret < 0)
+			return ret;
+
+		vbl->te_irq = ret;
+		/* Only enabled while someone is waiting for vblanks */
+		irq_set_status_flags(vbl->te_irq, IRQ_NOAUTOEN);
+		ret = devm_request_irq(dev, vbl->te_irq,
+				       tinydrm_vblank_te_handler,
+				       IRQF_TRIGGER_RISING, "tinydrm-te", vbl);
+		if (ret)
+			return ret;
+	}
+
+	ret = drm_vblank_init(drm, 1);
+	if (ret)
+		return ret;
+
+	/* There's no irq, but the vblank ioctls refuse to work without it */
+	drm->irq_enabled = true;
+
+	vbl->funcs = *crtc->funcs;
+	vbl->funcs.enable_vblank = tinydrm_vblank_enable;
+	vbl->funcs.disable_vblank = tinydrm_vblank_disable;
+	vbl->funcs.page_flip_target = drm_atomic_helper_page_flip_target;
+	crtc->funcs = &vbl->funcs;
+
+	vbl->helper_funcs = *crtc->helper_private;
+	vbl->helper_funcs.atomic_flush = tinydrm_vblank_atomic_flush;
+	drm_crtc_helper_add(crtc, &vbl->helper_funcs);
+
+	drm->mode_config.helper_private = &tinydrm_vblank_mode_config;
+
+	return 0;
+}
+EXPORT_SYMBOL(tinydrm_vblank_emulation_init);
+
+static void tinydrm_vblank_wait_target(struct drm_crtc *crtc, u32 target)
+{
+	if (drm_crtc_vblank_get(crtc))
+		return;
+
+	wait_event_timeout(*drm_crtc_vblank_waitqueue(crtc),
+			   (int)(drm_crtc_vblank_count(crtc) - target) >= 0,
+			   msecs_to_jiffies(TINYDRM_VBLANK_TARGET_TIMEOUT_MS));
+	drm_crtc_vblank_put(crtc);
+}
+
+/* The vblank period follows how fast frames actually reach the panel */
+static void tinydrm_vblank_flush_done(struct tinydrm_vblank *vbl, s64 us)
+{
+	vbl->flush_us = vbl->flush_us ? (vbl->flush_us * 7 + us) / 8 : us;
+	WRITE_ONCE(vbl->period_us, max_t(u32, vbl->flush_us,
+					 TINYDRM_VBLANK_MIN_PERIOD_US));
+}
+
+/*
+ * The event and target are passed in since a queued flip can't rely on its
+ * CRTC state, a commit that doesn't touch the primary plane can free it.
+ */
+static void tinydrm_pipe_flush(struct drm_simple_display_pipe *pipe,
+			       struct drm_plane_state *state,
+			       struct drm_plane_state *old_state,
+			       struct drm_pending_vblank_event *event,
+			       u32 target_vblank)
+{
+	struct drm_framebuffer *fb = state->fb;
+	struct drm_crtc *crtc = &pipe->crtc;
+	struct tinydrm_vblank *vbl = crtc_to_tinydrm_vblank(crtc);
+	struct drm_clip_rect *clips = NULL;
+	bool flushed = false;
+	ktime_t start;
+	int num_clips;
+
+	if (fb && fb != old_state->fb)
+		pipe->plane.fb = fb;
+
+	if (vbl && target_vblank)
+		tinydrm_vblank_wait_target(crtc, target_vblank);
+
+	start = ktime_get();
+
+	if (fb && fb->funcs->dirty) {
+		num_clips = tinydrm_plane_damage_clips(state, &clips);
+		if (num_clips > 0) {
+			fb->funcs->dirty(fb, NULL, 0, 0, clips, num_clips);
+			kfree(clips);
+			flushed = true;
+		} else if (num_clips < 0 || fb != old_state->fb) {
+			fb->funcs->dirty(fb, NULL, 0, 0, NULL, 0);
+			flushed = true;
+		}
+	}
+
+	if (vbl && flushed)
+		tinydrm_vblank_flush_done(vbl, ktime_us_delta(ktime_get(),
+							      start));
+
+	/* Signals the out-fence as well */
+	if (event) {
+		spin_lock_irq(&crtc->dev->event_lock);
+		drm_crtc_send_vblank_event(crtc, event);
+		spin_unlock_irq(&crtc->dev->event_lock);
+	}
+}
+
+/**
+ * tinydrm_display_pipe_damage_update - Display pipe update helper
+ * @pipe: Simple display pipe
+ * @old_state: Old plane state
+ *
+ * Same as tinydrm_display_pipe_update(), but the FB_DAMAGE_CLIPS of the
+ * commit are flushed. A new framebuffer without damage is flushed in full
+ * and damage on the current framebuffer is flushed as well. Drivers must
+ * have called tinydrm_plane_enable_fb_damage_clips() to use this.
+ *
+ * With vblank emulation the flush waits for the target vblank of the flip,
+ * and the page flip event is sent when the flush has completed.
+ */
+void tinydrm_display_pipe_damage_update(struct drm_simple_display_pipe *pipe,
+					struct drm_plane_state *old_state)
+{
+	struct drm_crtc_state *crtc_state = pipe->crtc.state;
+
+	tinydrm_pipe_flush(pipe, pipe->plane.state, old_state,
+			   crtc_state->event,
+			   crtc_state->active ? crtc_state->target_vblank : 0);
+	crtc_state->event = NULL;
+}
+EXPORT_SYMBOL(tinydrm_display_pipe_damage_update);
+
+/**
+ * DOC: Flip queue
+ *
+ * A nonblocking commit used to be limited to one flip in flight, the next
+ * one got -EBUSY until the flush had completed. tinydrm_flip_queue_init()
+ * lets nonblocking page flips be queued and flushed in order from a worker,
+ * so rendering the next frame overlaps sending the current one. The queue
+ * depth is set with the "flip-queue-depth" property, default 2 and at most
+ * 3.
+ *
+ * A queued commit holds a reference on its state, so its framebuffer stays
+ * pinned until the flush has completed. The page flip event and the out-fence
+ * are signalled at that point. Modesets and blocking commits wait for the
+ * queue to drain and go through drm_atomic_helper_commit(). Commits that
+ * only touch the software planes don't wait.
+ */
+
+#define TINYDRM_FLIP_QUEUE_DEPTH	2
+#define TINYDRM_FLIP_QUEUE_MAX_DEPTH	3
+
+struct tinydrm_flip_queue {
+	struct drm_mode_config_funcs funcs;
+	struct drm_simple_display_pipe *pipe;
+	struct workqueue_struct *wq;
+	unsigned int depth;
+	atomic_t queued;
+};
+
+static struct tinydrm_flip_queue *
+drm_to_tinydrm_flip_queue(struct drm_device *drm)
+{
+	return container_of(drm->mode_config.funcs, struct tinydrm_flip_queue,
+			    funcs);
+}
+
+struct tinydrm_flip {
+	struct work_struct work;
+	struct tinydrm_flip_queue *fq;
+	struct drm_atomic_state *state;
+	struct drm_pending_vblank_event *event;
+	u32 target_vblank;
+};
+
+static void tinydrm_flip_work(struct work_struct *work)
+{
+	struct tinydrm_flip *flip = container_of(work, struct tinydrm_flip,
+						 work);
+	struct drm_atomic_state *state = flip->state;
+	struct tinydrm_flip_queue *fq = flip->fq;
+	struct drm_simple_display_pipe *pipe = fq->pipe;
+	struct drm_device *drm = state->dev;
+
+	drm_atomic_helper_wait_for_fences(drm, state, false);
+
+	tinydrm_pipe_flush(pipe,
+			   drm_atomic_get_new_plane_state(state, &pipe->plane),
+			   drm_atomic_get_old_plane_state(state, &pipe->plane),
+			   flip->event, flip->target_vblank);
+
+	drm_atomic_helper_cleanup_planes(drm, state);
+	drm_atomic_state_put(state);
+	kfree(flip);
+	atomic_dec(&fq->queued);
+}
+
+/*
+ * Only page flips on an active pipe using the damage update are queued. They
+ * must not touch other planes since those are committed the usual way.
+ */
+static bool tinydrm_flip_queueable(struct tinydrm_flip_queue *fq,
+				   struct drm_atomic_state *state)
+{
+	struct drm_simple_display_pipe *pipe = fq->pipe;
+	struct drm_crtc_state *crtc_state;
+	struct drm_plane_state *plane_state;
+	struct drm_plane *plane;
+	int i;
+
+	if (pipe->funcs->update != tinydrm_display_pipe_damage_update)
+		return false;
+
+	if (!drm_atomic_get_new_plane_state(state, &pipe->plane))
+		return false;
+
+	for_each_new_plane_in_state(state, plane, plane_state, i) {
+		if (plane != &pipe->plane)
+			return false;
+	}
+
+	crtc_state = drm_atomic_get_new_crtc_state(state, &pipe->crtc);
+
+	return crtc_state && crtc_state->active &&
+	       !drm_atomic_crtc_needs_modeset(crtc_state);
+}
+
+/* Commits that leave the primary plane alone don't depend on queued flips */
+static bool tinydrm_flip_queue_needs_drain(struct tinydrm_flip_queue *fq,
+					   struct drm_atomic_state *state)
+{
+	struct drm_simple_display_pipe *pipe = fq->pipe;
+	struct drm_crtc_state *crtc_state;
+
+	crtc_state = drm_atomic_get_new_crtc_state(state, &pipe->crtc);
+
+	return drm_atomic_get_new_plane_state(state, &pipe->plane) ||
+	       (crtc_state && drm_atomic_crtc_needs_modeset(crtc_state));
+}
+
+static int tinydrm_flip_queue_commit(struct drm_device *drm,
+				     struct drm_atomic_state *state,
+				     bool nonblock)
+{
+	struct tinydrm_flip_queue *fq = drm_to_tinydrm_flip_queue(drm);
+	struct drm_crtc_state *crtc_state;
+	struct tinydrm_flip *flip;
+	int ret;
+
+	if (!nonblock || !tinydrm_flip_queueable(fq, state)) {
+		if (tinydrm_flip_queue_needs_drain(fq, state))
+			flush_workqueue(fq->wq);
+		return drm_atomic_helper_commit(drm, state, nonblock);
+	}
+
+	if (atomic_read(&fq->queued) >= fq->depth)
+		return -EBUSY;
+
+	flip = kzalloc(sizeof(*flip), GFP_KERNEL);
+	if (!flip)
+		return -ENOMEM;
+
+	ret = drm_atomic_helper_prepare_planes(drm, state);
+	if (ret)
+		goto err_free;
+
+	ret = drm_atomic_helper_swap_state(state, true);
+	if (ret) {
+		drm_atomic_helper_cleanup_planes(drm, state);
+		goto err_free;
+	}
+
+	crtc_state = drm_atomic_get_new_crtc_state(state, &fq->pipe->crtc);
+	flip->event = crtc_state->event;
+	crtc_state->event = NULL;
+	flip->target_vblank = crtc_state->target_vblank;
+	flip->fq = fq;
+	flip->state = state;
+
+	/* Commits are serialized by the CRTC lock, so this can't overshoot */
+	atomic_inc(&fq->queued);
+	drm_atomic_state_get(state);
+	INIT_WORK(&flip->work, tinydrm_flip_work);
+	queue_work(fq->wq, &flip->work);
+
+	return 0;
+
+err_free:
+	kfree(flip);
+
+	return ret;
+}
+
+static void tinydrm_flip_queue_fini(void *data)
+{
+	struct tinydrm_flip_queue *fq = data;
+
+	destroy_workqueue(fq->wq);
+}
+
+/**
+ * tinydrm_flip_queue_init - Queue nonblocking page flips
+ * @pipe: Display pipe
+ *
+ * Enables the flip queue for @pipe, see the overview. The pipe update
+ * callback must be tinydrm_display_pipe_damage_update(), flips on other pipes
+ * are committed the usual way. Call this after the display pipe is
+ * initialized and before registering the device.
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int tinydrm_flip_queue_init(struct drm_simple_display_pipe *pipe)
+{
+	struct drm_device *drm = pipe->crtc.dev;
+	struct device *dev = drm->dev;
+	struct tinydrm_flip_queue *fq;
+	u32 depth = TINYDRM_FLIP_QUEUE_DEPTH;
+	int ret;
+
+	fq = devm_kzalloc(dev, sizeof(*fq), GFP_KERNEL);
+	if (!fq)
+		return -ENOMEM;
+
+	device_property_read_u32(dev, "flip-queue-depth", &depth);
+	fq->depth = clamp_t(u32, depth, 1, TINYDRM_FLIP_QUEUE_MAX_DEPTH);
+	fq->pipe = pipe;
+
+	/* Ordered, the flushes must reach the panel in commit order */
+	fq->wq = alloc_ordered_workqueue("%s-flip", 0, dev_name(dev));
+	if (!fq->wq)
+		return -ENOMEM;
+
+	ret = devm_add_action_or_reset(dev, tinydrm_flip_queue_fini, fq);
+	if (ret)
+		return ret;
+
+	fq->funcs = *drm->mode_config.funcs;
+	fq->funcs.atomic_commit = tinydrm_flip_queue_commit;
+	drm->mode_config.funcs = &fq->funcs;
+
+	return 0;
+}
+EXPORT_SYMBOL(tinydrm_flip_queue_init);
@@ -0,0 +1,521 @@
+/*
+ * Copyright (C) 2018 The tinydrm contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/dma-buf.h>
+#include <linux/property.h>
+#include <linux/slab.h>
+#include <linux/swab.h>
+
+#include <drm/drmP.h>
+#include <drm/drm_atomic.h>
+#include <drm/drm_atomic_helper.h>
+#include <drm/drm_fb_cma_helper.h>
+#include <drm/drm_gem_cma_helper.h>
+#include <drm/drm_plane_helper.h>
+#include <drm/drm_simple_kms_helper.h>
+#include <drm/tinydrm/tinydrm.h>
+#include <drm/tinydrm/tinydrm-helpers2.h>
+
+/**
+ * DOC: Software planes
+ *
+ * The controllers have a single layer, so additional planes are composited
+ * by the driver while flushing. The primary framebuffer is left untouched,
+ * the plane is blended into the transmit buffer of the clips it overlaps.
+ * Moving or changing a plane only flushes its old and new rectangle, the
+ * client doesn't have to re-render or damage the primary plane.
+ *
+ * tinydrm_sw_planes_init() sets up the overlays and a cursor on top. The
+ * number of overlays is set with the "overlay-planes" property, default and
+ * at most &TINYDRM_MAX_OVERLAYS. Overlays support FB_DAMAGE_CLIPS, damage
+ * on an overlay that hasn't moved only flushes the damaged part of it.
+ * Transparent borders of the cursor image are trimmed, so a 64x64 buffer
+ * holding a 32x32 arrow only costs the arrow.
+ *
+ * Drivers call tinydrm_sw_planes_blend() on each chunk they send while
+ * holding &tinydrm_device->dirty_lock.
+ *
+ * A commit doesn't have to include the primary plane. Flipping only an
+ * overlay, for instance a video on top of a static UI, flushes the overlay
+ * rectangle and the page flip event is sent when that is done::
+ *
+ *	req = drmModeAtomicAlloc();
+ *	drmModeAtomicAddProperty(req, overlay_id, fb_id_prop, next_fb);
+ *	drmModeAtomicCommit(fd, req, DRM_MODE_PAGE_FLIP_EVENT |
+ *			    DRM_MODE_ATOMIC_NONBLOCK, user_data);
+ *	(wait for the event on fd with drmHandleEvent())
+ *
+ * The flip queue doesn't take these commits, so only one can be in flight
+ * and the next one gets -EBUSY until the event has been sent.
+ */
+
+static const uint32_t tinydrm_sw_plane_cursor_formats[] = {
+	DRM_FORMAT_ARGB8888,
+};
+
+static const uint32_t tinydrm_sw_plane_overlay_formats[] = {
+	DRM_FORMAT_RGB565,
+	DRM_FORMAT_XRGB8888,
+	DRM_FORMAT_ARGB8888,
+};
+
+static inline struct tinydrm_sw_plane *
+to_tinydrm_sw_plane(struct drm_plane *plane)
+{
+	return container_of(plane, struct tinydrm_sw_plane, base);
+}
+
+static bool tinydrm_clip_intersect(struct drm_clip_rect *r,
+				   const struct drm_clip_rect *a,
+				   const struct drm_clip_rect *b)
+{
+	r->x1 = max(a->x1, b->x1);
+	r->y1 = max(a->y1, b->y1);
+	r->x2 = min(a->x2, b->x2);
+	r->y2 = min(a->y2, b->y2);
+
+	return r->x1 < r->x2 && r->y1 < r->y2;
+}
+
+static int tinydrm_sw_plane_atomic_check(struct drm_plane *plane,
+					 struct drm_plane_state *state)
+{
+	struct drm_crtc_state *crtc_state;
+	struct drm_rect clip = { 0 };
+
+	if (!state->crtc)
+		return 0;
+
+	crtc_state = drm_atomic_get_new_crtc_state(state->state, state->crtc);
+	if (!crtc_state)
+		return -EINVAL;
+
+	clip.x2 = crtc_state->adjusted_mode.hdisplay;
+	clip.y2 = crtc_state->adjusted_mode.vdisplay;
+
+	return drm_atomic_helper_check_plane_state(state, crtc_state, &clip,
+						   DRM_PLANE_HELPER_NO_SCALING,
+						   DRM_PLANE_HELPER_NO_SCALING,
+						   true, true);
+}
+
+/* Shrink @src and @dst to the part of the cursor that isn't transparent */
+static void tinydrm_sw_plane_trim(struct drm_framebuffer *fb,
+				  struct drm_clip_rect *src,
+				  struct drm_clip_rect *dst)
+{
+	struct drm_gem_cma_object *cma_obj = drm_fb_cma_get_gem_obj(fb, 0);
+	unsigned int x, y, x1 = src->x2, x2 = src->x1, y1 = src->y2;
+	unsigned int y2 = src->y1;
+	u32 *line;
+
+	for (y = src->y1; y < src->y2; y++) {
+		line = cma_obj->vaddr + y * fb->pitches[0];
+		for (x = src->x1; x < src->x2; x++) {
+			if (!(line[x] >> 24))
+				continue;
+			x1 = min(x1, x);
+			x2 = max(x2, x + 1);
+			y1 = min(y1, y);
+			y2 = max(y2, y + 1);
+		}
+	}
+
+	if (x1 >= x2) {
+		dst->x2 = dst->x1;
+		return;
+	}
+
+	dst->x1 += x1 - src->x1;
+	dst->y1 += y1 - src->y1;
+	dst->x2 = dst->x1 + x2 - x1;
+	dst->y2 = dst->y1 + y2 - y1;
+	src->x1 = x1;
+	src->y1 = y1;
+	src->x2 = x2;
+	src->y2 = y2;
+}
+
+/* Flush the rectangles of the primary framebuffer, merged if they overlap */
+static void tinydrm_sw_plane_flush(struct tinydrm_sw_plane *splane,
+				   struct drm_clip_rect *old,
+				   struct drm_clip_rect *new)
+{
+	struct drm_framebuffer *fb = splane->pipe->plane.fb;
+	struct drm_clip_rect clips[2], r;
+	unsigned int num_clips = 0;
+
+	if (!fb || !fb->funcs->dirty)
+		return;
+
+	if (old->x1 < old->x2)
+		clips[num_clips++] = *old;
+	if (new->x1 < new->x2)
+		clips[num_clips++] = *new;
+
+	if (num_clips == 2 && !tinydrm_clip_intersect(&r, old, new)) {
+		fb->funcs->dirty(fb, NULL, 0, 0, &clips[0], 1);
+		fb->funcs->dirty(fb, NULL, 0, 0, &clips[1], 1);
+	} else if (num_clips) {
+		fb->funcs->dirty(fb, NULL, 0, 0, clips, num_clips);
+	}
+}
+
+/*
+ * Damage on an overlay that stayed in place is flushed as is, translated to
+ * screen coordinates. Returns false if the whole rectangle must be flushed.
+ */
+static bool tinydrm_sw_plane_flush_damage(struct tinydrm_sw_plane *splane,
+					  struct drm_plane_state *state,
+					  const struct drm_clip_rect *old_src,
+					  const struct drm_clip_rect *old_dst)
+{
+	struct drm_framebuffer *fb = splane->pipe->plane.fb;
+	struct drm_clip_rect *clips, r;
+	int i, num_clips, n = 0;
+
+	if (state->plane->type != DRM_PLANE_TYPE_OVERLAY || !splane->fb ||
+	    memcmp(old_src, &splane->src, sizeof(r)) ||
+	    memcmp(old_dst, &splane->dst, sizeof(r)))
+		return false;
+
+	num_clips = tinydrm_plane_damage_clips(state, &clips);
+	if (num_clips <= 0)
+		return false;
+
+	for (i = 0; i < num_clips; i++) {
+		if (!tinydrm_clip_intersect(&r, &clips[i], &splane->src))
+			continue;
+		clips[n].x1 = r.x1 - splane->src.x1 + splane->dst.x1;
+		clips[n].x2 = r.x2 - splane->src.x1 + splane->dst.x1;
+		clips[n].y1 = r.y1 - splane->src.y1 + splane->dst.y1;
+		clips[n].y2 = r.y2 - splane->src.y1 + splane->dst.y1;
+		n++;
+	}
+
+	if (n && fb && fb->funcs->dirty)
+		fb->funcs->dirty(fb, NULL, 0, 0, clips, n);
+	kfree(clips);
+
+	return true;
+}
+
+static void tinydrm_sw_plane_atomic_update(struct drm_plane *plane,
+					   struct drm_plane_state *old_state)
+{
+	struct tinydrm_sw_plane *splane = to_tinydrm_sw_plane(plane);
+	struct tinydrm_device *tdev = pipe_to_tinydrm(splane->pipe);
+	struct drm_plane_state *state = plane->state;
+	struct drm_framebuffer *fb = state->visible ? state->fb : NULL;
+	struct drm_clip_rect old, old_src, new = { 0 };
+
+	mutex_lock(&tdev->dirty_lock);
+
+	old = splane->dst;
+	old_src = splane->src;
+
+	if (splane->fb)
+		drm_framebuffer_put(splane->fb);
+	splane->fb = fb;
+
+	if (fb) {
+		drm_framebuffer_get(fb);
+		new.x1 = state->dst.x1;
+		new.y1 = state->dst.y1;
+		new.x2 = state->dst.x2;
+		new.y2 = state->dst.y2;
+		splane->src.x1 = state->src.x1 >> 16;
+		splane->src.y1 = state->src.y1 >> 16;
+		splane->src.x2 = splane->src.x1 + new.x2 - new.x1;
+		splane->src.y2 = splane->src.y1 + new.y2 - new.y1;
+		if (plane->type == DRM_PLANE_TYPE_CURSOR &&
+		    !drm_fb_cma_get_gem_obj(fb, 0)->base.import_attach)
+			tinydrm_sw_plane_trim(fb, &splane->src, &new);
+	}
+
+	splane->dst = new;
+
+	mutex_unlock(&tdev->dirty_lock);
+
+	if (!tinydrm_sw_plane_flush_damage(splane, state, &old_src, &old))
+		tinydrm_sw_plane_flush(splane, &old, &new);
+}
+
+static const struct drm_plane_helper_funcs tinydrm_sw_plane_helper_funcs = {
+	.prepare_fb = drm_fb_cma_prepare_fb,
+	.atomic_check = tinydrm_sw_plane_atomic_check,
+	.atomic_update = tinydrm_sw_plane_atomic_update,
+};
+
+static void tinydrm_sw_plane_destroy(struct drm_plane *plane)
+{
+	struct tinydrm_sw_plane *splane = to_tinydrm_sw_plane(plane);
+
+	if (splane->fb)
+		drm_framebuffer_put(splane->fb);
+	drm_plane_cleanup(plane);
+}
+
+static const struct drm_plane_funcs tinydrm_sw_plane_funcs = {
+	.update_plane		= drm_atomic_helper_update_plane,
+	.disable_plane		= drm_atomic_helper_disable_plane,
+	.destroy		= tinydrm_sw_plane_destroy,
+	.reset			= drm_atomic_helper_plane_reset,
+	.atomic_duplicate_state	= drm_atomic_helper_plane_duplicate_state,
+	.atomic_destroy_state	= drm_atomic_helper_plane_destroy_state,
+};
+
+static int tinydrm_sw_plane_init(struct tinydrm_sw_plane *splane,
+				 struct drm_simple_display_pipe *pipe,
+				 enum drm_plane_type type)
+{
+	struct drm_mode_config *mode_config = &pipe->crtc.dev->mode_config;
+	struct drm_plane *plane = &splane->base;
+	const uint32_t *formats;
+	unsigned int num_formats;
+	int ret;
+
+	if (type == DRM_PLANE_TYPE_CURSOR) {
+		formats = tinydrm_sw_plane_cursor_formats;
+		num_formats = ARRAY_SIZE(tinydrm_sw_plane_cursor_formats);
+	} else {
+		formats = tinydrm_sw_plane_overlay_formats;
+		num_formats = ARRAY_SIZE(tinydrm_sw_plane_overlay_formats);
+	}
+
+	splane->pipe = pipe;
+
+	/* Planes are clipped to the screen, 4 bytes covers all the formats */
+	splane->linebuf = devm_kmalloc_array(pipe->crtc.dev->dev,
+					     mode_config->max_width, 4,
+					     GFP_KERNEL);
+	if (!splane->linebuf)
+		return -ENOMEM;
+
+	ret = drm_universal_plane_init(pipe->crtc.dev, plane,
+				       drm_crtc_mask(&pipe->crtc),
+				       &tinydrm_sw_plane_funcs, formats,
+				       num_formats, NULL, type, NULL);
+	if (ret)
+		return ret;
+
+	drm_plane_helper_add(plane, &tinydrm_sw_plane_helper_funcs);
+
+	if (type == DRM_PLANE_TYPE_CURSOR) {
+		pipe->crtc.cursor = plane;
+		plane->funcs->reset(plane);
+		return 0;
+	}
+
+	return tinydrm_plane_enable_fb_damage_clips(plane);
+}
+
+/**
+ * tinydrm_sw_planes_init - Initialize the software composited planes
+ * @planes: Array of &TINYDRM_MAX_SW_PLANES planes
+ * @pipe: Display pipe the planes are shown on
+ *
+ * Sets up the overlays followed by the cursor, which is also used for the
+ * legacy cursor ioctls. The planes are blended in this order. Call this after
+ * the display pipe is initialized and before registering the device.
+ * Commits that only touch these planes get their page flip event from the
+ * CRTC set up by tinydrm_vblank_emulation_init(), drivers need to call that
+ * as well.
+ *
+ * Returns:
+ * Number of planes on success, negative error code on failure.
+ */
+int tinydrm_sw_planes_init(struct tinydrm_sw_plane *planes,
+			   struct drm_simple_display_pipe *pipe)
+{
+	struct device *dev = pipe->crtc.dev->dev;
+	u32 num_overlays = TINYDRM_MAX_OVERLAYS;
+	unsigned int i;
+	int ret;
+
+	device_property_read_u32(dev, "overlay-planes", &num_overlays);
+	num_overlays = min_t(u32, num_overlays, TINYDRM_MAX_OVERLAYS);
+
+	for (i = 0; i < num_overlays; i++) {
+		ret = tinydrm_sw_plane_init(&planes[i], pipe,
+					    DRM_PLANE_TYPE_OVERLAY);
+		if (ret)
+			return ret;
+	}
+
+	ret = tinydrm_sw_plane_init(&planes[i], pipe, DRM_PLANE_TYPE_CURSOR);
+	if (ret)
+		return ret;
+
+	return num_overlays + 1;
+}
+EXPORT_SYMBOL(tinydrm_sw_planes_init);
+
+/**
+ * tinydrm_sw_planes_overlap - Check if any plane is shown in a clip
+ * @planes: Software planes
+ * @count: Number of planes
+ * @clip: Clip rectangle in screen coordinates
+ *
+ * Drivers that send straight from the framebuffer use this to see if they
+ * need to go through the transmit buffer. Must be called with
+ * &tinydrm_device->dirty_lock held.
+ *
+ * Returns:
+ * True if a plane is visible inside @clip.
+ */
+bool tinydrm_sw_planes_overlap(struct tinydrm_sw_plane *planes,
+			       unsigned int count,
+			       const struct drm_clip_rect *clip)
+{
+	struct drm_clip_rect r;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		if (planes[i].fb &&
+		    tinydrm_clip_intersect(&r, &planes[i].dst, clip))
+			return true;
+	}
+
+	return false;
+}
+EXPORT_SYMBOL(tinydrm_sw_planes_overlap);
+
+static inline u32 tinydrm_blend8(u32 s, u32 d, u32 a)
+{
+	/* Pre-multiplied alpha */
+	return min_t(u32, s + DIV_ROUND_CLOSEST(d * (255 - a), 255), 255);
+}
+
+static inline u32 tinydrm_sw_plane_pixel(const void *src, u32 format,
+					 unsigned int x)
+{
+	u16 val;
+
+	switch (format) {
+	case DRM_FORMAT_RGB565:
+		val = ((const u16 *)src)[x];
+		return 0xff000000 | ((val & 0xf800) << 8) |
+		       ((val & 0x07e0) << 5) | ((val & 0x001f) << 3);
+	case DRM_FORMAT_XRGB8888:
+		return ((const u32 *)src)[x] | 0xff000000;
+	default:
+		return ((const u32 *)src)[x];
+	}
+}
+
+static void tinydrm_sw_plane_blend_line(u8 *dst, const void *src,
+					u32 format, unsigned int width,
+					unsigned int bpp, bool swap)
+{
+	u32 s, a, r, g, b;
+	unsigned int x;
+	u16 *dst16;
+	u16 val;
+
+	for (x = 0; x < width; x++) {
+		s = tinydrm_sw_plane_pixel(src, format, x);
+		a = s >> 24;
+		if (!a)
+			continue;
+
+		r = (s >> 16) & 0xff;
+		g = (s >> 8) & 0xff;
+		b = s & 0xff;
+
+		if (bpp == 18) {
+			if (a != 0xff) {
+				r = tinydrm_blend8(r, dst[x * 3], a);
+				g = tinydrm_blend8(g, dst[x * 3 + 1], a);
+				b = tinydrm_blend8(b, dst[x * 3 + 2], a);
+			}
+			dst[x * 3] = r;
+			dst[x * 3 + 1] = g;
+			dst[x * 3 + 2] = b;
+			continue;
+		}
+
+		dst16 = (u16 *)dst + x;
+		if (a != 0xff) {
+			val = swap ? swab16(*dst16) : *dst16;
+			r = tinydrm_blend8(r, (val >> 8) & 0xf8, a);
+			g = tinydrm_blend8(g, (val >> 3) & 0xfc, a);
+			b = tinydrm_blend8(b, (val << 3) & 0xf8, a);
+		}
+		val = ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3);
+		*dst16 = swap ? swab16(val) : val;
+	}
+}
+
+static void tinydrm_sw_plane_blend(struct tinydrm_sw_plane *splane, void *dst,
+				   const struct drm_clip_rect *clip,
+				   unsigned int bpp, bool swap)
+{
+	struct drm_framebuffer *fb = splane->fb;
+	struct dma_buf_attachment *import_attach;
+	struct drm_gem_cma_object *cma_obj;
+	unsigned int cpp = bpp == 18 ? 3 : 2;
+	size_t dst_pitch = (clip->x2 - clip->x1) * cpp;
+	struct drm_clip_rect r;
+	size_t len;
+	unsigned int y;
+	void *src;
+
+	if (!fb || !tinydrm_clip_intersect(&r, &splane->dst, clip))
+		return;
+
+	len = (r.x2 - r.x1) * fb->format->cpp[0];
+
+	cma_obj = drm_fb_cma_get_gem_obj(fb, 0);
+	import_attach = cma_obj->base.import_attach;
+	if (import_attach &&
+	    dma_buf_begin_cpu_access(import_attach->dmabuf, DMA_FROM_DEVICE))
+		return;
+
+	src = cma_obj->vaddr +
+	      (splane->src.y1 + r.y1 - splane->dst.y1) * fb->pitches[0] +
+	      (splane->src.x1 + r.x1 - splane->dst.x1) * fb->format->cpp[0];
+	dst += (r.y1 - clip->y1) * dst_pitch + (r.x1 - clip->x1) * cpp;
+
+	for (y = r.y1; y < r.y2; y++) {
+		/* The framebuffer is write-combined, read a line in one go */
+		memcpy(splane->linebuf, src, len);
+		tinydrm_sw_plane_blend_line(dst, splane->linebuf,
+					    fb->format->format, r.x2 - r.x1,
+					    bpp, swap);
+		src += fb->pitches[0];
+		dst += dst_pitch;
+	}
+
+	if (import_attach)
+		dma_buf_end_cpu_access(import_attach->dmabuf, DMA_FROM_DEVICE);
+}
+
+/**
+ * tinydrm_sw_planes_blend - Blend the planes into a transmit buffer
+ * @planes: Software planes
+ * @count: Number of planes
+ * @dst: Buffer holding the @clip pixels of the primary plane
+ * @clip: Clip rectangle in screen coordinates
+ * @bpp: Format of @dst, 16 for RGB565 and 18 for 3 bytes per pixel RGB666
+ * @swap: RGB565 pixels in @dst are byte swapped
+ *
+ * Must be called with &tinydrm_device->dirty_lock held.
+ */
+void tinydrm_sw_planes_blend(struct tinydrm_sw_plane *planes,
+			     unsigned int count, void *dst,
+			     const struct drm_clip_rect *clip,
+			     unsigned int bpp, bool swap)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		tinydrm_sw_plane_blend(&planes[i], dst, clip, bpp, swap);
+}
+EXPORT_SYMBOL(tinydrm_sw_planes_blend);
@@ -10,10 +10,14 @@
 #include <linux/debugfs.h>
 #include <linux/device.h>
 #include <linux/gpio/consumer.h>
+#include <linux/kernel.h>
+#include <linux/mutex.h>
+#include <linux/property.h>
 #include <linux/regmap.h>
 
 #include <drm/drmP.h>
 #include <drm/tinydrm/tinydrm-helpers.h>
+#include <drm/tinydrm/tinydrm-i80.h>
 #include <drm/tinydrm/tinydrm-regmap.h>
 
 /**
@@ -50,47 +54,124 @@ bool tinydrm_regmap_raw_swap_bytes(struct regmap *reg)
 }
 EXPORT_SYMBOL(tinydrm_regmap_raw_swap_bytes);
 
+/**
+ * tinydrm_regmap_stream_write - Stream pixels to a register
+ * @reg: Regmap
+ * @stream: Pixel stream operation (optional)
+ * @regnr: Register number, typically the GRAM data register
+ * @buf: Buffer to write, same layout as for regmap_raw_write()
+ * @len: Buffer length in bytes
+ *
+ * This function writes @buf using @stream if it's set, falling back to
+ * regmap_raw_write() otherwise.
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int tinydrm_regmap_stream_write(struct regmap *reg,
+				const struct tinydrm_regmap_stream *stream,
+				unsigned int regnr, const void *buf,
+				size_t len)
+{
+	if (!stream || !stream->write)
+		return regmap_raw_write(reg, regnr, buf, len);
+
+	return stream->write(stream->context, regnr, buf, len);
+}
+EXPORT_SYMBOL(tinydrm_regmap_stream_write);
+
+/**
+ * tinydrm_regmap_stream_fill - Stream pixels produced by a fill function
+ * @reg: Regmap
+ * @stream: Pixel stream operation (optional)
+ * @regnr: Register number, typically the GRAM data register
+ * @buf: Buffer big enough for @len bytes, used if there's no &fill operation
+ * @len: Number of bytes to write
+ * @granule: Chunks passed to @fill are a multiple of this, typically a line
+ * @fill: Function producing the bytes
+ * @arg: Argument passed to @fill
+ *
+ * If @stream supports it, @fill is called chunk by chunk so producing the
+ * next chunk overlaps writing the previous one. Otherwise @buf is filled in
+ * one go and written using tinydrm_regmap_stream_write().
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int tinydrm_regmap_stream_fill(struct regmap *reg,
+			       const struct tinydrm_regmap_stream *stream,
+			       unsigned int regnr, void *buf, size_t len,
+			       size_t granule, tinydrm_regmap_fill_t fill,
+			       void *arg)
+{
+	int ret;
+
+	if (stream && stream->fill)
+		return stream->fill(stream->context, regnr, len, granule,
+				    fill, arg);
+
+	ret = fill(buf, 0, len, arg);
+	if (ret)
+		return ret;
+
+	return tinydrm_regmap_stream_write(reg, stream, regnr, buf, len);
+}
+EXPORT_SYMBOL(tinydrm_regmap_stream_fill);
+
 struct tinydrm_regmap_i80 {
 	struct device *dev;
 	struct regmap *reg;
+	/* Serializes the stream operation with regmap bus access */
+	struct mutex lock;
+	unsigned int reg_width;
 	struct gpio_desc *cs;
 	struct gpio_desc *idx;
-	struct gpio_desc *wr;
-	struct gpio_descs *db;
+	struct tinydrm_i80_bus *bus;
 };
 
-static void tinydrm_i80_write_value(struct gpio_desc *wr,
-				    struct gpio_descs *db, u32 value)
+/* Copy @buf into bus thread slots, caller holds the lock */
+static void tinydrm_regmap_i80_queue(struct tinydrm_regmap_i80 *i80,
+				     const void *buf, size_t len,
+				     unsigned int flags)
 {
-	int i, values[32];
-
-	for (i = 0; i < db->ndescs; i++, value >>= 1)
-		values[i] = value & 1;
-
-	gpiod_set_value_cansleep(wr, 0);
-	gpiod_set_array_value_cansleep(db->ndescs, db->desc, values);
-	gpiod_set_value_cansleep(wr, 1);
+	unsigned int begin = flags & TINYDRM_I80_BEGIN;
+	size_t chunk, size;
+	void *slot;
+
+	do {
+		slot = tinydrm_i80_bus_get_slot(i80->bus, &size);
+		chunk = min(len, size);
+		memcpy(slot, buf, chunk);
+		buf += chunk;
+		len -= chunk;
+		tinydrm_i80_bus_queue_slot(i80->bus, chunk,
+					   (flags & TINYDRM_I80_CMD) | begin |
+					   (len ? 0 : flags & TINYDRM_I80_END));
+		begin = 0;
+	} while (len);
 }
 
-static void tinydrm_i80_write_buf(struct gpio_desc *wr, struct gpio_descs *db,
-				  const void *buf, size_t len)
+static void tinydrm_regmap_i80_queue_regnr(struct tinydrm_regmap_i80 *i80,
+					   unsigned int regnr)
 {
-	unsigned int width = db->ndescs;
-	size_t i;
-
-	if (width == 8) {
-		const u8 *buf8 = buf;
-
-		for (i = 0; i < len; i++)
-			tinydrm_i80_write_value(wr, db, *buf8++);
-	} else if (width == 16) {
-		const u16 *buf16 = buf;
-
-		for (i = 0; i < (len / 2); i++)
-			tinydrm_i80_write_value(wr, db, *buf16++);
+	size_t size;
+	void *slot;
+
+	slot = tinydrm_i80_bus_get_slot(i80->bus, &size);
+	if (tinydrm_i80_bus_width(i80->bus) == 16) {
+		*(u16 *)slot = regnr;
+		size = 2;
+	} else if (i80->reg_width == 16) {
+		/* MSB first on an 8-bit bus */
+		((u8 *)slot)[0] = regnr >> 8;
+		((u8 *)slot)[1] = regnr;
+		size = 2;
 	} else {
-		WARN_ON_ONCE(1);
+		*(u8 *)slot = regnr;
+		size = 1;
 	}
+	tinydrm_i80_bus_queue_slot(i80->bus, size,
+				   TINYDRM_I80_CMD | TINYDRM_I80_BEGIN);
 }
 
 static int tinydrm_regmap_i80_gather_write(void *context, const void *reg,
@@ -99,20 +180,34 @@ static int tinydrm_regmap_i80_gather_write(void *context, const void *reg,
 {
 	struct tinydrm_regmap_i80 *i80 = context;
 
+	mutex_lock(&i80->lock);
+
+	if (tinydrm_i80_bus_threaded(i80->bus)) {
+		tinydrm_regmap_i80_queue(i80, reg, reg_len,
+					 TINYDRM_I80_CMD | TINYDRM_I80_BEGIN);
+		tinydrm_regmap_i80_queue(i80, val, val_len, TINYDRM_I80_END);
+		tinydrm_i80_bus_wait_idle(i80->bus);
+		mutex_unlock(&i80->lock);
+
+		return 0;
+	}
+
 	if (i80->cs)
 		gpiod_set_value_cansleep(i80->cs, 0);
 
 	if (i80->idx)
 		gpiod_set_value_cansleep(i80->idx, 0);
-	tinydrm_i80_write_buf(i80->wr, i80->db, reg, reg_len);
+	tinydrm_i80_bus_write_buf(i80->bus, reg, reg_len);
 
 	if (i80->idx)
 		gpiod_set_value_cansleep(i80->idx, 1);
-	tinydrm_i80_write_buf(i80->wr, i80->db, val, val_len);
+	tinydrm_i80_bus_write_buf(i80->bus, val, val_len);
 
 	if (i80->cs)
 		gpiod_set_value_cansleep(i80->cs, 1);
 
+	mutex_unlock(&i80->lock);
+
 	return 0;
 }
 
@@ -132,58 +227,171 @@ static int tinydrm_regmap_i80_read(void *context, const void *reg,
 	return -ENOTSUPP;
 }
 
+static int tinydrm_regmap_i80_stream_write(void *context, unsigned int regnr,
+					   const void *buf, size_t len)
+{
+	struct tinydrm_regmap_i80 *i80 = context;
+
+	mutex_lock(&i80->lock);
+
+	if (tinydrm_i80_bus_threaded(i80->bus)) {
+		tinydrm_regmap_i80_queue_regnr(i80, regnr);
+		tinydrm_regmap_i80_queue(i80, buf, len, TINYDRM_I80_END);
+		tinydrm_i80_bus_wait_idle(i80->bus);
+		mutex_unlock(&i80->lock);
+
+		return 0;
+	}
+
+	if (i80->cs)
+		gpiod_set_value_cansleep(i80->cs, 0);
+
+	if (i80->idx)
+		gpiod_set_value_cansleep(i80->idx, 0);
+
+	/* The register number goes MSB first on an 8-bit bus */
+	if (i80->reg_width == 16 && tinydrm_i80_bus_width(i80->bus) == 8)
+		tinydrm_i80_bus_write_word(i80->bus, regnr >> 8);
+	tinydrm_i80_bus_write_word(i80->bus, regnr);
+
+	if (i80->idx)
+		gpiod_set_value_cansleep(i80->idx, 1);
+	tinydrm_i80_bus_write_buf(i80->bus, buf, len);
+
+	if (i80->cs)
+		gpiod_set_value_cansleep(i80->cs, 1);
+
+	mutex_unlock(&i80->lock);
+
+	return 0;
+}
+
+/* Only used with the bus thread: fill the next slot while the last is written */
+static int tinydrm_regmap_i80_stream_fill(void *context, unsigned int regnr,
+					  size_t len, size_t granule,
+					  tinydrm_regmap_fill_t fill, void *arg)
+{
+	struct tinydrm_regmap_i80 *i80 = context;
+	size_t offset = 0, chunk, size;
+	int ret = 0;
+	void *slot;
+
+	mutex_lock(&i80->lock);
+
+	tinydrm_regmap_i80_queue_regnr(i80, regnr);
+
+	do {
+		slot = tinydrm_i80_bus_get_slot(i80->bus, &size);
+		chunk = min(len - offset, granule && granule <= size ?
+					  rounddown(size, granule) : size);
+		ret = fill(slot, offset, chunk, arg);
+		if (ret)
+			chunk = 0;
+		offset += chunk;
+		tinydrm_i80_bus_queue_slot(i80->bus, chunk,
+					   ret || offset == len ?
+					   TINYDRM_I80_END : 0);
+	} while (!ret && offset < len);
+
+	tinydrm_i80_bus_wait_idle(i80->bus);
+
+	mutex_unlock(&i80->lock);
+
+	return ret;
+}
+
 static const struct regmap_bus tinydrm_i80_bus = {
 	.write = tinydrm_regmap_i80_write,
 	.gather_write = tinydrm_regmap_i80_gather_write,
 	.read = tinydrm_regmap_i80_read,
 	.reg_format_endian_default = REGMAP_ENDIAN_BIG,
 	.val_format_endian_default = REGMAP_ENDIAN_BIG,
-
-// NATIVE
-
 };
 
 /**
  * tinydrm_i80_init - Initialize an I80 bus regmap
  * @dev: Device
- * @reg_width: Register width in bits (8 or 16).
+ * @config: Register map configuration. Register and value width must be the
+ *          same, 8 or 16 bits.
  * @cs: Chip Select gpio (optional).
  * @idx: Index gpio, low writing register number and high writing value
  *       (optional).
  * @wr: Write latch gpio.
  * @db: Databus gpio array. The bus can be 8-bit wide even if the register is
  *      16-bit.
+ * @stream: Pixel stream operation to fill in (optional)
  *
  * This function creates a &regmap to access the register on a I80 type bus
- * connected controller.
+ * connected controller. If @stream is set, it's filled in with an operation
+ * that can write pixel data directly to the bus.
+ *
+ * The bus can't be read, so registers are only readable through the cache
+ * (see &regmap_config->cache_type).
+ *
+ * On an 8-bit bus 16-bit words go MSB first. On a 16-bit bus words are
+ * written native endian, so the formatting endianness defaults to native.
+ *
+ * If the device has a "bitbang-cpu" property, the bus is driven by a kthread
+ * bound to that CPU and @stream gets a &tinydrm_regmap_stream.fill operation.
  *
  * Returns I80 &regmap on success or ERR_PTR on failure.
  */
-struct regmap *tinydrm_i80_init(struct device *dev, unsigned int reg_width,
+struct regmap *tinydrm_i80_init(struct device *dev,
+				const struct regmap_config *config,
 				struct gpio_desc *cs, struct gpio_desc *idx,
-				struct gpio_desc *wr, struct gpio_descs *db)
+				struct gpio_desc *wr, struct gpio_descs *db,
+				struct tinydrm_regmap_stream *stream)
 {
+	unsigned int reg_width = config->reg_bits;
+	struct regmap_config i80_config = *config;
 	struct tinydrm_regmap_i80 *i80;
-	struct regmap_config config = {
-		.reg_bits = reg_width,
-		.val_bits = reg_width,
-		.cache_type = REGCACHE_NONE,
-	};
+	u32 cpu;
+	int ret;
 
 	if ((db->ndescs != 8 && db->ndescs != 16) ||
-	    (reg_width != 8 && reg_width != 16))
+	    (reg_width != 8 && reg_width != 16) ||
+	    config->val_bits != reg_width)
 		return ERR_PTR(-EINVAL);
 
 	i80 = devm_kzalloc(dev, sizeof(*i80), GFP_KERNEL);
 	if (!i80)
 		return ERR_PTR(-ENOMEM);
 
+	i80->bus = devm_tinydrm_i80_bus_init(dev, wr, db);
+	if (IS_ERR(i80->bus))
+		return ERR_CAST(i80->bus);
+
+	if (db->ndescs == 16) {
+		if (i80_config.reg_format_endian == REGMAP_ENDIAN_DEFAULT)
+			i80_config.reg_format_endian = REGMAP_ENDIAN_NATIVE;
+		if (i80_config.val_format_endian == REGMAP_ENDIAN_DEFAULT)
+			i80_config.val_format_endian = REGMAP_ENDIAN_NATIVE;
+	}
+
+	mutex_init(&i80->lock);
 	i80->dev = dev;
+	i80->reg_width = reg_width;
 	i80->cs = cs;
 	i80->idx = idx;
-	i80->wr = wr;
-	i80->db = db;
-	i80->reg = devm_regmap_init(dev, &tinydrm_i80_bus, i80, &config);
+	i80->reg = devm_regmap_init(dev, &tinydrm_i80_bus, i80, &i80_config);
+	if (IS_ERR(i80->reg))
+		return i80->reg;
+
+	if (!device_property_read_u32(dev, "bitbang-cpu", &cpu)) {
+		ret = tinydrm_i80_bus_start_thread(dev, i80->bus, cs, idx, cpu);
+		if (ret) {
+			dev_err(dev, "Failed to start bus thread on CPU%u %d\n",
+				cpu, ret);
+			return ERR_PTR(ret);
+		}
+	}
+
+	if (stream) {
+		stream->write = tinydrm_regmap_i80_stream_write;
+		if (tinydrm_i80_bus_threaded(i80->bus))
+			stream->fill = tinydrm_regmap_i80_stream_fill;
+		stream->context = i80;
+	}
 
 	return i80->reg;
 }
@@ -0,0 +1,490 @@
+/*
+ * Copyright (C) 2018 The tinydrm contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/device.h>
+#include <linux/mutex.h>
+#include <linux/of.h>
+#include <linux/property.h>
+
+#include <drm/drmP.h>
+#include <drm/drm_gem_framebuffer_helper.h>
+#include <drm/drm_simple_kms_helper.h>
+#include <drm/tinydrm/tinydrm.h>
+#include <drm/tinydrm/tinydrm-helpers2.h>
+#include <drm/tinydrm/tinydrm-wall.h>
+
+/**
+ * DOC: Video wall
+ *
+ * A video wall shows one framebuffer on several identical panels placed
+ * side by side. It is described by a node that references the panels::
+ *
+ *	wall {
+ *		compatible = "video-wall";
+ *		panels = <&tft0>, <&tft1>, <&tft2>, <&tft3>;
+ *		columns = <2>;
+ *	};
+ *
+ * The "video-wall" compatible is generic and has no vendor prefix, the wall
+ * is not a piece of hardware. Required property "panels" lists phandles to
+ * the panel nodes in row major order, optional "columns" defaults to all of
+ * them in one row. Panel drivers check tinydrm_wall_is_tile() and add a
+ * &tinydrm_wall_tile with devm_tinydrm_wall_tile_add() instead of
+ * registering their own DRM device. The wall then registers a single device
+ * with a mode spanning all the tiles.
+ *
+ * Every tile has its own worker. A flush splits the damage per tile and
+ * sends it to all the panels at once, so with one panel per SPI bus the
+ * throughput scales with the number of buses. The flush returns when every
+ * tile is done. This is the frame barrier: no panel starts on the next frame
+ * before all of them show the current one.
+ */
+
+enum tinydrm_wall_op {
+	TINYDRM_WALL_FLUSH,
+	TINYDRM_WALL_ENABLE,
+	TINYDRM_WALL_DISABLE,
+};
+
+static LIST_HEAD(tinydrm_wall_tiles);
+static DEFINE_MUTEX(tinydrm_wall_lock);
+
+/**
+ * tinydrm_wall_is_tile - Check if a panel is part of a video wall
+ * @dev: Panel device
+ *
+ * Returns:
+ * True if an enabled video wall node references @dev.
+ */
+bool tinydrm_wall_is_tile(struct device *dev)
+{
+	struct device_node *np, *panel;
+	bool found = false;
+	int i;
+
+	if (!dev->of_node)
+		return false;
+
+	for_each_compatible_node(np, NULL, "video-wall") {
+		if (!of_device_is_available(np))
+			continue;
+
+		for (i = 0; !found; i++) {
+			panel = of_parse_phandle(np, "panels", i);
+			if (!panel)
+				break;
+			found = panel == dev->of_node;
+			of_node_put(panel);
+		}
+
+		if (found) {
+			of_node_put(np);
+			break;
+		}
+	}
+
+	return found;
+}
+EXPORT_SYMBOL(tinydrm_wall_is_tile);
+
+static void tinydrm_wall_tile_remove(void *data)
+{
+	struct tinydrm_wall_tile *tile = data;
+
+	mutex_lock(&tinydrm_wall_lock);
+	list_del(&tile->list);
+	mutex_unlock(&tinydrm_wall_lock);
+}
+
+/**
+ * devm_tinydrm_wall_tile_add - Make a panel available to a video wall
+ * @dev: Panel device
+ * @tile: Tile with &tinydrm_wall_tile->funcs and the size filled in
+ *
+ * The wall probe is deferred until all its tiles are added. A device link
+ * makes sure the wall is unbound before any of its panels.
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int devm_tinydrm_wall_tile_add(struct device *dev,
+			       struct tinydrm_wall_tile *tile)
+{
+	tile->dev = dev;
+
+	mutex_lock(&tinydrm_wall_lock);
+	list_add_tail(&tile->list, &tinydrm_wall_tiles);
+	mutex_unlock(&tinydrm_wall_lock);
+
+	return devm_add_action_or_reset(dev, tinydrm_wall_tile_remove, tile);
+}
+EXPORT_SYMBOL(devm_tinydrm_wall_tile_add);
+
+static void tinydrm_wall_work(struct work_struct *work)
+{
+	struct tinydrm_wall_tile *tile = container_of(work,
+						      struct tinydrm_wall_tile,
+						      work);
+	struct tinydrm_wall *wall = tile->wall;
+
+	switch (tile->op) {
+	case TINYDRM_WALL_FLUSH:
+		tile->ret = tile->funcs->flush(tile, tile->fb, &tile->clip);
+		break;
+	case TINYDRM_WALL_ENABLE:
+		tile->funcs->enable(tile);
+		break;
+	case TINYDRM_WALL_DISABLE:
+		tile->funcs->disable(tile);
+		break;
+	}
+
+	if (atomic_dec_and_test(&wall->pending))
+		wake_up(&wall->done);
+}
+
+static void tinydrm_wall_queue(struct tinydrm_wall *wall,
+			       struct tinydrm_wall_tile *tile,
+			       enum tinydrm_wall_op op)
+{
+	tile->op = op;
+	tile->ret = 0;
+	atomic_inc(&wall->pending);
+	queue_work(tile->wq, &tile->work);
+}
+
+static void tinydrm_wall_run(struct tinydrm_wall *wall,
+			     enum tinydrm_wall_op op)
+{
+	unsigned int i;
+
+	for (i = 0; i < wall->num_tiles; i++)
+		tinydrm_wall_queue(wall, wall->tiles[i], op);
+
+	wait_event(wall->done, !atomic_read(&wall->pending));
+}
+
+/* Bounding box of the damage inside @tile, false if there is none */
+static bool tinydrm_wall_tile_damage(struct tinydrm_wall_tile *tile,
+				     unsigned int flags,
+				     struct drm_clip_rect *clips,
+				     unsigned int num_clips)
+{
+	struct drm_clip_rect *damage = &tile->clip;
+	unsigned int x2 = tile->x + tile->width;
+	unsigned int y2 = tile->y + tile->height;
+	struct drm_clip_rect r;
+	bool found = false;
+	unsigned int i;
+
+	if (!clips || !num_clips) {
+		damage->x1 = tile->x;
+		damage->y1 = tile->y;
+		damage->x2 = x2;
+		damage->y2 = y2;
+		return true;
+	}
+
+	for (i = 0; i < num_clips; i++) {
+		if (flags & DRM_MODE_FB_DIRTY_ANNOTATE_COPY)
+			i++;
+
+		r.x1 = max_t(unsigned int, clips[i].x1, tile->x);
+		r.y1 = max_t(unsigned int, clips[i].y1, tile->y);
+		r.x2 = min_t(unsigned int, clips[i].x2, x2);
+		r.y2 = min_t(unsigned int, clips[i].y2, y2);
+		if (r.x1 >= r.x2 || r.y1 >= r.y2)
+			continue;
+
+		if (!found) {
+			*damage = r;
+			found = true;
+			continue;
+		}
+
+		damage->x1 = min(damage->x1, r.x1);
+		damage->y1 = min(damage->y1, r.y1);
+		damage->x2 = max(damage->x2, r.x2);
+		damage->y2 = max(damage->y2, r.y2);
+	}
+
+	return found;
+}
+
+static int tinydrm_wall_fb_dirty(struct drm_framebuffer *fb,
+				 struct drm_file *file_priv,
+				 unsigned int flags, unsigned int color,
+				 struct drm_clip_rect *clips,
+				 unsigned int num_clips)
+{
+	struct tinydrm_device *tdev = fb->dev->dev_private;
+	struct tinydrm_wall *wall = tinydrm_to_wall(tdev);
+	struct tinydrm_wall_tile *tile;
+	unsigned int i;
+	int ret = 0;
+
+	mutex_lock(&tdev->dirty_lock);
+
+	if (!wall->enabled)
+		goto out_unlock;
+
+	/* fbdev can flush even when we're not interested */
+	if (tdev->pipe.plane.fb != fb)
+		goto out_unlock;
+
+	for (i = 0; i < wall->num_tiles; i++) {
+		tile = wall->tiles[i];
+		tile->fb = NULL;
+		if (!tinydrm_wall_tile_damage(tile, flags, clips, num_clips))
+			continue;
+
+		DRM_DEBUG("Flushing [FB:%d] tile %u: x1=%u, x2=%u, y1=%u, y2=%u\n",
+			  fb->base.id, i, tile->clip.x1, tile->clip.x2,
+			  tile->clip.y1, tile->clip.y2);
+
+		tile->fb = fb;
+		tinydrm_wall_queue(wall, tile, TINYDRM_WALL_FLUSH);
+	}
+
+	/* The frame barrier */
+	wait_event(wall->done, !atomic_read(&wall->pending));
+
+	for (i = 0; i < wall->num_tiles && !ret; i++) {
+		if (wall->tiles[i]->fb)
+			ret = wall->tiles[i]->ret;
+	}
+
+out_unlock:
+	mutex_unlock(&tdev->dirty_lock);
+
+	if (ret)
+		dev_err_once(fb->dev->dev, "Failed to update display %d\n",
+			     ret);
+
+	return ret;
+}
+
+static const struct drm_framebuffer_funcs tinydrm_wall_fb_funcs = {
+	.destroy	= drm_gem_fb_destroy,
+	.create_handle	= drm_gem_fb_create_handle,
+	.dirty		= tinydrm_wall_fb_dirty,
+};
+
+static void tinydrm_wall_pipe_enable(struct drm_simple_display_pipe *pipe,
+				     struct drm_crtc_state *crtc_state)
+{
+	struct tinydrm_device *tdev = pipe_to_tinydrm(pipe);
+	struct tinydrm_wall *wall = tinydrm_to_wall(tdev);
+	struct drm_framebuffer *fb = pipe->plane.state->fb;
+
+	DRM_DEBUG_KMS("\n");
+
+	/* The panels are initialized in parallel as well */
+	tinydrm_wall_run(wall, TINYDRM_WALL_ENABLE);
+
+	mutex_lock(&tdev->dirty_lock);
+	wall->enabled = true;
+	mutex_unlock(&tdev->dirty_lock);
+
+	if (fb)
+		fb->funcs->dirty(fb, NULL, 0, 0, NULL, 0);
+}
+
+static void tinydrm_wall_pipe_disable(struct drm_simple_display_pipe *pipe)
+{
+	struct tinydrm_device *tdev = pipe_to_tinydrm(pipe);
+	struct tinydrm_wall *wall = tinydrm_to_wall(tdev);
+
+	DRM_DEBUG_KMS("\n");
+
+	mutex_lock(&tdev->dirty_lock);
+	wall->enabled = false;
+	mutex_unlock(&tdev->dirty_lock);
+
+	tinydrm_wall_run(wall, TINYDRM_WALL_DISABLE);
+}
+
+static const struct drm_simple_display_pipe_funcs tinydrm_wall_pipe_funcs = {
+	.enable = tinydrm_wall_pipe_enable,
+	.disable = tinydrm_wall_pipe_disable,
+	.update = tinydrm_display_pipe_damage_update,
+	.prepare_fb = tinydrm_display_pipe_prepare_fb,
+};
+
+static const uint32_t tinydrm_wall_formats[] = {
+	DRM_FORMAT_RGB565,
+	DRM_FORMAT_XRGB8888,
+};
+
+static struct tinydrm_wall_tile *tinydrm_wall_find_tile(struct device_node *np)
+{
+	struct tinydrm_wall_tile *tile;
+
+	list_for_each_entry(tile, &tinydrm_wall_tiles, list) {
+		if (tile->dev->of_node == np)
+			return tile;
+	}
+
+	return NULL;
+}
+
+static void tinydrm_wall_release(void *data)
+{
+	struct tinydrm_wall *wall = data;
+	struct tinydrm_wall_tile *tile;
+	unsigned int i;
+
+	mutex_lock(&tinydrm_wall_lock);
+	for (i = 0; i < wall->num_tiles; i++) {
+		tile = wall->tiles[i];
+		if (tile->wq)
+			destroy_workqueue(tile->wq);
+		tile->wq = NULL;
+		tile->wall = NULL;
+	}
+	mutex_unlock(&tinydrm_wall_lock);
+}
+
+static int tinydrm_wall_add_tiles(struct device *dev,
+				  struct tinydrm_wall *wall,
+				  unsigned int count, unsigned int columns)
+{
+	struct tinydrm_wall_tile *tile;
+	struct device_node *panel;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		panel = of_parse_phandle(dev->of_node, "panels", i);
+		if (!panel)
+			return -EINVAL;
+		tile = tinydrm_wall_find_tile(panel);
+		of_node_put(panel);
+		if (!tile)
+			return -EPROBE_DEFER;
+
+		if (tile->wall) {
+			DRM_DEV_ERROR(dev, "%s is already in a wall\n",
+				      dev_name(tile->dev));
+			return -EBUSY;
+		}
+
+		if (i && (tile->width != wall->tiles[0]->width ||
+			  tile->height != wall->tiles[0]->height)) {
+			DRM_DEV_ERROR(dev, "Panels must be the same size\n");
+			return -EINVAL;
+		}
+
+		if (!device_link_add(dev, tile->dev, DL_FLAG_AUTOREMOVE))
+			return -EINVAL;
+
+		tile->wq = alloc_ordered_workqueue("%s", WQ_HIGHPRI,
+						   dev_name(tile->dev));
+		if (!tile->wq)
+			return -ENOMEM;
+
+		INIT_WORK(&tile->work, tinydrm_wall_work);
+		tile->x = (i % columns) * tile->width;
+		tile->y = (i / columns) * tile->height;
+		tile->wall = wall;
+		wall->tiles[wall->num_tiles++] = tile;
+	}
+
+	return 0;
+}
+
+static int tinydrm_wall_pipe_init(struct tinydrm_wall *wall,
+				  unsigned int width, unsigned int height)
+{
+	struct tinydrm_device *tdev = &wall->tinydrm;
+	struct drm_display_mode mode = {
+		TINYDRM_MODE(width, height, 0, 0),
+	};
+	int ret;
+
+	ret = tinydrm_display_pipe_init(tdev, &tinydrm_wall_pipe_funcs,
+					DRM_MODE_CONNECTOR_VIRTUAL,
+					tinydrm_wall_formats,
+					ARRAY_SIZE(tinydrm_wall_formats), &mode,
+					0);
+	if (ret)
+		return ret;
+
+	return tinydrm_plane_enable_fb_damage_clips(&tdev->pipe.plane);
+}
+
+/**
+ * devm_tinydrm_wall_init - Initialize a video wall
+ * @dev: Wall device
+ * @wall: Wall structure to initialize
+ * @driver: DRM driver
+ *
+ * Looks up the panels in the "panels" property and sets up a display pipe
+ * spanning all of them. Returns -EPROBE_DEFER until every panel has been
+ * added with devm_tinydrm_wall_tile_add().
+ *
+ * Returns:
+ * Zero on success, negative error code on failure.
+ */
+int devm_tinydrm_wall_init(struct device *dev, struct tinydrm_wall *wall,
+			   struct drm_driver *driver)
+{
+	struct tinydrm_device *tdev = &wall->tinydrm;
+	unsigned int rows, width, height;
+	u32 columns;
+	int count, ret;
+
+	count = of_count_phandle_with_args(dev->of_node, "panels", NULL);
+	if (count <= 0 || count > TINYDRM_WALL_MAX_TILES) {
+		DRM_DEV_ERROR(dev, "Need 1 to %u panels\n",
+			      TINYDRM_WALL_MAX_TILES);
+		return -EINVAL;
+	}
+
+	columns = count;
+	device_property_read_u32(dev, "columns", &columns);
+	if (!columns || count % columns) {
+		DRM_DEV_ERROR(dev, "Can't have %d panels in %u columns\n",
+			      count, columns);
+		return -EINVAL;
+	}
+	rows = count / columns;
+
+	atomic_set(&wall->pending, 0);
+	init_waitqueue_head(&wall->done);
+
+	ret = devm_add_action(dev, tinydrm_wall_release, wall);
+	if (ret)
+		return ret;
+
+	mutex_lock(&tinydrm_wall_lock);
+	ret = tinydrm_wall_add_tiles(dev, wall, count, columns);
+	mutex_unlock(&tinydrm_wall_lock);
+	if (ret)
+		return ret;
+
+	width = columns * wall->tiles[0]->width;
+	height = rows * wall->tiles[0]->height;
+
+	ret = devm_tinydrm_init(dev, tdev, &tinydrm_wall_fb_funcs, driver);
+	if (ret)
+		return ret;
+
+	ret = tinydrm_wall_pipe_init(wall, width, height);
+	if (ret)
+		return ret;
+
+	tdev->drm->mode_config.preferred_depth = 16;
+
+	drm_mode_config_reset(tdev->drm);
+
+	DRM_DEBUG_KMS("%u panels, %ux%u\n", wall->num_tiles, width, height);
+
+	return 0;
+}
+EXPORT_SYMBOL(devm_tinydrm_wall_init);
@@ -0,0 +1,94 @@
+/*
+ * DRM driver for video walls made of several SPI panels
+ *
+ * Copyright (C) 2018 The tinydrm contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/of.h>
+#include <linux/platform_device.h>
+
+#include <drm/drm_fb_helper.h>
+#include <drm/drm_gem_cma_helper.h>
+#include <drm/tinydrm/tinydrm.h>
+#include <drm/tinydrm/tinydrm-helpers2.h>
+#include <drm/tinydrm/tinydrm-wall.h>
+
+DEFINE_DRM_GEM_CMA_FOPS(video_wall_fops);
+
+static struct drm_driver video_wall_driver = {
+    .driver_features = DRIVER_GEM | DRIVER_MODESET | DRIVER_PRIME |
+                       DRIVER_ATOMIC,
+    .fops = &video_wall_fops,
+    TINYDRM_GEM_DRIVER_OPS,
+    .lastclose = tinydrm_lastclose,
+    .name = "video-wall",
+    .desc = "Tiled multi-panel display",
+    .date = "20180520",
+    .major = 1,
+    .minor = 0,
+};
+
+static const struct of_device_id video_wall_of_match[] = {
+    {.compatible = "video-wall"},
+    {},
+};
+MODULE_DEVICE_TABLE(of, video_wall_of_match);
+
+static int video_wall_probe(struct platform_device *pdev)
+{
+    struct device *dev = &pdev->dev;
+    struct tinydrm_wall *wall;
+    struct tinydrm_device *tdev;
+    int ret;
+
+    wall = devm_kzalloc(dev, sizeof(*wall), GFP_KERNEL);
+    if (!wall)
+        return -ENOMEM;
+
+    /* Deferred until all the panels have probed */
+    ret = devm_tinydrm_wall_init(dev, wall, &video_wall_driver);
+    if (ret)
+        return ret;
+
+    tdev = &wall->tinydrm;
+
+    platform_set_drvdata(pdev, wall);
+
+    ret = devm_tinydrm_register(tdev);
+    if (ret)
+        return ret;
+
+    tinydrm_fbdev_init_deferred_io(tdev);
+
+    DRM_DEBUG_DRIVER("Initialized %s:%s with %u panels on minor %d\n",
+                     tdev->drm->driver->name, dev_name(dev),
+                     wall->num_tiles, tdev->drm->primary->index);
+
+    return 0;
+}
+
+static void video_wall_shutdown(struct platform_device *pdev)
+{
+    struct tinydrm_wall *wall = platform_get_drvdata(pdev);
+
+    tinydrm_shutdown(&wall->tinydrm);
+}
+
+static struct platform_driver video_wall_platform_driver = {
+    .driver = {
+        .name = "video-wall",
+        .of_match_table = video_wall_of_match,
+    },
+    .probe = video_wall_probe,
+    .shutdown = video_wall_shutdown,
+};
+module_platform_driver(video_wall_platform_driver);
+
+MODULE_DESCRIPTION("Tiled multi-panel DRM driver");
+MODULE_LICENSE("GPL");